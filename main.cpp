@@ -9,7 +9,32 @@
 #include <cmath>
 #include <chrono>
 #include <map>
+#include <deque>
 #include <fstream> 
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <ctime>
+#include <sys/resource.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 
 const int SCREEN_WIDTH = 900;
@@ -19,21 +44,130 @@ const int TILE_SIZE = 100;
 const int TILE_MARGIN = 15;
 const int BOARD_MARGIN = 10;
 const int HEADER_HEIGHT = 150;
+const int PLAYER_HEADER_SPACE = 70; // Below each multiplayer board: gap, player name and score, gap
+static_assert(BOARD_SIZE * BOARD_SIZE <= 16, "dirty-cell masks are 16 bits wide");
 const char* FONT_PATH = "assets/fonts/arial.ttf";
 const char* SAVE_FILE_SINGLE_PATH = "2048_save_single.dat"; 
 const char* SAVE_FILE_MULTI_PATH = "2048_save_multi.dat"; 
+const char* HISTORY_FILE_SINGLE_PATH = "2048_history_single.dat"; // Undo histories, saved less often than the game
+const char* HISTORY_FILE_MULTI_PATH = "2048_history_multi.dat";
+const char* LATENCY_LOG_PATH = "2048_latency.log"; // Input latency summary appended after every session
+const char* NTUPLE_WEIGHTS_PATH = "2048_ntuple.dat"; // Trained value network, loaded by the AI when present
 
 const float ANIMATION_DURATION = 0.02f;  
 const float NEW_TILE_DELAY = 0.04f;
 const float NEW_TILE_ANIMATION_DURATION = 0.1f;
 const float MERGE_ANIMATION_DURATION = 0.05f;
 
+// Animation clock: time advances in fixed steps, frames render between the last two steps
+const float ANIMATION_STEP = 1.0f / 240.0f;
+const float MAX_ANIMATION_FRAME_TIME = 0.25f; // Longer stalls are not caught up
+const int MAX_TILE_ANIMATIONS = BOARD_SIZE * BOARD_SIZE; // A move slides at most one tile per cell
+const int HISTORY_CAPACITY = 2048; // Undo steps kept per player; the oldest are dropped first
+const int MAX_PLAYERS = 8; // Local multiplayer boards
+const int DEFAULT_PLAYER_COUNT = 2;
+const size_t MAX_QUEUED_KEYS = 8; // Keys pressed during an animation that are kept for replay
+const int DEFAULT_REFRESH_RATE = 60; // Used when SDL does not report the display refresh rate
+const Uint32 LOGIC_TICK_MS = 1; // Logic thread sleep between updates
+const size_t INPUT_EVENT_QUEUE_SIZE = 256; // Events in flight from the render thread to the logic thread
+const int NETWORK_DEFAULT_PORT = 20480; // --host / --join without a port
+const Uint32 NETWORK_PING_INTERVAL_MS = 500; // Round trip probes during a networked game
+const size_t NETWORK_MAX_SEND_BUFFER = 64 * 1024; // Unsent bytes before a peer that stopped reading is dropped
+const int SERVER_DEFAULT_PORT = 20481; // --server / --load-test without a port
+const int SERVER_EPOLL_EVENTS = 256; // Socket events handled per epoll_wait
+const int SERVER_REPORT_INTERVAL_MS = 5000; // Load line printed by --server
+const size_t SERVER_MAX_LINE = 256; // Longer requests close the connection
+const size_t SERVER_MAX_OUTPUT = 64 * 1024; // Unsent responses before a client that stopped reading is dropped
+const size_t BOT_MAX_OUTPUT = 64 * 1024; // Unwritten answers before a bot agent that stopped reading is disconnected
+const int LOAD_TEST_DEFAULT_SESSIONS = 1000;
+const int LOAD_TEST_DEFAULT_MOVES = 200; // Moves per session
+const int LOAD_TEST_MAX_CONNECTIONS = 64; // Sessions share this many connections
+const int ENV_MIN_BOARDS_PER_THREAD = 16384; // Smaller batch env calls run on the calling thread
+const int ENV_BENCHMARK_DEFAULT_BOARDS = 65536; // --env-benchmark
+const int ENV_BENCHMARK_DEFAULT_STEPS = 200;
+const int MONTE_CARLO_DEFAULT_PLAYOUTS = 200; // Playouts per legal direction
+const int MONTE_CARLO_DEFAULT_BUDGET_MS = 100; // Time budget per move, 0 = none
+const int MONTE_CARLO_PLAYOUT_BATCH = 4; // Playouts a thread claims between clock checks
+const int MONTE_CARLO_BENCHMARK_POSITIONS = 20; // --mc-benchmark
+const int NTUPLE_DEFAULT_EPOCHS = 10; // --train-ntuple
+const int NTUPLE_DEFAULT_EPOCH_GAMES = 2000;
+const float NTUPLE_LEARNING_RATE = 0.0025f; // Per weight; a value sums 40 weights
+
+const float HEADLESS_FRAME_DT = 1.0f / 60.0f; // Frame time fed to the animation clock by --headless-render
+const unsigned int HEADLESS_DEFAULT_SEED = 2048;
+const int HEADLESS_MAX_ANIMATION_FRAMES = 120; // Safety cap while waiting for an animation to finish
+const int BENCHMARK_DEFAULT_MOVES = 2000; // Moves replayed per screen by --render-benchmark
+const int RULE_CHECK_DEFAULT_BOARDS = 100000; // --check-rules
+
+const int PROFILER_HISTORY_SIZE = 240; // Frames kept for the profiler overlay histogram
+const float FRAME_BUDGET_MS = 1000.0f / 60.0f;
+
 const char* SOUND_BUTTON = "assets/sounds/button.wav";
 const char* SOUND_MOVE = "assets/sounds/move.wav";
 const char* SOUND_MERGE = "assets/sounds/merge.wav";
 const char* SOUND_MERGE_NEW = "assets/sounds/merge_new.wav";
 const char* SOUND_GAMEOVER = "assets/sounds/gameover.wav";
+const int DEFAULT_AUDIO_CHUNK_SIZE = 2048; // Mix_OpenAudio buffer in samples; smaller means lower latency but more CPU
+const int MAX_VOICES_PER_SOUND = 2; // Channels per sound effect; the oldest voice is cut off when all are busy
+const char* ASSET_DIR_ENV = "GAME2048_ASSET_DIR"; // Directory whose files override the embedded assets
+
+// Asset pack: built with -DEMBED_ASSETS (from the repository root), the font and sounds are
+// linked into the executable by the assembler's .incbin and read from memory, so the game
+// runs as a single file without touching the filesystem. Assets missing at build time are
+// left out and their sound stays silent.
+#ifdef EMBED_ASSETS
+#ifdef __APPLE__
+#define ASSET_SECTION ".const_data"
+#define ASSET_SYMBOL(name) "_" #name
+#else
+#define ASSET_SECTION ".section .rodata"
+#define ASSET_SYMBOL(name) #name
+#endif
+
+#define EMBED_ASSET(name, path) \
+extern "C" const unsigned char name##Start[]; \
+extern "C" const unsigned char name##End[]; \
+__asm__(ASSET_SECTION "\n" \
+        ".globl " ASSET_SYMBOL(name##Start) "\n" \
+        ".balign 16\n" \
+        ASSET_SYMBOL(name##Start) ":\n" \
+        ".incbin \"" path "\"\n" \
+        ".globl " ASSET_SYMBOL(name##End) "\n" \
+        ASSET_SYMBOL(name##End) ":\n" \
+        ".text\n")
+
+// assets/fonts/arial.ttf is only a placeholder note; the font itself is arial.ttf in the root
+#if __has_include("arial.ttf")
+EMBED_ASSET(embeddedFont, "arial.ttf");
+#endif
+#if __has_include("assets/sounds/button.wav")
+EMBED_ASSET(embeddedButtonSound, "assets/sounds/button.wav");
+#endif
+#if __has_include("assets/sounds/move.wav")
+EMBED_ASSET(embeddedMoveSound, "assets/sounds/move.wav");
+#endif
+#if __has_include("assets/sounds/merge.wav")
+EMBED_ASSET(embeddedMergeSound, "assets/sounds/merge.wav");
+#endif
+#if __has_include("assets/sounds/merge_new.wav")
+EMBED_ASSET(embeddedMergeNewSound, "assets/sounds/merge_new.wav");
+#endif
+#if __has_include("assets/sounds/gameover.wav")
+EMBED_ASSET(embeddedGameoverSound, "assets/sounds/gameover.wav");
+#endif
+#endif
+
+
+enum SoundEffect {
+SOUND_EFFECT_BUTTON,
+SOUND_EFFECT_MOVE,
+SOUND_EFFECT_MERGE,
+SOUND_EFFECT_MERGE_NEW,
+SOUND_EFFECT_GAMEOVER,
+SOUND_EFFECT_COUNT
+};
 
+const char* SOUND_PATHS[SOUND_EFFECT_COUNT] = {SOUND_BUTTON, SOUND_MOVE, SOUND_MERGE, SOUND_MERGE_NEW, SOUND_GAMEOVER};
 
 enum GameState {
 MENU,
@@ -45,28 +179,122 @@ HOW_TO_PLAY
 };
 
 
-enum PlayerTurn {
-PLAYER_ONE,
-PLAYER_TWO
+// Keyboard controls of one local player in multiplayer
+struct PlayerControls {
+SDL_Keycode up, left, down, right;
+SDL_Keycode undo, redo;
+const char* name; // Shown next to the player on the multiplayer screen
+};
+
+const PlayerControls PLAYER_CONTROLS[MAX_PLAYERS] = {
+{SDLK_w, SDLK_a, SDLK_s, SDLK_d, SDLK_q, SDLK_e, "WASD"},
+{SDLK_UP, SDLK_LEFT, SDLK_DOWN, SDLK_RIGHT, SDLK_LEFTBRACKET, SDLK_RIGHTBRACKET, "Arrows"},
+{SDLK_i, SDLK_j, SDLK_k, SDLK_l, SDLK_u, SDLK_o, "IJKL"},
+{SDLK_t, SDLK_f, SDLK_g, SDLK_h, SDLK_5, SDLK_6, "TFGH"},
+{SDLK_KP_8, SDLK_KP_4, SDLK_KP_5, SDLK_KP_6, SDLK_KP_7, SDLK_KP_9, "Numpad"},
+{SDLK_HOME, SDLK_DELETE, SDLK_END, SDLK_PAGEDOWN, SDLK_INSERT, SDLK_PAGEUP, "Home/End"},
+{SDLK_x, SDLK_z, SDLK_c, SDLK_v, SDLK_1, SDLK_2, "ZXCV"},
+{SDLK_m, SDLK_n, SDLK_COMMA, SDLK_PERIOD, SDLK_9, SDLK_0, "NM,."}
+};
+
+// True for the four move keys of a player (not undo/redo)
+bool isMoveKey(const PlayerControls& controls, SDL_Keycode key) {
+return key == controls.up || key == controls.left || key == controls.down || key == controls.right;
+}
+
+
+// Animations of one board as a fixed-capacity struct of arrays. Moving tiles fill the first
+// moveCount slots; merged and new tiles are only flagged per cell. Masks hold one bit per
+// cell (row * BOARD_SIZE + col), so checking whether a cell is animated is a single test.
+struct AnimationPool {
+int moveCount;
+int startRow[MAX_TILE_ANIMATIONS];
+int startCol[MAX_TILE_ANIMATIONS];
+int endRow[MAX_TILE_ANIMATIONS];
+int endCol[MAX_TILE_ANIMATIONS];
+int value[MAX_TILE_ANIMATIONS];
+Uint16 moveCells;   // Start and end cells of the moving tiles
+Uint16 mergedCells; // Merge destinations (scale pulse)
+Uint16 newCells;    // Spawned tiles (pop-up)
+};
+
+// Tile spawn random engine (splitmix64). Its whole position is one 64-bit state, so an
+// undo entry can store it and an undone move spawns the same tile when it is repeated.
+// Works with the std distributions and std::shuffle.
+class TileRng {
+public:
+typedef Uint64 result_type;
+
+explicit TileRng(Uint64 seedValue = 0) : state(seedValue) {}
+
+void seed(Uint64 seedValue) { state = seedValue; }
+
+static constexpr result_type min() { return 0; }
+static constexpr result_type max() { return ~static_cast<Uint64>(0); }
+
+result_type operator()() {
+    Uint64 z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+Uint64 state;
+};
+
+// One state of a board's undo history: the board packed 4 bits per cell (log2 of the tile,
+// 0 = empty, cell row * BOARD_SIZE + col in bits 4 * cell), the score and the RNG position
+struct HistoryEntry {
+Uint64 board;
+Uint64 rngState;
+int score;
+};
+
+// Fixed-capacity undo/redo ring of board states, oldest first from start. cursor is the
+// state currently on the board: undo moves it back, redo forward, and a new move drops the
+// states after it. When the ring is full the oldest state is overwritten.
+struct MoveHistory {
+HistoryEntry entries[HISTORY_CAPACITY];
+int start;
+int count;
+int cursor;
 };
 
 
-enum AnimationState {
-NONE,
-MOVING,
-APPEARING,
-MERGING
+// Animation clock of one board. Time advances in fixed steps; elapsed is the time since
+// the move started as rendered this frame, interpolated between the last two steps.
+struct AnimationTimeline {
+bool active;
+float elapsed;
+float time;
+float previousTime;
+float accumulator;
+std::chrono::steady_clock::time_point lastFrameTime;
 };
 
 
-struct TileAnimation {
-int startRow, startCol;
-int endRow, endCol;
-float startTime;
-float progress;
-AnimationState state;
-bool merged;
-int value;
+// Everything one board owns. Single player plays players[0]; multiplayer the first
+// playerCount entries. Each board has its own animation timeline so that in multiplayer
+// one player's animation never blocks another player's input.
+struct PlayerState {
+std::vector<std::vector<int> > board;
+std::vector<std::vector<int> > previousBoard; // For animation
+int score;
+bool gameOver; // No moves left (multiplayer)
+bool won;
+AnimationTimeline animationTimeline;
+AnimationPool animationPool;
+MoveHistory moveHistory;
+TileRng rng; // Tile spawns of this board; its history entries store the position
+};
+
+// The part of a PlayerState the renderer needs
+struct PlayerSnapshot {
+std::vector<std::vector<int> > board;
+int score;
+bool won;
+AnimationTimeline animationTimeline;
+AnimationPool animationPool;
 };
 
 
@@ -82,6 +310,44 @@ Uint8 r, g, b;
 };
 
 
+// Persistent texture for a piece of rendered text
+struct TextTexture {
+SDL_Texture* texture;
+int w, h;
+};
+
+
+// Pre-rendered glyphs 0-9 for one font, used to draw numbers without any TTF calls
+struct DigitAtlas {
+SDL_Texture* texture;
+SDL_Rect glyphs[10];
+int height;
+};
+
+
+// Position and tile metrics of one board on screen
+struct BoardLayout {
+int x, y;
+int width, height;
+int tileSize;
+int tileMargin;
+};
+
+
+// Key for the label cache: font, text and packed RGBA color
+struct LabelKey {
+TTF_Font* font;
+std::string text;
+Uint32 color;
+
+bool operator<(const LabelKey& other) const {
+    if (font != other.font) return font < other.font;
+    if (color != other.color) return color < other.color;
+    return text < other.text;
+}
+};
+
+
 const Color BACKGROUND_COLOR = {250, 248, 239}; // Light cream background
 const Color BOARD_COLOR = {187, 173, 160}; // Tan board background
 const Color EMPTY_TILE_COLOR = {205, 193, 180}; // Empty tile color
@@ -121,6 +387,13 @@ return colors;
 
 const std::vector<Color> TILE_COLORS = initTileColors();
 
+// Helper function to pick the color of a tile value
+Color getTileColor(int value) {
+if (value == 0) return EMPTY_TILE_COLOR;
+int colorIndex = std::min(static_cast<int>(log2(value)) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
+return TILE_COLORS[colorIndex];
+}
+
 // Helper function to convert our Color to SDL_Color
 SDL_Color toSDLColor(const Color& color, Uint8 a = 255) {
 SDL_Color sdlColor;
@@ -136,6 +409,515 @@ bool isPointInRect(int x, int y, const SDL_Rect& rect) {
 return (x >= rect.x && x < rect.x + rect.w && y >= rect.y && y < rect.y + rect.h);
 }
 
+// Script used by --headless-render when no script file is given:
+// a short single player game followed by a short multiplayer game
+const char* HEADLESS_DEFAULT_SCRIPT =
+    "single left up right down left up right down frames 10 "
+    "multi a left w up d right s down a left frames 10";
+
+// Frames produced by a headless run: pixel hashes (when hashing), frame times and draw calls
+struct HeadlessRun {
+bool hashFrames;
+std::vector<Uint64> frameHashes;
+std::vector<float> frameMs;
+std::vector<int> drawCalls;
+};
+
+// Peak resident set size of the process in KB
+long getPeakRssKb() {
+struct rusage usage;
+getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+return usage.ru_maxrss / 1024; // macOS reports bytes
+#else
+return usage.ru_maxrss;
+#endif
+}
+
+// 64-bit FNV-1a hash of the visible pixels of a surface (row padding is skipped)
+Uint64 hashSurfacePixels(SDL_Surface* surface) {
+Uint64 hash = 14695981039346656037ULL;
+if (SDL_MUSTLOCK(surface)) SDL_LockSurface(surface);
+const Uint8* pixels = static_cast<const Uint8*>(surface->pixels);
+int rowBytes = surface->w * surface->format->BytesPerPixel;
+for (int y = 0; y < surface->h; y++) {
+    const Uint8* row = pixels + y * surface->pitch;
+    for (int x = 0; x < rowBytes; x++) {
+        hash ^= row[x];
+        hash *= 1099511628211ULL;
+    }
+}
+if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+return hash;
+}
+
+// Frame phases tracked by the profiler overlay (F3)
+enum FramePhase {
+PHASE_EVENTS,
+PHASE_SNAPSHOT,
+PHASE_BOARD_TEXTURE,
+PHASE_RENDER,
+PHASE_PRESENT,
+PHASE_COUNT // Also used as "no phase"
+};
+
+// Per-frame timings and renderer work counters shown by the profiler overlay
+struct FrameStats {
+double phaseMs[PHASE_COUNT];
+int drawCalls;
+int textureCreations;
+int ttfRenders;
+};
+
+// Global so that free helpers such as drawRoundedRect are counted too
+FrameStats currentFrameStats = {};
+bool profilerEnabled = false;
+FramePhase activePhase = PHASE_COUNT;
+
+// Adds the time spent in a scope to one phase of the current frame. Nested timers are
+// subtracted from the enclosing phase, so each phase reports its own time only.
+// While the profiler is off a timer costs a single flag check.
+class ScopedPhaseTimer {
+public:
+explicit ScopedPhaseTimer(FramePhase timedPhase) 
+    : phase(timedPhase), parentPhase(activePhase), active(profilerEnabled), start(0) {
+    if (active) {
+        activePhase = phase;
+        start = SDL_GetPerformanceCounter();
+    }
+}
+
+~ScopedPhaseTimer() {
+    if (!active) return;
+    
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    currentFrameStats.phaseMs[phase] += ms;
+    if (parentPhase != PHASE_COUNT) {
+        currentFrameStats.phaseMs[parentPhase] -= ms;
+    }
+    activePhase = parentPhase;
+}
+
+private:
+FramePhase phase;
+FramePhase parentPhase;
+bool active;
+Uint64 start;
+};
+
+// Adds the performance counter ticks spent in a scope to a running total
+class ScopedTickCounter {
+public:
+explicit ScopedTickCounter(Uint64& counterTotal) : total(counterTotal), start(SDL_GetPerformanceCounter()) {}
+~ScopedTickCounter() { total += SDL_GetPerformanceCounter() - start; }
+
+private:
+Uint64& total;
+Uint64 start;
+};
+
+// A move on its way from the key press to the screen. SDL event timestamps are in
+// SDL_GetTicks() milliseconds, the later stages use the performance counter.
+struct InputLatency {
+bool active;
+Uint32 eventTicks;
+Uint32 dispatchTicks;
+Uint64 dispatchCounter;
+Uint64 animationStartCounter;
+Uint64 saveTicksAtDispatch;
+Uint64 saveTicks;
+Uint64 appliedCounter;
+Uint64 moveSequence; // First snapshot that shows the move
+};
+
+// Finished input-to-photon measurement, split by where the time went (ms)
+struct LatencySample {
+float eventMs;   // Event timestamp until the game handles it (OS, event queue, key queue)
+float moveMs;    // Move logic and animation setup (CPU)
+float saveMs;    // Synchronous saveGame() during the move (disk)
+float frameMs;   // Move applied until the first frame showing it is drawn
+float presentMs; // SDL_RenderPresent (vsync)
+float totalMs;
+};
+
+// Startup timing printed by --startup-profile (ms). Fonts, save files and sounds load on
+// worker threads while the main thread creates the window and renderer.
+struct StartupProfile {
+double sdlInitMs;     // SDL_Init and TTF_Init (main thread)
+double windowMs;      // Window and renderer (main thread)
+double fontsMs;       // Font worker
+double saveLoadMs;    // Save file worker
+double workerWaitMs;  // Main thread waiting for the font and save file workers
+double audioOpenMs;   // Sound worker: Mix_OpenAudio
+double soundDecodeMs; // Sound worker: WAV decoding
+double firstFrameMs;  // initialize() start until the first frame is presented
+double soundsReadyMs; // initialize() start until the sound worker is done
+};
+
+enum MoveDirection {
+MOVE_LEFT,
+MOVE_RIGHT,
+MOVE_UP,
+MOVE_DOWN
+};
+
+// Networked multiplayer (--host / --join): each process plays its own board and mirrors the
+// opponent's from the moves it receives. A message is one type byte and a fixed-size body
+// (integers little-endian).
+enum NetworkMessage {
+NET_BOARD = 1, // Packed board (8 bytes) and score (4 bytes): a new game or a restart
+NET_MOVE = 2,  // Direction (1 byte) and spawned tile (1 byte: cell << 1, | 1 for a 4, 0xFF for none)
+NET_PING = 3,  // Sender's performance counter (8 bytes)
+NET_PONG = 4   // A PING body sent back
+};
+
+// Body size of a message type, -1 for an unknown type
+int getNetworkBodySize(Uint8 type) {
+switch (type) {
+    case NET_BOARD: return 12;
+    case NET_MOVE: return 2;
+    case NET_PING:
+    case NET_PONG: return 8;
+}
+return -1;
+}
+
+// Connection of a networked game (logic thread only)
+struct NetworkSession {
+bool enabled;
+int listenSocket; // --host: accepts the opponent, -1 otherwise
+int socket;       // Connected opponent, -1 while waiting
+int port;
+std::vector<Uint8> receiveBuffer; // Bytes of incomplete messages
+std::vector<Uint8> sendBuffer;    // Bytes the socket did not take yet
+Uint32 lastPingTicks;
+float rttMs; // Smoothed round trip time, 0 until measured
+};
+
+// A move of the opponent waiting for the first frame that shows it
+struct RemoteMove {
+Uint64 moveSequence;
+Uint64 receivedCounter; // Performance counter when the message was read
+float rttMs;            // Round trip estimate at that time
+};
+
+// Bot control (--bot): an external agent plays the single player game by sending moves and
+// reading the board back, over stdin/stdout or a Unix socket, with or without the window.
+// Text framing, one command per line, each answered by "OK <board> <score> <moved> <over>"
+// (board packed like HistoryEntry, in hex; moved counts the moves that changed the board):
+//   LRUD...   moves in order, any number per line
+//   S         state only
+//   N [seed]  new game, seeded for reproducible runs
+//   Q         end the session
+// Binary framing (--bot-binary): a request is an opcode byte ('M', 'S', 'N', 'Q'), a count
+// byte and count bytes: the MoveDirection of each move for 'M', an optional 8-byte seed for
+// 'N'. The answer is 16 bytes: board (8), score (4), moved (2), over (1), refused (1),
+// little-endian. While the user is on another screen of the window (menu, help) commands
+// other than Q are not run: the text answer is "ERR not playing", the binary one has refused 1.
+struct BotSession {
+bool enabled;
+bool binary;
+int listenSocket; // --bot <path>: Unix socket the agent connects to, -1 for stdin/stdout
+int inputFd;      // -1 while no agent is connected
+int outputFd;
+int stdinFlags;   // stdin and stdout file status flags before O_NONBLOCK, restored by closeBot(); -1 if unchanged
+int stdoutFlags;
+std::string socketPath;
+std::vector<Uint8> input;  // Bytes of an incomplete command
+std::vector<Uint8> output; // Answers not written yet
+};
+
+const int BOT_ANSWER_SIZE = 16; // Binary framing answer
+
+// Unix socket for a bot agent; -1 on error
+int openBotSocket(const std::string& path) {
+sockaddr_un address = {};
+if (path.size() >= sizeof(address.sun_path)) return -1;
+address.sun_family = AF_UNIX;
+std::strcpy(address.sun_path, path.c_str());
+
+int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+if (fd < 0) return -1;
+unlink(path.c_str());
+if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 1) < 0) {
+    close(fd);
+    return -1;
+}
+return fd;
+}
+
+#ifdef MSG_NOSIGNAL
+const int NETWORK_SEND_FLAGS = MSG_NOSIGNAL; // A closed peer is an error, not SIGPIPE
+#else
+const int NETWORK_SEND_FLAGS = 0;
+#endif
+
+void writeLittleEndian(std::vector<Uint8>& out, Uint64 value, int bytes) {
+for (int i = 0; i < bytes; i++) {
+    out.push_back(static_cast<Uint8>(value >> (8 * i)));
+}
+}
+
+Uint64 readLittleEndian(const Uint8* in, int bytes) {
+Uint64 value = 0;
+for (int i = 0; i < bytes; i++) {
+    value |= static_cast<Uint64>(in[i]) << (8 * i);
+}
+return value;
+}
+
+// Non-blocking TCP socket listening on all interfaces; -1 on error
+int openListenSocket(int port) {
+int fd = socket(AF_INET, SOCK_STREAM, 0);
+if (fd < 0) return -1;
+
+int reuse = 1;
+setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+sockaddr_in address = {};
+address.sin_family = AF_INET;
+address.sin_addr.s_addr = htonl(INADDR_ANY);
+address.sin_port = htons(static_cast<uint16_t>(port));
+if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 1) < 0) {
+    close(fd);
+    return -1;
+}
+
+fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+return fd;
+}
+
+// Connect to host:port (blocking, done once at startup); -1 on error
+int connectToHost(const std::string& host, int port) {
+addrinfo hints = {};
+hints.ai_family = AF_UNSPEC;
+hints.ai_socktype = SOCK_STREAM;
+addrinfo* results = nullptr;
+std::string portText = std::to_string(port);
+if (getaddrinfo(host.c_str(), portText.c_str(), &hints, &results) != 0) return -1;
+
+int fd = -1;
+for (addrinfo* candidate = results; candidate != nullptr; candidate = candidate->ai_next) {
+    fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+    if (fd < 0) continue;
+    if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) break;
+    close(fd);
+    fd = -1;
+}
+freeaddrinfo(results);
+return fd;
+}
+
+// Messages are a few bytes each: send them at once (no Nagle) and never block the logic thread
+void configurePeerSocket(int fd) {
+int noDelay = 1;
+setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+#ifdef SO_NOSIGPIPE
+int noSigPipe = 1;
+setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// Milliseconds between two performance counter values
+double getCounterMs(Uint64 startCounter, Uint64 endCounter) {
+return (endCounter - startCounter) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// Value at the given percentile of an unsorted list
+float getPercentile(std::vector<float> values, int percent) {
+if (values.empty()) return 0.0f;
+std::sort(values.begin(), values.end());
+return values[(values.size() - 1) * percent / 100];
+}
+
+// Lock-free triple buffer between one writer and one reader thread. The writer fills
+// writeBuffer() and publishes it; the reader calls update() to pick up the newest published
+// slot and reads it through readBuffer() until its next update(). Neither side ever waits.
+template<typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+    
+    T& writeBuffer() { return slots[back]; }
+    
+    // Swap the written slot into the middle, marked as new
+    void publish() {
+        back = middle.exchange(back | NEW_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+    
+    // Take the middle slot if the writer published since the last update; returns true if so
+    bool update() {
+        if (!(middle.load(std::memory_order_acquire) & NEW_BIT)) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    
+    const T& readBuffer() const { return slots[front]; }
+    
+private:
+    static const int INDEX_MASK = 3;
+    static const int NEW_BIT = 4;
+    
+    T slots[3];
+    std::atomic<int> middle; // Slot index, NEW_BIT set when it holds an unread snapshot
+    int back;  // Writer only
+    int front; // Reader only
+};
+
+// Lock-free single producer, single consumer ring buffer
+template<typename T, size_t N>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {}
+    
+    // Producer side; false when the queue is full
+    bool push(const T& item) {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        size_t nextTail = (currentTail + 1) % N;
+        if (nextTail == head.load(std::memory_order_acquire)) return false;
+        items[currentTail] = item;
+        tail.store(nextTail, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer side; false when the queue is empty
+    bool pop(T& item) {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) return false;
+        item = items[currentHead];
+        head.store((currentHead + 1) % N, std::memory_order_release);
+        return true;
+    }
+    
+private:
+    T items[N];
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+};
+
+// Everything the renderer needs from the game state, copied by the logic thread after every
+// update. Field names match the Game2048 members they are copied from.
+struct GameSnapshot {
+GameState currentState;
+int playerCount;
+PlayerSnapshot players[MAX_PLAYERS]; // The first playerCount are filled
+int bestScore;
+bool gameOver;
+std::vector<Button> menuButtons;
+std::vector<Button> howToPlayButtons;
+std::vector<Button> gameOverButtons;
+std::vector<Button> multiplayerGameOverButtons;
+int mouseX, mouseY;
+Uint64 moveSequence; // Moves applied so far, used to match latency samples to frames
+bool networkEnabled;
+bool networkConnected;
+bool networkHost;
+int networkPort;
+float networkRttMs;
+int hintDirection; // -1 when no hint is shown
+};
+
+// One file of the asset pack, looked up by its on-disk path
+struct EmbeddedAsset {
+const char* path;
+const unsigned char* start;
+const unsigned char* end;
+};
+
+const EmbeddedAsset EMBEDDED_ASSETS[] = {
+#ifdef EMBED_ASSETS
+#if __has_include("arial.ttf")
+{FONT_PATH, embeddedFontStart, embeddedFontEnd},
+#endif
+#if __has_include("assets/sounds/button.wav")
+{SOUND_BUTTON, embeddedButtonSoundStart, embeddedButtonSoundEnd},
+#endif
+#if __has_include("assets/sounds/move.wav")
+{SOUND_MOVE, embeddedMoveSoundStart, embeddedMoveSoundEnd},
+#endif
+#if __has_include("assets/sounds/merge.wav")
+{SOUND_MERGE, embeddedMergeSoundStart, embeddedMergeSoundEnd},
+#endif
+#if __has_include("assets/sounds/merge_new.wav")
+{SOUND_MERGE_NEW, embeddedMergeNewSoundStart, embeddedMergeNewSoundEnd},
+#endif
+#if __has_include("assets/sounds/gameover.wav")
+{SOUND_GAMEOVER, embeddedGameoverSoundStart, embeddedGameoverSoundEnd},
+#endif
+#endif
+{nullptr, nullptr, nullptr}
+};
+
+// True when the game was built with the asset pack
+bool hasEmbeddedAssets() {
+return EMBEDDED_ASSETS[0].path != nullptr;
+}
+
+// Open an asset for reading (the caller passes ownership to TTF_OpenFontRW / Mix_LoadWAV_RW).
+// With GAME2048_ASSET_DIR set the file is read from that directory, for trying out assets
+// without rebuilding. Otherwise the embedded copy is used; builds without the asset pack,
+// and files not in it, read the path relative to the working directory.
+// Returns nullptr if the asset is not available.
+SDL_RWops* openAsset(const char* path) {
+const char* assetDir = SDL_getenv(ASSET_DIR_ENV);
+if (assetDir != nullptr && assetDir[0] != '\0') {
+    std::string overridePath = std::string(assetDir) + "/" + path;
+    return SDL_RWFromFile(overridePath.c_str(), "rb");
+}
+
+for (const EmbeddedAsset* asset = EMBEDDED_ASSETS; asset->path != nullptr; asset++) {
+    if (std::strcmp(asset->path, path) == 0) {
+        return SDL_RWFromConstMem(asset->start, static_cast<int>(asset->end - asset->start));
+    }
+}
+
+// Embedded builds look nothing up on disk: a missing asset stays missing
+if (hasEmbeddedAssets()) {
+    return nullptr;
+}
+return SDL_RWFromFile(path, "rb");
+}
+
+// Renderer calls go through these wrappers, which count the work for the profiler overlay and
+// the headless runs. While counting is off a wrapper costs a single flag check.
+bool renderStatsEnabled = false;
+
+int renderClear(SDL_Renderer* target) {
+if (renderStatsEnabled) currentFrameStats.drawCalls++;
+return SDL_RenderClear(target);
+}
+
+int renderFillRect(SDL_Renderer* target, const SDL_Rect* rect) {
+if (renderStatsEnabled) currentFrameStats.drawCalls++;
+return SDL_RenderFillRect(target, rect);
+}
+
+int renderDrawPoint(SDL_Renderer* target, int x, int y) {
+if (renderStatsEnabled) currentFrameStats.drawCalls++;
+return SDL_RenderDrawPoint(target, x, y);
+}
+
+int renderCopy(SDL_Renderer* target, SDL_Texture* texture, const SDL_Rect* source, const SDL_Rect* destination) {
+if (renderStatsEnabled) currentFrameStats.drawCalls++;
+return SDL_RenderCopy(target, texture, source, destination);
+}
+
+SDL_Texture* createTexture(SDL_Renderer* target, Uint32 format, int access, int w, int h) {
+if (renderStatsEnabled) currentFrameStats.textureCreations++;
+return SDL_CreateTexture(target, format, access, w, h);
+}
+
+SDL_Texture* createTextureFromSurface(SDL_Renderer* target, SDL_Surface* surface) {
+if (renderStatsEnabled) currentFrameStats.textureCreations++;
+return SDL_CreateTextureFromSurface(target, surface);
+}
+
+SDL_Surface* renderTextBlended(TTF_Font* textFont, const char* text, SDL_Color color) {
+if (renderStatsEnabled) currentFrameStats.ttfRenders++;
+return TTF_RenderText_Blended(textFont, text, color);
+}
+
 // Helper function to draw a rounded rectangle
 void drawRoundedRect(SDL_Renderer* renderer, int x, int y, int w, int h, int radius) {
 // Draw the main rectangle (excluding corners)
@@ -144,13 +926,13 @@ rect.x = x + radius;
 rect.y = y;
 rect.w = w - 2 * radius;
 rect.h = h;
-SDL_RenderFillRect(renderer, &rect);
+renderFillRect(renderer, &rect);
 
 rect.x = x;
 rect.y = y + radius;
 rect.w = w;
 rect.h = h - 2 * radius;
-SDL_RenderFillRect(renderer, &rect);
+renderFillRect(renderer, &rect);
 
 // Draw the four corner circles
 int diameter = radius * 2;
@@ -160,13 +942,13 @@ for (int i = 0; i <= diameter; i++) {
         int dy = radius - j;
         if (dx*dx + dy*dy <= radius*radius) {
             // Top-left corner
-            SDL_RenderDrawPoint(renderer, x + i, y + j);
+            renderDrawPoint(renderer, x + i, y + j);
             // Top-right corner
-            SDL_RenderDrawPoint(renderer, x + w - i - 1, y + j);
+            renderDrawPoint(renderer, x + w - i - 1, y + j);
             // Bottom-left corner
-            SDL_RenderDrawPoint(renderer, x + i, y + h - j - 1);
+            renderDrawPoint(renderer, x + i, y + h - j - 1);
             // Bottom-right corner
-            SDL_RenderDrawPoint(renderer, x + w - i - 1, y + h - j - 1);
+            renderDrawPoint(renderer, x + w - i - 1, y + h - j - 1);
         }
     }
 }
@@ -183,3008 +965,6116 @@ float easeInOut(float t) {
 return t < 0.5f ? 2.0f * t * t : 1.0f - pow(-2.0f * t + 2.0f, 2.0f) / 2.0f;
 }
 
-// Game class
-class Game2048 {
-private:
-SDL_Window* window;
-SDL_Renderer* renderer;
-TTF_Font* font;
-TTF_Font* titleFont;
-TTF_Font* menuFont;
-TTF_Font* largeFont;
-std::vector<std::vector<int> > board;
-std::vector<std::vector<int> > boardP2; // Board for player 2
-std::vector<std::vector<int> > previousBoard; // For animation
-std::vector<std::vector<int> > previousBoardP2; // For animation
-int score;
-int scoreP2; // Score for player 2
-int bestScore;
-bool gameOver;
-bool gameOverP2; // Game over state for player 2
-bool won;
-bool wonP2; // Win state for player 2
-std::mt19937 rng;
-GameState currentState;
-PlayerTurn currentPlayer; // Current player in multiplayer mode
-std::vector<Button> menuButtons;
-std::vector<Button> howToPlayButtons;
-std::vector<Button> gameOverButtons;
-std::vector<Button> multiplayerGameOverButtons;
-int mouseX, mouseY;
+// Pack a board into a HistoryEntry board. Returns false if a tile is too large for 4 bits (above 32768).
+bool packBoard(const std::vector<std::vector<int> >& cells, Uint64& packed) {
+packed = 0;
+for (int i = 0; i < BOARD_SIZE; i++) {
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        int exponent = 0;
+        while ((1 << exponent) < cells[i][j]) exponent++;
+        if (exponent > 15) return false;
+        packed |= static_cast<Uint64>(exponent) << (4 * (i * BOARD_SIZE + j));
+    }
+}
+return true;
+}
 
-// Animation related variables
-std::chrono::steady_clock::time_point lastFrameTime;
-float deltaTime;
-bool animating;
-std::vector<TileAnimation> animations;
-std::vector<TileAnimation> animationsP2;
-std::map<std::pair<int, int>, std::pair<int, int>> mergedTiles; // Maps destination to source
-std::map<std::pair<int, int>, std::pair<int, int>> mergedTilesP2;
-std::vector<std::pair<int, int>> newTiles;
-std::vector<std::pair<int, int>> newTilesP2;
-
-// Texture caching for smoother animations
-SDL_Texture* boardTexture;
-bool boardTextureNeedsUpdate;
+void unpackBoard(Uint64 packed, std::vector<std::vector<int> >& cells) {
+for (int i = 0; i < BOARD_SIZE; i++) {
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        int exponent = static_cast<int>((packed >> (4 * (i * BOARD_SIZE + j))) & 0xF);
+        cells[i][j] = (exponent == 0) ? 0 : (1 << exponent);
+    }
+}
+}
 
-// Sound effects
-Mix_Chunk* buttonSound;
-Mix_Chunk* moveSound;
-Mix_Chunk* mergeSound;
-Mix_Chunk* mergeNewSound;
-Mix_Chunk* gameoverSound;
+// Packed board rules for code that keeps many boards (the game server): the same slides,
+// merges, scoring and spawns as the Game2048 move functions, on the HistoryEntry board layout.
+// A row is 16 bits (column 0 in the low nibble); every possible row is looked up in tables
+// built on first use. The packed board has a limit the game does not: 65536 does not fit in
+// 4 bits, so the tables never merge two 32768 tiles. On a board where two of them would meet
+// (hasPackedTileLimit) the packed rules stop matching the game's, and the code using them
+// ends the game there. --check-rules compares these rules with the game's.
+struct PackedRowTables {
+Uint16 left[65536];
+Uint16 right[65536];
+Uint32 leftScore[65536];
+Uint32 rightScore[65536];
+};
 
-// Biến để theo dõi thời gian lưu game tự động
-Uint32 lastAutoSaveTime;
-const Uint32 AUTO_SAVE_INTERVAL = 5000; // Lưu game mỗi 5 giây
+// Slide one row (4 exponents) towards cell 0, merging each tile at most once
+Uint16 slidePackedRow(Uint16 row, Uint32& score) {
+int cells[BOARD_SIZE];
+int count = 0;
+for (int j = 0; j < BOARD_SIZE; j++) {
+    int exponent = (row >> (4 * j)) & 0xF;
+    if (exponent != 0) cells[count++] = exponent;
+}
 
-public:
-Game2048() : window(nullptr), renderer(nullptr), font(nullptr), titleFont(nullptr), 
-             menuFont(nullptr), largeFont(nullptr), score(0), scoreP2(0), bestScore(0), 
-             gameOver(false), gameOverP2(false), won(false), wonP2(false), 
-             currentState(MENU), currentPlayer(PLAYER_ONE), mouseX(0), mouseY(0),
-             deltaTime(0.0f), animating(false), boardTexture(nullptr), boardTextureNeedsUpdate(true),
-             buttonSound(nullptr), moveSound(nullptr), mergeSound(nullptr), 
-             mergeNewSound(nullptr), gameoverSound(nullptr), lastAutoSaveTime(0) {
-    // Initialize random number generator
-    std::random_device rd;
-    rng = std::mt19937(rd());
+Uint16 result = 0;
+int target = 0;
+score = 0;
+for (int k = 0; k < count; k++) {
+    int exponent = cells[k];
+    if (k + 1 < count && cells[k + 1] == exponent && exponent < 15) {
+        exponent++;
+        score += 1u << exponent;
+        k++;
+    }
+    result |= static_cast<Uint16>(exponent << (4 * target++));
+}
+return result;
+}
 
-    // Initialize boards
-    board.resize(BOARD_SIZE);
-    boardP2.resize(BOARD_SIZE);
-    previousBoard.resize(BOARD_SIZE);
-    previousBoardP2.resize(BOARD_SIZE);
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        board[i].resize(BOARD_SIZE, 0);
-        boardP2[i].resize(BOARD_SIZE, 0);
-        previousBoard[i].resize(BOARD_SIZE, 0);
-        previousBoardP2[i].resize(BOARD_SIZE, 0);
+Uint16 reversePackedRow(Uint16 row) {
+return static_cast<Uint16>(((row & 0xF) << 12) | ((row & 0xF0) << 4) | ((row >> 4) & 0xF0) | (row >> 12));
+}
+
+const PackedRowTables& getPackedRowTables() {
+static const PackedRowTables* tables = [] {
+    PackedRowTables* built = new PackedRowTables();
+    for (int row = 0; row < 65536; row++) {
+        Uint16 reversed = reversePackedRow(static_cast<Uint16>(row));
+        built->left[row] = slidePackedRow(static_cast<Uint16>(row), built->leftScore[row]);
+        built->right[row] = reversePackedRow(slidePackedRow(reversed, built->rightScore[row]));
     }
-    
-    // Initialize time
-    lastFrameTime = std::chrono::steady_clock::now();
+    return built;
+}();
+return *tables;
 }
 
-~Game2048() {
-    // Lưu game trước khi thoát
-    saveGame();
-    
-    // Free sound effects
-    if (buttonSound != nullptr) Mix_FreeChunk(buttonSound);
-    if (moveSound != nullptr) Mix_FreeChunk(moveSound);
-    if (mergeSound != nullptr) Mix_FreeChunk(mergeSound);
-    if (mergeNewSound != nullptr) Mix_FreeChunk(mergeNewSound);
-    if (gameoverSound != nullptr) Mix_FreeChunk(gameoverSound);
-    
-    // Close SDL_mixer
-    Mix_CloseAudio();
-    
-    // Giải phóng các texture tĩnh từ renderGameUI
-    static SDL_Texture* bestLabelTexture = nullptr;
-    static SDL_Texture* bestScoreTexture = nullptr;
-    static SDL_Texture* scoreLabelTexture = nullptr;
-    static SDL_Texture* scoreTexture = nullptr;
-    
-    if (bestLabelTexture != nullptr) SDL_DestroyTexture(bestLabelTexture);
-    if (bestScoreTexture != nullptr) SDL_DestroyTexture(bestScoreTexture);
-    if (scoreLabelTexture != nullptr) SDL_DestroyTexture(scoreLabelTexture);
-    if (scoreTexture != nullptr) SDL_DestroyTexture(scoreTexture);
-    
-    if (boardTexture != nullptr) SDL_DestroyTexture(boardTexture);
-    if (font != nullptr) TTF_CloseFont(font);
-    if (titleFont != nullptr) TTF_CloseFont(titleFont);
-    if (menuFont != nullptr) TTF_CloseFont(menuFont);
-    if (largeFont != nullptr) TTF_CloseFont(largeFont);
-    if (renderer != nullptr) SDL_DestroyRenderer(renderer);
-    if (window != nullptr) SDL_DestroyWindow(window);
-    TTF_Quit();
-    Mix_Quit();
-    SDL_Quit();
+// Swap rows and columns, so column moves can use the row tables
+Uint64 transposePackedBoard(Uint64 board) {
+Uint64 a1 = board & 0xF0F00F0FF0F00F0FULL;
+Uint64 a2 = board & 0x0000F0F00000F0F0ULL;
+Uint64 a3 = board & 0x0F0F00000F0F0000ULL;
+Uint64 a = a1 | (a2 << 12) | (a3 >> 12);
+Uint64 b1 = a & 0xFF00FF0000FF00FFULL;
+Uint64 b2 = a & 0x00FF00FF00000000ULL;
+Uint64 b3 = a & 0x00000000FF00FF00ULL;
+return b1 | (b2 >> 24) | (b3 << 24);
 }
 
-// Hàm lưu trạng thái game vào file
-void saveGame() {
-    const char* filePath = (currentState == MULTIPLAYER || currentState == MULTIPLAYER_GAME_OVER) 
-                          ? SAVE_FILE_MULTI_PATH : SAVE_FILE_SINGLE_PATH;
-    
-    std::ofstream saveFile(filePath, std::ios::binary);
-    if (!saveFile.is_open()) {
-        std::cerr << "Không thể mở file để lưu game!" << std::endl;
-        return;
+// Apply a MoveDirection to a packed board and add the merged points to score.
+// The board is returned unchanged if nothing moved.
+Uint64 movePackedBoard(Uint64 board, int direction, Uint32& score) {
+const PackedRowTables& tables = getPackedRowTables();
+bool columns = (direction == MOVE_UP || direction == MOVE_DOWN);
+bool towardsZero = (direction == MOVE_LEFT || direction == MOVE_UP);
+const Uint16* rowTable = towardsZero ? tables.left : tables.right;
+const Uint32* scoreTable = towardsZero ? tables.leftScore : tables.rightScore;
+
+Uint64 lines = columns ? transposePackedBoard(board) : board;
+Uint64 moved = 0;
+for (int i = 0; i < BOARD_SIZE; i++) {
+    Uint16 row = static_cast<Uint16>(lines >> (16 * i));
+    moved |= static_cast<Uint64>(rowTable[row]) << (16 * i);
+    score += scoreTable[row];
+}
+return columns ? transposePackedBoard(moved) : moved;
+}
+
+// Spawn a tile like addRandomTile: a random empty cell, a 2 in 90% of the spawns, else a 4
+Uint64 spawnPackedTile(Uint64 board, TileRng& rng) {
+int emptyCells[BOARD_SIZE * BOARD_SIZE];
+int emptyCount = 0;
+for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+    if (((board >> (4 * cell)) & 0xF) == 0) emptyCells[emptyCount++] = cell;
+}
+if (emptyCount == 0) return board;
+
+std::uniform_int_distribution<int> dist(0, emptyCount - 1);
+int cell = emptyCells[dist(rng)];
+std::uniform_int_distribution<int> valueDist(0, 9);
+Uint64 exponent = (valueDist(rng) < 9) ? 1 : 2;
+return board | (exponent << (4 * cell));
+}
+
+// Bit 0 of each nibble of the result is set where the nibble of value is not 0
+Uint64 getNonZeroNibbles(Uint64 value) {
+value |= value >> 1;
+value |= value >> 2;
+return value & 0x1111111111111111ULL;
+}
+
+// Bit 0 of each nibble of the result is set where the nibble of value is 15 (a 32768 tile)
+Uint64 getMaxNibbles(Uint64 value) {
+return value & (value >> 1) & (value >> 2) & (value >> 3) & 0x1111111111111111ULL;
+}
+
+// True if sliding the row (4 exponents) either way brings two 32768 tiles together
+bool hasPackedRowTileLimit(Uint16 row) {
+int previous = 0;
+for (int j = 0; j < BOARD_SIZE; j++) {
+    int exponent = (row >> (4 * j)) & 0xF;
+    if (exponent == 0) continue;
+    if (exponent == 15 && previous == 15) return true;
+    previous = exponent;
+}
+return false;
+}
+
+// The tile limit: true if a move of the game would merge two 32768 tiles on this board. The
+// 65536 tile does not fit the packed board, so the packed rules cannot play on from here.
+bool hasPackedTileLimit(Uint64 board) {
+Uint64 maxTiles = getMaxNibbles(board);
+if ((maxTiles & (maxTiles - 1)) == 0) return false; // Fewer than two 32768 tiles
+Uint64 columns = transposePackedBoard(board);
+for (int i = 0; i < BOARD_SIZE; i++) {
+    if (hasPackedRowTileLimit(static_cast<Uint16>(board >> (16 * i))) ||
+        hasPackedRowTileLimit(static_cast<Uint16>(columns >> (16 * i)))) {
+        return true;
     }
+}
+return false;
+}
+
+// True if the packed rules have a move left (canMove on a packed board): the board is not at
+// the tile limit, and has an empty cell or two equal neighbours in a row (columns 0-2 against
+// the next) or a column (rows 0-2 against the next)
+bool canMovePackedBoard(Uint64 board) {
+if (hasPackedTileLimit(board)) return false;
+if (~getNonZeroNibbles(board) & 0x1111111111111111ULL) return true;
+if (~getNonZeroNibbles(board ^ (board >> 4)) & 0x0111011101110111ULL) return true;
+return (~getNonZeroNibbles(board ^ (board >> 16)) & 0x0000111111111111ULL) != 0;
+}
+
+// Whether a packed game has ended: 0 playing, 1 no move left, 2 stopped at the tile limit
+// (the game itself would go on by merging two 32768 tiles)
+int getPackedGameOver(Uint64 board) {
+if (hasPackedTileLimit(board)) return 2;
+return canMovePackedBoard(board) ? 0 : 1;
+}
+
+// Random board for --check-rules: half of them full, the others with about a third of the
+// cells empty. Tiles are a few below a random top exponent (up to 15), so equal neighbours,
+// 32768 tiles and full boards without a move are all common.
+Uint64 makeRuleCheckBoard(TileRng& rng) {
+Uint64 board = 0;
+int top = 1 + static_cast<int>(rng() % 15);
+int spread = 2 + static_cast<int>(rng() % 8);
+bool full = (rng() & 1) != 0;
+for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+    Uint64 roll = rng();
+    if (!full && roll % 3 == 0) continue;
+    int exponent = std::max(1, top - static_cast<int>((roll >> 8) % spread));
+    board |= static_cast<Uint64>(exponent) << (4 * cell);
+}
+return board;
+}
+
+// Multi-board move kernel: applies a direction to up to PACKED_MOVE_BLOCK packed boards and
+// returns the changed mask (bit i set if board i moved), the moved boards and their merge
+// scores. Same results as movePackedBoard. Each board is expanded to one byte per cell in a
+// 16-byte lane (row r in bytes 4r..4r+3, column 0 first); a byte shuffle turns every
+// direction into a left move, which runs on all rows at once:
+//   slide: 3 passes of "an empty cell takes its right neighbour"
+//   merge: equal neighbours merge, pairs chosen left to right (no merge of two 32768 tiles)
+//   slide: 2 more passes close the gaps the merges left
+// The AVX2 path moves 2 boards per register, the SSSE3 path 1; other CPUs use the row tables.
+// The SIMD paths are x86-64 only: the 64-bit lane moves (_mm_cvtsi64_si128, _mm_cvtsi128_si64,
+// _mm256_extract_epi64) do not exist on 32-bit x86.
+const int PACKED_MOVE_BLOCK = 16;
+
+// Per direction: cell order that makes the move a left move, and back
+alignas(16) const Uint8 PACKED_MOVE_SHUFFLE_IN[4][16] = {
+{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},  // Left
+{3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},  // Right: rows reversed
+{0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15},  // Up: transposed
+{12, 8, 4, 0, 13, 9, 5, 1, 14, 10, 6, 2, 15, 11, 7, 3}   // Down: transposed, then rows reversed
+};
+alignas(16) const Uint8 PACKED_MOVE_SHUFFLE_OUT[4][16] = {
+{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+{3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12},
+{0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15},
+{3, 7, 11, 15, 2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12}
+};
+
+// Points for a merge into exponent e (2^e), split into low and high bytes for byte lookups
+alignas(16) const Uint8 PACKED_SCORE_LOW[16] = {0, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0};
+alignas(16) const Uint8 PACKED_SCORE_HIGH[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 4, 8, 16, 32, 64, 128};
+
+Uint32 movePackedBoardsScalar(const Uint64* boards, const Uint8* directions, int count, Uint64* moved, Uint32* scores) {
+Uint32 changed = 0;
+for (int i = 0; i < count; i++) {
+    scores[i] = 0;
+    moved[i] = movePackedBoard(boards[i], directions[i] & 3, scores[i]);
+    if (moved[i] != boards[i]) changed |= 1u << i;
+}
+return changed;
+}
+
+#if defined(__x86_64__)
+// One step of the slide: where a cell is empty and its right neighbour is not, the tile moves left
+__attribute__((target("ssse3")))
+inline __m128i slideCellsLeft(__m128i cells, __m128i zero, __m128i notLastColumn, __m128i notFirstColumn) {
+__m128i next = _mm_and_si128(_mm_srli_si128(cells, 1), notLastColumn);
+__m128i takes = _mm_andnot_si128(_mm_cmpeq_epi8(next, zero), _mm_cmpeq_epi8(cells, zero));
+__m128i given = _mm_and_si128(_mm_slli_si128(takes, 1), notFirstColumn);
+return _mm_or_si128(_mm_andnot_si128(given, cells), _mm_and_si128(takes, next));
+}
+
+__attribute__((target("ssse3")))
+Uint32 movePackedBoardsSsse3(const Uint64* boards, const Uint8* directions, int count, Uint64* moved, Uint32* scores) {
+const __m128i zero = _mm_setzero_si128();
+const __m128i one = _mm_set1_epi8(1);
+const __m128i lowNibble = _mm_set1_epi8(0x0F);
+const __m128i lowByte = _mm_set1_epi16(0x00FF);
+const __m128i maxExponent = _mm_set1_epi8(15);
+const __m128i notLastColumn = _mm_set1_epi32(0x00FFFFFF);
+const __m128i notFirstColumn = _mm_set1_epi32(static_cast<int>(0xFFFFFF00u));
+const __m128i scoreLow = _mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_SCORE_LOW));
+const __m128i scoreHigh = _mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_SCORE_HIGH));
+
+Uint32 changed = 0;
+for (int i = 0; i < count; i++) {
+    int direction = directions[i] & 3;
     
-    // Lưu trạng thái game hiện tại
-    int stateInt = static_cast<int>(currentState);
-    saveFile.write(reinterpret_cast<char*>(&stateInt), sizeof(int));
+    // Nibbles to bytes, in left move order
+    __m128i packed = _mm_cvtsi64_si128(static_cast<long long>(boards[i]));
+    __m128i cells = _mm_unpacklo_epi8(_mm_and_si128(packed, lowNibble), _mm_and_si128(_mm_srli_epi16(packed, 4), lowNibble));
+    cells = _mm_shuffle_epi8(cells, _mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_MOVE_SHUFFLE_IN[direction])));
     
-    // Lưu điểm số
-    saveFile.write(reinterpret_cast<char*>(&score), sizeof(int));
-    saveFile.write(reinterpret_cast<char*>(&scoreP2), sizeof(int));
-    saveFile.write(reinterpret_cast<char*>(&bestScore), sizeof(int));
+    for (int pass = 0; pass < 3; pass++) {
+        cells = slideCellsLeft(cells, zero, notLastColumn, notFirstColumn);
+    }
     
-    // Lưu trạng thái game over và win
-    saveFile.write(reinterpret_cast<char*>(&gameOver), sizeof(bool));
-    saveFile.write(reinterpret_cast<char*>(&gameOverP2), sizeof(bool));
-    saveFile.write(reinterpret_cast<char*>(&won), sizeof(bool));
-    saveFile.write(reinterpret_cast<char*>(&wonP2), sizeof(bool));
+    // A cell merges with its right neighbour if they are equal, unless the cell was just
+    // merged into its left neighbour
+    __m128i next = _mm_and_si128(_mm_srli_si128(cells, 1), notLastColumn);
+    __m128i equal = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi8(cells, zero), _mm_cmpeq_epi8(cells, maxExponent)), 
+                                     _mm_cmpeq_epi8(cells, next));
+    __m128i firstOfRun = _mm_andnot_si128(_mm_and_si128(_mm_slli_si128(equal, 1), notFirstColumn), equal);
+    __m128i merges = _mm_andnot_si128(_mm_and_si128(_mm_slli_si128(firstOfRun, 1), notFirstColumn), equal);
+    cells = _mm_add_epi8(cells, _mm_and_si128(merges, one));
+    cells = _mm_andnot_si128(_mm_and_si128(_mm_slli_si128(merges, 1), notFirstColumn), cells);
+    
+    __m128i mergedExponents = _mm_and_si128(cells, merges);
+    __m128i low = _mm_sad_epu8(_mm_shuffle_epi8(scoreLow, mergedExponents), zero);
+    __m128i high = _mm_sad_epu8(_mm_shuffle_epi8(scoreHigh, mergedExponents), zero);
+    __m128i sums = _mm_add_epi64(low, _mm_slli_epi64(high, 8));
+    scores[i] = static_cast<Uint32>(_mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    
+    for (int pass = 0; pass < 2; pass++) {
+        cells = slideCellsLeft(cells, zero, notLastColumn, notFirstColumn);
+    }
     
-    // Lưu người chơi hiện tại
-    int playerInt = static_cast<int>(currentPlayer);
-    saveFile.write(reinterpret_cast<char*>(&playerInt), sizeof(int));
+    // Back to the board's cell order, then bytes to nibbles
+    cells = _mm_shuffle_epi8(cells, _mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_MOVE_SHUFFLE_OUT[direction])));
+    __m128i pairs = _mm_and_si128(_mm_or_si128(cells, _mm_srli_epi16(cells, 4)), lowByte);
+    moved[i] = static_cast<Uint64>(_mm_cvtsi128_si64(_mm_packus_epi16(pairs, zero)));
+    if (moved[i] != boards[i]) changed |= 1u << i;
+}
+return changed;
+}
+
+__attribute__((target("avx2")))
+inline __m256i slideCellsLeft(__m256i cells, __m256i zero, __m256i notLastColumn, __m256i notFirstColumn) {
+__m256i next = _mm256_and_si256(_mm256_srli_si256(cells, 1), notLastColumn);
+__m256i takes = _mm256_andnot_si256(_mm256_cmpeq_epi8(next, zero), _mm256_cmpeq_epi8(cells, zero));
+__m256i given = _mm256_and_si256(_mm256_slli_si256(takes, 1), notFirstColumn);
+return _mm256_or_si256(_mm256_andnot_si256(given, cells), _mm256_and_si256(takes, next));
+}
+
+// Shuffle table rows of two boards, one per 128-bit lane
+__attribute__((target("avx2")))
+inline __m256i loadShufflePair(const Uint8 (*table)[16], int first, int second) {
+__m128i low = _mm_load_si128(reinterpret_cast<const __m128i*>(table[first]));
+__m128i high = _mm_load_si128(reinterpret_cast<const __m128i*>(table[second]));
+return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+// The SSSE3 kernel on two boards per register; an odd last board runs next to an empty one
+__attribute__((target("avx2")))
+Uint32 movePackedBoardsAvx2(const Uint64* boards, const Uint8* directions, int count, Uint64* moved, Uint32* scores) {
+const __m256i zero = _mm256_setzero_si256();
+const __m256i one = _mm256_set1_epi8(1);
+const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+const __m256i maxExponent = _mm256_set1_epi8(15);
+const __m256i notLastColumn = _mm256_set1_epi32(0x00FFFFFF);
+const __m256i notFirstColumn = _mm256_set1_epi32(static_cast<int>(0xFFFFFF00u));
+const __m256i scoreLow = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_SCORE_LOW)));
+const __m256i scoreHigh = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(PACKED_SCORE_HIGH)));
+
+Uint32 changed = 0;
+for (int i = 0; i < count; i += 2) {
+    bool pair = (i + 1 < count);
+    Uint64 second = pair ? boards[i + 1] : 0;
+    int firstDirection = directions[i] & 3;
+    int secondDirection = pair ? (directions[i + 1] & 3) : 0;
+    
+    __m256i packed = _mm256_set_epi64x(0, static_cast<long long>(second), 0, static_cast<long long>(boards[i]));
+    __m256i cells = _mm256_unpacklo_epi8(_mm256_and_si256(packed, lowNibble), 
+                                         _mm256_and_si256(_mm256_srli_epi16(packed, 4), lowNibble));
+    cells = _mm256_shuffle_epi8(cells, loadShufflePair(PACKED_MOVE_SHUFFLE_IN, firstDirection, secondDirection));
+    
+    for (int pass = 0; pass < 3; pass++) {
+        cells = slideCellsLeft(cells, zero, notLastColumn, notFirstColumn);
+    }
     
-    // Lưu bảng của người chơi 1
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            saveFile.write(reinterpret_cast<char*>(&board[i][j]), sizeof(int));
-        }
+    __m256i next = _mm256_and_si256(_mm256_srli_si256(cells, 1), notLastColumn);
+    __m256i equal = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi8(cells, zero), _mm256_cmpeq_epi8(cells, maxExponent)), 
+                                        _mm256_cmpeq_epi8(cells, next));
+    __m256i firstOfRun = _mm256_andnot_si256(_mm256_and_si256(_mm256_slli_si256(equal, 1), notFirstColumn), equal);
+    __m256i merges = _mm256_andnot_si256(_mm256_and_si256(_mm256_slli_si256(firstOfRun, 1), notFirstColumn), equal);
+    cells = _mm256_add_epi8(cells, _mm256_and_si256(merges, one));
+    cells = _mm256_andnot_si256(_mm256_and_si256(_mm256_slli_si256(merges, 1), notFirstColumn), cells);
+    
+    __m256i mergedExponents = _mm256_and_si256(cells, merges);
+    __m256i low = _mm256_sad_epu8(_mm256_shuffle_epi8(scoreLow, mergedExponents), zero);
+    __m256i high = _mm256_sad_epu8(_mm256_shuffle_epi8(scoreHigh, mergedExponents), zero);
+    __m256i sums = _mm256_add_epi64(low, _mm256_slli_epi64(high, 8));
+    
+    for (int pass = 0; pass < 2; pass++) {
+        cells = slideCellsLeft(cells, zero, notLastColumn, notFirstColumn);
     }
     
-    // Lưu bảng của người chơi 2
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            saveFile.write(reinterpret_cast<char*>(&boardP2[i][j]), sizeof(int));
+    cells = _mm256_shuffle_epi8(cells, loadShufflePair(PACKED_MOVE_SHUFFLE_OUT, firstDirection, secondDirection));
+    __m256i pairs = _mm256_and_si256(_mm256_or_si256(cells, _mm256_srli_epi16(cells, 4)), lowByte);
+    __m256i result = _mm256_packus_epi16(pairs, zero);
+    
+    moved[i] = static_cast<Uint64>(_mm256_extract_epi64(result, 0));
+    scores[i] = static_cast<Uint32>(_mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1));
+    if (moved[i] != boards[i]) changed |= 1u << i;
+    if (pair) {
+        moved[i + 1] = static_cast<Uint64>(_mm256_extract_epi64(result, 2));
+        scores[i + 1] = static_cast<Uint32>(_mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+        if (moved[i + 1] != boards[i + 1]) changed |= 1u << (i + 1);
+    }
+}
+return changed;
+}
+#endif
+
+typedef Uint32 (*PackedMoveKernel)(const Uint64*, const Uint8*, int, Uint64*, Uint32*);
+
+struct PackedMoveKernelChoice {
+PackedMoveKernel kernel;
+const char* name;
+};
+
+// The widest kernel the CPU supports, picked once
+const PackedMoveKernelChoice& getPackedMoveKernel() {
+static const PackedMoveKernelChoice choice = [] {
+    PackedMoveKernelChoice best = {movePackedBoardsScalar, "row tables"};
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx2")) {
+        best.kernel = movePackedBoardsAvx2;
+        best.name = "AVX2";
+    } else if (__builtin_cpu_supports("ssse3")) {
+        best.kernel = movePackedBoardsSsse3;
+        best.name = "SSSE3";
+    }
+#endif
+    return best;
+}();
+return choice;
+}
+
+// Move count boards (at most PACKED_MOVE_BLOCK), board i in directions[i]; returns the changed mask
+Uint32 movePackedBoards(const Uint64* boards, const Uint8* directions, int count, Uint64* moved, Uint32* scores) {
+return getPackedMoveKernel().kernel(boards, directions, count, moved, scores);
+}
+
+// Batch environment for reinforcement learning, a C API built into the shared library
+// (-DGAME2048_ENV_LIBRARY -shared -fPIC, see README). Games are kept structure-of-arrays:
+// boards[i] (packed like HistoryEntry), rngStates[i] (splitmix64 state of the game), and
+// per step actions[i] (MoveDirection), rewards[i] (merge score of the move), dones[i]
+// (getPackedGameOver: 1 no move left, 2 truncated at the tile limit, a limit of the packed
+// board and not of the game) and spawns[i] (cell << 1, | 1 for a 4; 0xFF when the action did
+// not move, encoded like NET_MOVE). Spawns follow addRandomTile's odds from the game's own
+// stream. Stepping a truncated board leaves it unchanged.
+int envThreadCount = 1;
+
+// Spawn in a random empty cell of a board that has one: the index-th set bit of the empty
+// mask, with the cell and the 2-or-4 draw taken from the two halves of one random number
+Uint64 spawnEnvTile(Uint64 board, Uint64& rngState, Uint8& spawn) {
+Uint64 empty = ~getNonZeroNibbles(board) & 0x1111111111111111ULL;
+TileRng rng(rngState);
+Uint64 random = rng();
+rngState = rng.state;
+
+Uint32 index = static_cast<Uint32>(((random & 0xFFFFFFFFULL) * __builtin_popcountll(empty)) >> 32);
+for (Uint32 k = 0; k < index; k++) empty &= empty - 1;
+int cell = __builtin_ctzll(empty) / 4;
+bool four = (((random >> 32) * 10) >> 32) >= 9;
+spawn = static_cast<Uint8>((cell << 1) | (four ? 1 : 0));
+return board | (static_cast<Uint64>(four ? 2 : 1) << (4 * cell));
+}
+
+// Run body(begin, end) over [0, n) split across envThreadCount threads. Small batches stay on
+// the calling thread, where starting threads would cost more than the work.
+template<typename Body>
+void runEnvBatch(int n, Body body) {
+int threads = std::min(envThreadCount, n / ENV_MIN_BOARDS_PER_THREAD);
+if (threads <= 1) {
+    body(0, n);
+    return;
+}
+
+std::vector<std::thread> workers;
+int chunk = (n + threads - 1) / threads;
+for (int t = 1; t < threads; t++) {
+    int begin = t * chunk;
+    int end = std::min(n, begin + chunk);
+    workers.emplace_back([&body, begin, end] { body(begin, end); });
+}
+body(0, std::min(n, chunk));
+for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+// New game with two tiles, like restart()
+Uint64 startEnvBoard(Uint64& rngState) {
+Uint8 spawn;
+return spawnEnvTile(spawnEnvTile(0, rngState, spawn), rngState, spawn);
+}
+
+extern "C" {
+
+// Worker threads used by the batch calls (1 = calling thread only); returns the previous value
+int game2048_env_set_threads(int threads) {
+int previous = envThreadCount;
+envThreadCount = std::max(1, threads);
+return previous;
+}
+
+// Start n new games; game i is seeded from seed and i, so runs are reproducible
+void game2048_env_reset(Uint64* boards, Uint64* rngStates, int n, Uint64 seed) {
+runEnvBatch(n, [=](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        rngStates[i] = seed + static_cast<Uint64>(i) * 0xD1B54A32D192ED03ULL;
+        boards[i] = startEnvBoard(rngStates[i]);
+    }
+});
+}
+
+// Start a new game in every slot whose dones flag is set, continuing its random stream
+void game2048_env_reset_done(Uint64* boards, Uint64* rngStates, const Uint8* dones, int n) {
+runEnvBatch(n, [=](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (dones[i]) boards[i] = startEnvBoard(rngStates[i]);
+    }
+});
+}
+
+// Apply actions[i] to game i for all n games
+void game2048_env_step(Uint64* boards, const Uint8* actions, int n, Uint64* rngStates, 
+                       Uint32* rewards, Uint8* dones, Uint8* spawns) {
+runEnvBatch(n, [=](int begin, int end) {
+    Uint64 moved[PACKED_MOVE_BLOCK];
+    Uint32 scores[PACKED_MOVE_BLOCK];
+    for (int block = begin; block < end; block += PACKED_MOVE_BLOCK) {
+        int count = std::min(PACKED_MOVE_BLOCK, end - block);
+        Uint32 changed = movePackedBoards(boards + block, actions + block, count, moved, scores);
+        for (int k = 0; k < count; k++) {
+            int i = block + k;
+            spawns[i] = 0xFF;
+            if (hasPackedTileLimit(boards[i])) {
+                rewards[i] = 0;
+                dones[i] = 2;
+                continue;
+            }
+            rewards[i] = scores[k];
+            if (changed & (1u << k)) {
+                moved[k] = spawnEnvTile(moved[k], rngStates[i], spawns[i]);
+            }
+            boards[i] = moved[k];
+            dones[i] = static_cast<Uint8>(getPackedGameOver(moved[k]));
         }
     }
-    
-    saveFile.close();
-    std::cout << "Đã lưu game thành công!" << std::endl;
+});
 }
 
-// Hàm tải trạng thái game từ file
-bool loadGame(bool isMultiplayer = false) {
-    const char* filePath = isMultiplayer ? SAVE_FILE_MULTI_PATH : SAVE_FILE_SINGLE_PATH;
-    
-    std::ifstream saveFile(filePath, std::ios::binary);
-    if (!saveFile.is_open()) {
-        std::cout << "Không tìm thấy file lưu game, bắt đầu game mới." << std::endl;
-        return false;
+}
+
+// --env-benchmark [boards] [steps]: random actions on a batch through the C API, finished games
+// restarted after every step; prints the time per board step on one thread and on all cores
+int runEnvBenchmark(int boardCount, int steps) {
+boardCount = std::max(1, boardCount);
+std::vector<Uint64> boards(boardCount);
+std::vector<Uint64> rngStates(boardCount);
+std::vector<Uint8> actions(boardCount);
+std::vector<Uint32> rewards(boardCount);
+std::vector<Uint8> dones(boardCount);
+std::vector<Uint8> spawns(boardCount);
+TileRng actionRng(HEADLESS_DEFAULT_SEED);
+
+int threadOptions[2] = {1, std::max(1, static_cast<int>(std::thread::hardware_concurrency()))};
+for (int option = 0; option < 2; option++) {
+    if (option == 1 && threadOptions[1] == 1) break;
+    game2048_env_set_threads(threadOptions[option]);
+    game2048_env_reset(boards.data(), rngStates.data(), boardCount, HEADLESS_DEFAULT_SEED);
+    
+    double stepSeconds = 0.0;
+    Uint64 totalReward = 0;
+    Uint64 finishedGames = 0;
+    for (int step = 0; step < steps; step++) {
+        for (int i = 0; i < boardCount; i++) actions[i] = static_cast<Uint8>(actionRng() & 3);
+        
+        auto start = std::chrono::steady_clock::now();
+        game2048_env_step(boards.data(), actions.data(), boardCount, rngStates.data(), rewards.data(), dones.data(), spawns.data());
+        stepSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        for (int i = 0; i < boardCount; i++) {
+            totalReward += rewards[i];
+            finishedGames += dones[i];
+        }
+        game2048_env_reset_done(boards.data(), rngStates.data(), dones.data(), boardCount);
     }
     
-    // Đọc trạng thái game
-    int stateInt;
-    saveFile.read(reinterpret_cast<char*>(&stateInt), sizeof(int));
-    currentState = static_cast<GameState>(stateInt);
-    
-    // Đọc điểm số
-    saveFile.read(reinterpret_cast<char*>(&score), sizeof(int));
-    saveFile.read(reinterpret_cast<char*>(&scoreP2), sizeof(int));
-    saveFile.read(reinterpret_cast<char*>(&bestScore), sizeof(int));
-    
-    // Đọc trạng thái game over và win
-    saveFile.read(reinterpret_cast<char*>(&gameOver), sizeof(bool));
-    saveFile.read(reinterpret_cast<char*>(&gameOverP2), sizeof(bool));
-    saveFile.read(reinterpret_cast<char*>(&won), sizeof(bool));
-    saveFile.read(reinterpret_cast<char*>(&wonP2), sizeof(bool));
-    
-    // Đọc người chơi hiện tại
-    int playerInt;
-    saveFile.read(reinterpret_cast<char*>(&playerInt), sizeof(int));
-    currentPlayer = static_cast<PlayerTurn>(playerInt);
+    double boardSteps = static_cast<double>(boardCount) * steps;
+    char line[200];
+    snprintf(line, sizeof(line), "Env step, %d thread(s): %.2f ns per board, %.1f M board steps/s (%d boards x %d steps, %llu games finished, reward %llu)",
+             threadOptions[option], stepSeconds * 1e9 / boardSteps, boardSteps / stepSeconds / 1e6, boardCount, steps,
+             static_cast<unsigned long long>(finishedGames), static_cast<unsigned long long>(totalReward));
+    std::cout << line << std::endl;
+}
+
+// The move kernel alone on the final boards, checked against the row tables
+std::vector<Uint64> moved(boardCount);
+std::vector<Uint32> scores(boardCount);
+Uint64 mismatches = 0;
+double kernelSeconds = 0.0;
+for (int step = 0; step < steps; step++) {
+    for (int i = 0; i < boardCount; i++) actions[i] = static_cast<Uint8>(actionRng() & 3);
+    
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < boardCount; i += PACKED_MOVE_BLOCK) {
+        movePackedBoards(&boards[i], &actions[i], std::min(PACKED_MOVE_BLOCK, boardCount - i), &moved[i], &scores[i]);
+    }
+    kernelSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
     
-    // Đọc bảng của người chơi 1
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            saveFile.read(reinterpret_cast<char*>(&board[i][j]), sizeof(int));
+    if (step == 0) {
+        for (int i = 0; i < boardCount; i++) {
+            Uint32 score = 0;
+            Uint64 expected = movePackedBoard(boards[i], actions[i], score);
+            if (expected != moved[i] || score != scores[i]) mismatches++;
         }
     }
-    
-    // Đọc bảng của người chơi 2
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            saveFile.read(reinterpret_cast<char*>(&boardP2[i][j]), sizeof(int));
+}
+double kernelMoves = static_cast<double>(boardCount) * steps;
+char line[200];
+snprintf(line, sizeof(line), "Move kernel (%s): %.2f ns per board, %llu mismatches against the row tables",
+         getPackedMoveKernel().name, kernelSeconds * 1e9 / kernelMoves, static_cast<unsigned long long>(mismatches));
+std::cout << line << std::endl;
+return mismatches == 0 ? 0 : 1;
+}
+
+// Monte Carlo player: each legal direction from the board is scored by the mean points of random
+// games played from the position after that move to the end, and the best mean wins. Playouts
+// are spread over threads, each with its own TileRng stream, until every direction has its
+// playouts or the time budget runs out.
+struct MonteCarloResult {
+int direction; // -1 when no move is legal or at the tile limit
+double meanScore[4]; // Points of the move plus the mean points of its playouts
+Uint64 playouts[4];
+Uint64 totalPlayouts;
+double seconds;
+};
+
+// Uniformly random legal moves until none is left or the tile limit; returns the points scored
+Uint32 playRandomGame(Uint64 board, TileRng& rng) {
+Uint32 score = 0;
+Uint8 spawn;
+for (;;) {
+    if (hasPackedTileLimit(board)) return score;
+    Uint64 moved = board;
+    Uint32 points = 0;
+    Uint32 tried = 0;
+    while (moved == board) {
+        if (tried == 0xF) return score;
+        int direction = static_cast<int>(rng() & 3);
+        if (tried & (1u << direction)) continue;
+        tried |= 1u << direction;
+        points = 0;
+        moved = movePackedBoard(board, direction, points);
+    }
+    score += points;
+    board = spawnEnvTile(moved, rng.state, spawn);
+}
+}
+
+// Pick a direction for board with playoutsPerMove playouts per legal direction on threadCount
+// threads, stopping early after budgetMs (0 = no budget). Thread t draws from seed + t * step.
+MonteCarloResult chooseMonteCarloMove(Uint64 board, int playoutsPerMove, int budgetMs, int threadCount, Uint64 seed) {
+auto start = std::chrono::steady_clock::now();
+MonteCarloResult result = {};
+result.direction = -1;
+if (hasPackedTileLimit(board)) return result;
+
+Uint64 after[4];
+Uint32 movePoints[4];
+int legal[4];
+int legalCount = 0;
+for (int direction = 0; direction < 4; direction++) {
+    movePoints[direction] = 0;
+    after[direction] = movePackedBoard(board, direction, movePoints[direction]);
+    if (after[direction] != board) legal[legalCount++] = direction;
+}
+if (legalCount == 0) return result;
+
+// Playout j belongs to direction legal[j % legalCount], so a budget cut leaves every direction
+// with about the same number of playouts
+int total = std::max(1, playoutsPerMove) * legalCount;
+auto deadline = start + std::chrono::milliseconds(budgetMs);
+std::atomic<int> next(0);
+threadCount = std::max(1, threadCount);
+std::vector<double> sums(threadCount * 4, 0.0);
+std::vector<Uint64> counts(threadCount * 4, 0);
+
+auto worker = [&](int t) {
+    TileRng rng(seed + static_cast<Uint64>(t) * 0xD1B54A32D192ED03ULL);
+    double sum[4] = {0.0, 0.0, 0.0, 0.0};
+    Uint64 count[4] = {0, 0, 0, 0};
+    for (;;) {
+        int begin = next.fetch_add(MONTE_CARLO_PLAYOUT_BATCH, std::memory_order_relaxed);
+        if (begin >= total) break;
+        if (budgetMs > 0 && std::chrono::steady_clock::now() >= deadline) break;
+        int end = std::min(total, begin + MONTE_CARLO_PLAYOUT_BATCH);
+        for (int j = begin; j < end; j++) {
+            int direction = legal[j % legalCount];
+            Uint8 spawn;
+            Uint64 position = spawnEnvTile(after[direction], rng.state, spawn);
+            sum[direction] += playRandomGame(position, rng);
+            count[direction]++;
         }
     }
-    
-    saveFile.close();
-    
-    // Đánh dấu cần cập nhật texture bảng
-    boardTextureNeedsUpdate = true;
-    
-    std::cout << "Đã tải game thành công!" << std::endl;
-    return true;
+    for (int direction = 0; direction < 4; direction++) {
+        sums[t * 4 + direction] = sum[direction];
+        counts[t * 4 + direction] = count[direction];
+    }
+};
+
+std::vector<std::thread> workers;
+for (int t = 1; t < threadCount; t++) workers.emplace_back(worker, t);
+worker(0);
+for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+double bestScore = -1.0;
+for (int k = 0; k < legalCount; k++) {
+    int direction = legal[k];
+    double sum = 0.0;
+    for (int t = 0; t < threadCount; t++) {
+        sum += sums[t * 4 + direction];
+        result.playouts[direction] += counts[t * 4 + direction];
+    }
+    if (result.playouts[direction] == 0) continue;
+    result.totalPlayouts += result.playouts[direction];
+    result.meanScore[direction] = movePoints[direction] + sum / result.playouts[direction];
+    if (result.meanScore[direction] > bestScore) {
+        bestScore = result.meanScore[direction];
+        result.direction = direction;
+    }
+}
+// A budget too small for a single playout still returns a legal move
+if (result.direction < 0) result.direction = legal[0];
+result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+return result;
 }
 
-bool initialize() {
-    // Initialize SDL
-    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
-        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
-        return false;
+// --mc-benchmark [playouts] [threads]: playouts per second on mid-game positions, on one thread
+// and on threads (default all cores), without a time budget
+int runMonteCarloBenchmark(int playoutsPerMove, int threadCount) {
+TileRng rng(HEADLESS_DEFAULT_SEED);
+std::vector<Uint64> positions;
+while (static_cast<int>(positions.size()) < MONTE_CARLO_BENCHMARK_POSITIONS) {
+    // Random games stopped halfway through
+    Uint64 board = startEnvBoard(rng.state);
+    std::vector<Uint64> visited;
+    Uint8 spawn;
+    for (;;) {
+        visited.push_back(board);
+        if (!canMovePackedBoard(board)) break;
+        Uint32 points = 0;
+        Uint64 moved = movePackedBoard(board, static_cast<int>(rng() & 3), points);
+        if (moved != board) board = spawnEnvTile(moved, rng.state, spawn);
     }
+    positions.push_back(visited[visited.size() / 2]);
+}
 
-    // Initialize SDL_ttf
-    if (TTF_Init() < 0) {
-        std::cerr << "SDL_ttf could not initialize! TTF_Error: " << TTF_GetError() << std::endl;
-        return false;
+int threadOptions[2] = {1, std::max(1, threadCount)};
+for (int option = 0; option < 2; option++) {
+    if (option == 1 && threadOptions[1] == 1) break;
+    Uint64 playouts = 0;
+    double seconds = 0.0;
+    for (size_t i = 0; i < positions.size(); i++) {
+        MonteCarloResult result = chooseMonteCarloMove(positions[i], playoutsPerMove, 0, threadOptions[option], rng());
+        playouts += result.totalPlayouts;
+        seconds += result.seconds;
     }
-    
-    // Initialize SDL_mixer
-    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-        std::cerr << "SDL_mixer could not initialize! Mix_Error: " << Mix_GetError() << std::endl;
-        // Continue without sound
-    } else {
-        // Load sound effects
-        buttonSound = Mix_LoadWAV(SOUND_BUTTON);
-        moveSound = Mix_LoadWAV(SOUND_MOVE);
-        mergeSound = Mix_LoadWAV(SOUND_MERGE);
-        mergeNewSound = Mix_LoadWAV(SOUND_MERGE_NEW);
-        gameoverSound = Mix_LoadWAV(SOUND_GAMEOVER);
-        
-        if (!buttonSound || !moveSound || !mergeSound || !mergeNewSound || !gameoverSound) {
-            std::cerr << "Warning: Could not load sound effects! Mix_Error: " << Mix_GetError() << std::endl;
-            // Continue without sound
+    char line[200];
+    snprintf(line, sizeof(line), "Monte Carlo, %d thread(s): %.0f playouts/s, %.2f ms per move (%d positions, %d playouts per direction)",
+             threadOptions[option], playouts / seconds, seconds * 1000.0 / positions.size(),
+             static_cast<int>(positions.size()), playoutsPerMove);
+    std::cout << line << std::endl;
+}
+return 0;
+}
+
+// N-tuple value network: the value of a board is the sum of one weight per tuple and symmetry,
+// indexed by the exponents on the tuple's cells. Two lines and three 2x2 squares under the
+// 8 rotations and reflections of the board cover every row, column and square.
+const int NTUPLE_COUNT = 5;
+const int NTUPLE_LENGTH = 4;
+const int NTUPLE_WEIGHTS = 1 << (4 * NTUPLE_LENGTH); // Per tuple
+const int NTUPLE_SYMMETRIES = 8;
+const int NTUPLE_BASE_CELLS[NTUPLE_COUNT][NTUPLE_LENGTH] = {
+{0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 4, 5}, {1, 2, 5, 6}, {5, 6, 9, 10}
+};
+const Uint32 NTUPLE_FILE_MAGIC = 0x4E543431; // Header of NTUPLE_WEIGHTS_PATH
+
+struct NTupleCells {
+Uint8 cells[NTUPLE_COUNT][NTUPLE_SYMMETRIES][NTUPLE_LENGTH];
+};
+
+// The cells of every tuple under each symmetry, built on first use
+const NTupleCells& getNTupleCells() {
+static const NTupleCells table = [] {
+    NTupleCells built;
+    for (int tuple = 0; tuple < NTUPLE_COUNT; tuple++) {
+        for (int symmetry = 0; symmetry < NTUPLE_SYMMETRIES; symmetry++) {
+            for (int k = 0; k < NTUPLE_LENGTH; k++) {
+                int row = NTUPLE_BASE_CELLS[tuple][k] / BOARD_SIZE;
+                int col = NTUPLE_BASE_CELLS[tuple][k] % BOARD_SIZE;
+                // Rotate a quarter turn symmetry % 4 times, then mirror the upper four
+                for (int turn = 0; turn < symmetry % 4; turn++) {
+                    int rotatedRow = col;
+                    col = BOARD_SIZE - 1 - row;
+                    row = rotatedRow;
+                }
+                if (symmetry >= 4) col = BOARD_SIZE - 1 - col;
+                built.cells[tuple][symmetry][k] = static_cast<Uint8>(row * BOARD_SIZE + col);
+            }
         }
     }
+    return built;
+}();
+return table;
+}
 
-    // Create window
-    window = SDL_CreateWindow("2048 Game", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
-                             SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    if (window == nullptr) {
-        std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        return false;
+// Trainer threads read and write the weights without locks (Hogwild): each weight is an
+// atomic float accessed with relaxed loads and stores, so a racing update may be lost but
+// no value is ever torn
+struct NTupleNetwork {
+std::unique_ptr<std::atomic<float>[]> weights; // NTUPLE_COUNT * NTUPLE_WEIGHTS, tuple major
+
+NTupleNetwork() : weights(new std::atomic<float>[NTUPLE_COUNT * NTUPLE_WEIGHTS]) {
+    for (int i = 0; i < NTUPLE_COUNT * NTUPLE_WEIGHTS; i++) weights[i].store(0.0f, std::memory_order_relaxed);
+}
+};
+
+int getNTupleIndex(Uint64 board, const Uint8* cells) {
+int index = 0;
+for (int k = 0; k < NTUPLE_LENGTH; k++) {
+    index = (index << 4) | static_cast<int>((board >> (4 * cells[k])) & 0xF);
+}
+return index;
+}
+
+float evaluateNTuple(const NTupleNetwork& network, Uint64 board) {
+const NTupleCells& table = getNTupleCells();
+float value = 0.0f;
+for (int tuple = 0; tuple < NTUPLE_COUNT; tuple++) {
+    const std::atomic<float>* weights = &network.weights[tuple * NTUPLE_WEIGHTS];
+    for (int symmetry = 0; symmetry < NTUPLE_SYMMETRIES; symmetry++) {
+        value += weights[getNTupleIndex(board, table.cells[tuple][symmetry])].load(std::memory_order_relaxed);
     }
+}
+return value;
+}
 
-    // Create renderer with vsync enabled to prevent tearing
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (renderer == nullptr) {
-        std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
-        return false;
+// Add delta to every weight the value of board is made of
+void updateNTuple(NTupleNetwork& network, Uint64 board, float delta) {
+const NTupleCells& table = getNTupleCells();
+for (int tuple = 0; tuple < NTUPLE_COUNT; tuple++) {
+    std::atomic<float>* weights = &network.weights[tuple * NTUPLE_WEIGHTS];
+    for (int symmetry = 0; symmetry < NTUPLE_SYMMETRIES; symmetry++) {
+        std::atomic<float>& weight = weights[getNTupleIndex(board, table.cells[tuple][symmetry])];
+        weight.store(weight.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
     }
+}
+}
 
-    // Load fonts with smaller sizes
-    font = TTF_OpenFont(FONT_PATH, 24); // Smaller font for tile numbers and buttons
-    titleFont = TTF_OpenFont(FONT_PATH, 24); // Smaller title font
-    menuFont = TTF_OpenFont(FONT_PATH, 28); // Smaller menu font
-    largeFont = TTF_OpenFont(FONT_PATH, 48); // Smaller large font for title
-    
-    if (font == nullptr || titleFont == nullptr || menuFont == nullptr || largeFont == nullptr) {
-        std::cerr << "Failed to load font! TTF_Error: " << TTF_GetError() << std::endl;
-        std::cerr << "Make sure the font file is located at " << FONT_PATH << std::endl;
-    
-        // Thử tìm font ở vị trí khác
-        const char* altFontPath = "arial.ttf";
-        font = TTF_OpenFont(altFontPath, 22);
-        titleFont = TTF_OpenFont(altFontPath, 36);
-        menuFont = TTF_OpenFont(altFontPath, 24);
-        largeFont = TTF_OpenFont(altFontPath, 54);
-    
-        if (font == nullptr || titleFont == nullptr || menuFont == nullptr || largeFont == nullptr) {
-            std::cerr << "Also tried " << altFontPath << " but failed." << std::endl;
-            return false;
-        } else {
-            std::cout << "Successfully loaded font from " << altFontPath << std::endl;
-        }
+// Greedy move: the direction with the best points plus value of the board after the move
+// (before the spawn). Returns -1 when no move is legal or at the tile limit.
+int chooseNTupleMove(const NTupleNetwork& network, Uint64 board, Uint64* afterMove = nullptr, Uint32* movePoints = nullptr,
+                     float* moveValue = nullptr) {
+int best = -1;
+float bestValue = 0.0f;
+if (moveValue != nullptr) *moveValue = 0.0f;
+if (hasPackedTileLimit(board)) return -1;
+for (int direction = 0; direction < 4; direction++) {
+    Uint32 points = 0;
+    Uint64 after = movePackedBoard(board, direction, points);
+    if (after == board) continue;
+    float value = static_cast<float>(points) + evaluateNTuple(network, after);
+    if (best < 0 || value > bestValue) {
+        best = direction;
+        bestValue = value;
+        if (afterMove != nullptr) *afterMove = after;
+        if (movePoints != nullptr) *movePoints = points;
     }
+}
+if (moveValue != nullptr) *moveValue = bestValue;
+return best;
+}
 
-    // Initialize menu buttons
-    initializeMenuButtons();
-    
-    // Thử tải game đã lưu
-    if (!loadGame() && !loadGame(true)) {
-        // Nếu không có file lưu nào, bắt đầu với menu
-        currentState = MENU;
+bool saveNTupleNetwork(const NTupleNetwork& network, const std::string& path) {
+std::ofstream file(path, std::ios::binary);
+if (!file.is_open()) return false;
+Uint32 header[3] = {NTUPLE_FILE_MAGIC, NTUPLE_COUNT, NTUPLE_WEIGHTS};
+file.write(reinterpret_cast<const char*>(header), sizeof(header));
+std::vector<float> values(NTUPLE_WEIGHTS);
+for (int tuple = 0; tuple < NTUPLE_COUNT; tuple++) {
+    for (int i = 0; i < NTUPLE_WEIGHTS; i++) values[i] = network.weights[tuple * NTUPLE_WEIGHTS + i].load(std::memory_order_relaxed);
+    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+}
+return static_cast<bool>(file);
+}
+
+// Load weights saved by saveNTupleNetwork; false (network unchanged) if the file is missing or
+// was written for other tuples
+bool loadNTupleNetwork(NTupleNetwork& network, const std::string& path) {
+std::ifstream file(path, std::ios::binary);
+if (!file.is_open()) return false;
+Uint32 header[3] = {0, 0, 0};
+file.read(reinterpret_cast<char*>(header), sizeof(header));
+if (!file || header[0] != NTUPLE_FILE_MAGIC || header[1] != NTUPLE_COUNT || header[2] != NTUPLE_WEIGHTS) return false;
+std::vector<float> values(static_cast<size_t>(NTUPLE_COUNT) * NTUPLE_WEIGHTS);
+file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+if (!file) return false;
+for (size_t i = 0; i < values.size(); i++) network.weights[i].store(values[i], std::memory_order_relaxed);
+return true;
+}
+
+// One self-play game with TD(0) on afterstates: the value of the board after each move moves
+// towards the points plus value of the next move, and towards 0 after the last move. It plays
+// by the packed rules, so a game that reaches the tile limit ends there.
+// Returns the score; maxExponent gets the biggest tile.
+Uint32 trainNTupleGame(NTupleNetwork& network, TileRng& rng, float learningRate, int& maxExponent) {
+Uint8 spawn;
+Uint64 board = startEnvBoard(rng.state);
+Uint64 previousAfter = 0;
+bool hasPrevious = false;
+Uint32 score = 0;
+for (;;) {
+    Uint64 after = 0;
+    Uint32 points = 0;
+    float target = 0.0f;
+    if (chooseNTupleMove(network, board, &after, &points, &target) < 0) break;
+    if (hasPrevious) {
+        updateNTuple(network, previousAfter, learningRate * (target - evaluateNTuple(network, previousAfter)));
     }
+    previousAfter = after;
+    hasPrevious = true;
+    score += points;
+    board = spawnEnvTile(after, rng.state, spawn);
+}
+if (hasPrevious) {
+    updateNTuple(network, previousAfter, -learningRate * evaluateNTuple(network, previousAfter));
+}
 
-    return true;
+maxExponent = 0;
+for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+    maxExponent = std::max(maxExponent, static_cast<int>((board >> (4 * cell)) & 0xF));
+}
+return score;
+}
+
+// --train-ntuple [epochs] [games per epoch] [threads]: self-play training on threads sharing the
+// weights, continuing from weightsPath if it holds a network; the weights are saved after each epoch
+int runNTupleTraining(const std::string& weightsPath, int epochs, int epochGames, int threadCount) {
+NTupleNetwork network;
+if (loadNTupleNetwork(network, weightsPath)) {
+    std::cout << "Continuing from " << weightsPath << std::endl;
 }
+threadCount = std::max(1, threadCount);
+std::random_device rd;
+Uint64 seed = (static_cast<Uint64>(rd()) << 32) | rd();
 
-// Play a sound effect
-void playSound(Mix_Chunk* sound) {
-    if (sound) {
-        Mix_PlayChannel(-1, sound, 0);
+for (int epoch = 1; epoch <= epochs; epoch++) {
+    std::atomic<int> nextGame(0);
+    std::vector<Uint64> scoreSums(threadCount, 0);
+    std::vector<int> wins(threadCount, 0); // Games that reached 2048
+    auto start = std::chrono::steady_clock::now();
+    
+    auto worker = [&](int t) {
+        TileRng rng(seed + (static_cast<Uint64>(epoch) * threadCount + t) * 0xD1B54A32D192ED03ULL);
+        Uint64 scoreSum = 0;
+        int won = 0;
+        while (nextGame.fetch_add(1, std::memory_order_relaxed) < epochGames) {
+            int maxExponent = 0;
+            scoreSum += trainNTupleGame(network, rng, NTUPLE_LEARNING_RATE, maxExponent);
+            if (maxExponent >= 11) won++;
+        }
+        scoreSums[t] = scoreSum;
+        wins[t] = won;
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threadCount; t++) workers.emplace_back(worker, t);
+    worker(0);
+    for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Uint64 scoreSum = 0;
+    int won = 0;
+    for (int t = 0; t < threadCount; t++) {
+        scoreSum += scoreSums[t];
+        won += wins[t];
     }
+    bool saved = saveNTupleNetwork(network, weightsPath);
+    char line[200];
+    snprintf(line, sizeof(line), "Epoch %d: %d games, %.0f games/s, average score %.0f, 2048 reached %.1f%%%s",
+             epoch, epochGames, epochGames / seconds, static_cast<double>(scoreSum) / std::max(1, epochGames),
+             100.0 * won / std::max(1, epochGames), saved ? "" : " (weights not saved)");
+    std::cout << line << std::endl;
+}
+return 0;
 }
 
-void initializeMenuButtons() {
-    // Main menu buttons
-    menuButtons.clear();
-    
-    Button singleplayerBtn;
-    singleplayerBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    singleplayerBtn.rect.y = 200;
-    singleplayerBtn.rect.w = 300;
-    singleplayerBtn.rect.h = 60;
-    singleplayerBtn.text = "Singleplayer";
-    singleplayerBtn.isHovered = false;
-    menuButtons.push_back(singleplayerBtn);
-    
-    Button multiplayerBtn;
-    multiplayerBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    multiplayerBtn.rect.y = 280;
-    multiplayerBtn.rect.w = 300;
-    multiplayerBtn.rect.h = 60;
-    multiplayerBtn.text = "Multiplayer";
-    multiplayerBtn.isHovered = false;
-    menuButtons.push_back(multiplayerBtn);
-    
-    Button howToPlayBtn;
-    howToPlayBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    howToPlayBtn.rect.y = 360;
-    howToPlayBtn.rect.w = 300;
-    howToPlayBtn.rect.h = 60;
-    howToPlayBtn.text = "How to Play";
-    howToPlayBtn.isHovered = false;
-    menuButtons.push_back(howToPlayBtn);
-    
-    Button exitBtn;
-    exitBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    exitBtn.rect.y = 440;
-    exitBtn.rect.w = 300;
-    exitBtn.rect.h = 60;
-    exitBtn.text = "Exit";
-    exitBtn.isHovered = false;
-    menuButtons.push_back(exitBtn);
-    
-    // How to play screen buttons
-    howToPlayButtons.clear();
-    
-    Button backBtn;
-    backBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    backBtn.rect.y = 575;
-    backBtn.rect.w = 300;
-    backBtn.rect.h = 60;
-    backBtn.text = "Back to Menu";
-    backBtn.isHovered = false;
-    howToPlayButtons.push_back(backBtn);
+void clearHistory(MoveHistory& history) {
+history.start = 0;
+history.count = 0;
+history.cursor = -1;
+}
+
+// State at position index (0 = oldest) of the history
+HistoryEntry& getHistoryEntry(MoveHistory& history, int index) {
+return history.entries[(history.start + index) % HISTORY_CAPACITY];
+}
+
+// Add the state after a move; the redo states are dropped. O(1), no allocation.
+void pushHistory(MoveHistory& history, const HistoryEntry& entry) {
+history.count = history.cursor + 1;
+if (history.count == HISTORY_CAPACITY) {
+    history.start = (history.start + 1) % HISTORY_CAPACITY;
+    history.count--;
+}
+getHistoryEntry(history, history.count) = entry;
+history.count++;
+history.cursor = history.count - 1;
+}
+
+// Step back one state; nullptr if there is nothing to undo
+const HistoryEntry* undoHistory(MoveHistory& history) {
+if (history.cursor <= 0) return nullptr;
+history.cursor--;
+return &getHistoryEntry(history, history.cursor);
+}
+
+// Step forward one state; nullptr if there is nothing to redo
+const HistoryEntry* redoHistory(MoveHistory& history) {
+if (history.cursor + 1 >= history.count) return nullptr;
+history.cursor++;
+return &getHistoryEntry(history, history.cursor);
+}
+
+// Save file layout of a board: the cells row by row
+void writeBoard(std::ofstream& saveFile, std::vector<std::vector<int> >& cells) {
+for (int i = 0; i < BOARD_SIZE; i++) {
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        saveFile.write(reinterpret_cast<char*>(&cells[i][j]), sizeof(int));
+    }
+}
+}
+
+void readBoard(std::ifstream& saveFile, std::vector<std::vector<int> >& cells) {
+for (int i = 0; i < BOARD_SIZE; i++) {
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        saveFile.read(reinterpret_cast<char*>(&cells[i][j]), sizeof(int));
+    }
+}
+}
+
+// Save file layout of a history: count, cursor, then the states oldest first
+void writeHistory(std::ofstream& saveFile, MoveHistory& history) {
+saveFile.write(reinterpret_cast<char*>(&history.count), sizeof(int));
+saveFile.write(reinterpret_cast<char*>(&history.cursor), sizeof(int));
+for (int i = 0; i < history.count; i++) {
+    HistoryEntry& entry = getHistoryEntry(history, i);
+    saveFile.write(reinterpret_cast<char*>(&entry.board), sizeof(Uint64));
+    saveFile.write(reinterpret_cast<char*>(&entry.rngState), sizeof(Uint64));
+    saveFile.write(reinterpret_cast<char*>(&entry.score), sizeof(int));
+}
+}
+
+// An empty history in the save file: the histories themselves are in the history file
+void writeEmptyHistory(std::ofstream& saveFile) {
+int count = 0;
+int cursor = -1;
+saveFile.write(reinterpret_cast<char*>(&count), sizeof(int));
+saveFile.write(reinterpret_cast<char*>(&cursor), sizeof(int));
+}
+
+// Returns false (history cleared) if the file has no valid history, e.g. an older save file
+bool readHistory(std::ifstream& saveFile, MoveHistory& history) {
+clearHistory(history);
+int count = 0;
+int cursor = -1;
+saveFile.read(reinterpret_cast<char*>(&count), sizeof(int));
+saveFile.read(reinterpret_cast<char*>(&cursor), sizeof(int));
+if (!saveFile || count <= 0 || count > HISTORY_CAPACITY || cursor < 0 || cursor >= count) return false;
+
+for (int i = 0; i < count; i++) {
+    HistoryEntry& entry = history.entries[i];
+    saveFile.read(reinterpret_cast<char*>(&entry.board), sizeof(Uint64));
+    saveFile.read(reinterpret_cast<char*>(&entry.rngState), sizeof(Uint64));
+    saveFile.read(reinterpret_cast<char*>(&entry.score), sizeof(int));
+}
+if (!saveFile) return false;
+
+history.count = count;
+history.cursor = cursor;
+return true;
+}
+
+// Bit of a cell in the AnimationPool masks
+Uint16 getCellBit(int row, int col) {
+return static_cast<Uint16>(1u << (row * BOARD_SIZE + col));
+}
+
+void clearAnimationPool(AnimationPool& pool) {
+pool.moveCount = 0;
+pool.moveCells = 0;
+pool.mergedCells = 0;
+pool.newCells = 0;
+}
+
+void addMoveAnimation(AnimationPool& pool, int startRow, int startCol, int endRow, int endCol, int value) {
+int slot = pool.moveCount++;
+pool.startRow[slot] = startRow;
+pool.startCol[slot] = startCol;
+pool.endRow[slot] = endRow;
+pool.endCol[slot] = endCol;
+pool.value[slot] = value;
+pool.moveCells |= getCellBit(startRow, startCol) | getCellBit(endRow, endCol);
+}
+
+// Check whether a cell is currently drawn by the animation overlay instead of the cached board texture
+bool isCellAnimated(const AnimationPool& pool, int row, int col) {
+return ((pool.moveCells | pool.mergedCells | pool.newCells) & getCellBit(row, col)) != 0;
+}
+
+// Screen positions of the moving tiles at the given progress. Tiles moving along a row or
+// column slide straight; others (rare) slide horizontally first, then vertically.
+// The path is blended arithmetically instead of branched on, so the loop vectorizes.
+void getMovePositions(const AnimationPool& pool, float progress, int originX, int originY, int cellStep,
+                      float* tileX, float* tileY) {
+float eased = easeInOut(progress);
+float cornerX = (progress < 0.5f) ? eased * 2.0f : 1.0f;
+float cornerY = (progress < 0.5f) ? 0.0f : (eased - 0.5f) * 2.0f;
+
+for (int k = 0; k < pool.moveCount; k++) {
+    float corner = static_cast<float>((pool.startRow[k] != pool.endRow[k]) & (pool.startCol[k] != pool.endCol[k]));
+    float startX = static_cast<float>(originX + pool.startCol[k] * cellStep);
+    float startY = static_cast<float>(originY + pool.startRow[k] * cellStep);
+    float endX = static_cast<float>(originX + pool.endCol[k] * cellStep);
+    float endY = static_cast<float>(originY + pool.endRow[k] * cellStep);
+    tileX[k] = lerp(startX, endX, lerp(eased, cornerX, corner));
+    tileY[k] = lerp(startY, endY, lerp(eased, cornerY, corner));
+}
+}
+
+// Game class
+class Game2048 {
+private:
+SDL_Window* window;
+SDL_Renderer* renderer;
+TTF_Font* font;
+TTF_Font* titleFont;
+TTF_Font* menuFont;
+TTF_Font* largeFont;
+TTF_Font* profilerFont; // Small font for the profiler overlay (optional)
+
+// --headless-render: no window, software renderer drawing into headlessSurface,
+// no audio, no save files and a fixed animation step so every frame is reproducible
+bool headless;
+SDL_Surface* headlessSurface;
+std::vector<PlayerState> players; // MAX_PLAYERS boards, allocated once
+int playerCount; // Boards in play in multiplayer
+int selectedPlayerCount; // Player count for the next new multiplayer game (menu keys 2-8, --players)
+int bestScore;
+bool gameOver; // Set to leave the application from the menu
+TileRng rng;
+GameState currentState;
+int currentPlayer; // Board the move functions work on (always 0 in single player)
+std::vector<Button> menuButtons;
+std::vector<Button> howToPlayButtons;
+std::vector<Button> gameOverButtons;
+std::vector<Button> multiplayerGameOverButtons;
+int mouseX, mouseY;
+
+std::deque<SDL_Event> queuedKeys; // Keys pressed while animating, replayed by processQueuedKeys()
+
+// Input-to-photon latency: the key being handled, moves waiting for their first
+// presented frame and the finished samples of this session
+InputLatency trackedInput;
+std::vector<InputLatency> inputsAwaitingFrame; // Shared by both threads, guarded by latencyMutex
+std::mutex latencyMutex;
+std::vector<LatencySample> latencySamples;
+Uint64 saveCounterTicks; // Total time spent in saveGame()
+Uint64 moveSequence; // Moves applied so far (logic thread)
+Uint64 presentedMoveSequence; // moveSequence of the last presented snapshot (render thread)
+
+// Networked multiplayer: players[0] is the local board, players[1] mirrors the opponent
+NetworkSession network;
+std::vector<RemoteMove> remoteMovesAwaitingFrame; // Guarded by latencyMutex
+float remoteMoveLatencyMs; // Opponent move to screen, smoothed (render thread)
+
+BotSession bot; // --bot (logic thread, or the main thread without a window)
+
+bool aiAutoplay; // M in single player: the AI makes the moves
+TileRng monteCarloRng; // Playout seeds, apart from rng so autoplay does not change the spawns
+std::unique_ptr<NTupleNetwork> valueNetwork; // Trained weights for the AI and hints, else Monte Carlo
+int hintDirection; // H in single player: suggested move for hintBoard, -1 for none
+Uint64 hintBoard;
+// The AI search runs on a worker so the logic thread keeps handling input; its move is used
+// only if the board is still aiSearchBoard
+std::future<int> aiSearch;
+Uint64 aiSearchBoard;
+bool aiSearchForHint; // Shown as the hint instead of played
+
+// Game logic runs on logicThread and hands the state to the render thread through
+// snapshots; input goes the other way through inputEvents. The render functions only
+// read snapshots.readBuffer().
+std::thread logicThread;
+std::atomic<bool> logicRunning;
+TripleBuffer<GameSnapshot> snapshots;
+SpscQueue<SDL_Event, INPUT_EVENT_QUEUE_SIZE> inputEvents;
+
+// Texture caching for smoother animations (render thread only)
+// The NeedsUpdate flags force a full redraw; the Cells arrays hold the value drawn in each
+// cell (row * BOARD_SIZE + col) so only cells that differ from the snapshot are redrawn
+SDL_Texture* boardTexture;
+bool boardTextureNeedsUpdate;
+int boardTextureCells[BOARD_SIZE * BOARD_SIZE];
+SDL_Texture* multiplayerBoardTexture; // Static layer of all multiplayer boards, drawn with a single copy
+bool multiplayerBoardTextureNeedsUpdate;
+int multiplayerBoardTexturePlayers; // Player count the texture is laid out for
+int multiplayerBoardTextureCells[MAX_PLAYERS][BOARD_SIZE * BOARD_SIZE];
+
+// Text texture caching - static labels are keyed by (font, text, color),
+// numbers (scores) are laid out from a per-font digit atlas
+std::map<LabelKey, TextTexture> labelCache;
+std::map<TTF_Font*, DigitAtlas> digitAtlases;
+
+// Sound effects - written by soundLoader, only read once soundsReady is set.
+// playSound() only records the request in pendingSounds; flushSounds() plays them once per update.
+Mix_Chunk* sounds[SOUND_EFFECT_COUNT];
+std::thread soundLoader;
+std::atomic<bool> soundsReady;
+Uint32 pendingSounds; // One bit per SoundEffect
+int audioChunkSize;
+
+// --startup-profile
+bool startupProfileEnabled;
+bool startupProfilePrinted;
+Uint64 startupCounter; // initialize() start
+StartupProfile startupProfile;
+
+// Profiler overlay (F3) - frame times in ms, ring buffer of the last PROFILER_HISTORY_SIZE frames
+FrameStats lastFrameStats;
+float frameTimeHistory[PROFILER_HISTORY_SIZE];
+int frameTimeCount;
+int frameTimeNext;
+
+// Biến để theo dõi thời gian lưu game tự động
+Uint32 lastAutoSaveTime;
+const Uint32 AUTO_SAVE_INTERVAL = 5000; // Lưu game mỗi 5 giây
+
+public:
+Game2048() : window(nullptr), renderer(nullptr), font(nullptr), titleFont(nullptr), 
+             menuFont(nullptr), largeFont(nullptr), profilerFont(nullptr), headless(false), headlessSurface(nullptr), players(MAX_PLAYERS),
+             playerCount(DEFAULT_PLAYER_COUNT), selectedPlayerCount(DEFAULT_PLAYER_COUNT), bestScore(0), gameOver(false),
+             currentState(MENU), currentPlayer(0), mouseX(0), mouseY(0), trackedInput(), saveCounterTicks(0), moveSequence(0), presentedMoveSequence(0),
+             network(), remoteMoveLatencyMs(0.0f), bot(), aiAutoplay(false), hintDirection(-1), hintBoard(0),
+             aiSearchBoard(0), aiSearchForHint(false),
+             logicRunning(false), boardTexture(nullptr), boardTextureNeedsUpdate(true), boardTextureCells(),
+             multiplayerBoardTexture(nullptr), multiplayerBoardTextureNeedsUpdate(true),
+             multiplayerBoardTexturePlayers(0), multiplayerBoardTextureCells(),
+             sounds(), soundsReady(false), pendingSounds(0), audioChunkSize(DEFAULT_AUDIO_CHUNK_SIZE),
+             startupProfileEnabled(false), startupProfilePrinted(false), startupCounter(0), startupProfile(),
+             lastFrameStats(), frameTimeHistory(),
+             frameTimeCount(0), frameTimeNext(0), lastAutoSaveTime(0) {
+    // Initialize random number generator
+    std::random_device rd;
+    rng.seed((static_cast<Uint64>(rd()) << 32) | rd());
+    monteCarloRng.seed((static_cast<Uint64>(rd()) << 32) | rd());
+    
+    network.listenSocket = -1;
+    network.socket = -1;
+    bot.listenSocket = -1;
+    bot.inputFd = -1;
+    bot.outputFd = -1;
+    bot.stdinFlags = -1;
+    bot.stdoutFlags = -1;
+
+    // Initialize boards
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        PlayerState& player = players[p];
+        player.board.assign(BOARD_SIZE, std::vector<int>(BOARD_SIZE, 0));
+        player.previousBoard.assign(BOARD_SIZE, std::vector<int>(BOARD_SIZE, 0));
+        player.score = 0;
+        player.gameOver = false;
+        player.won = false;
+        player.animationTimeline.active = false;
+        resetAnimationTimeline(player.animationTimeline);
+        clearAnimationPool(player.animationPool);
+        clearHistory(player.moveHistory);
+    }
+}
+
+~Game2048() {
+    stopLogicThread();
     
-    // Game over buttons
-    gameOverButtons.clear();
+    // Lưu game trước khi thoát
+    saveGame(true);
+    closeNetwork();
+    closeBot();
     
-    Button restartBtn;
-    restartBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    restartBtn.rect.y = 350;
-    restartBtn.rect.w = 300;
-    restartBtn.rect.h = 60;
-    restartBtn.text = "Play Again";
-    restartBtn.isHovered = false;
-    gameOverButtons.push_back(restartBtn);
+    // The sound worker may still be decoding
+    if (soundLoader.joinable()) soundLoader.join();
     
-    Button menuBtn;
-    menuBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    menuBtn.rect.y = 430;
-    menuBtn.rect.w = 300;
-    menuBtn.rect.h = 60;
-    menuBtn.text = "Main Menu";
-    menuBtn.isHovered = false;
-    gameOverButtons.push_back(menuBtn);
+    // Free sound effects
+    for (int effect = 0; effect < SOUND_EFFECT_COUNT; effect++) {
+        if (sounds[effect] != nullptr) Mix_FreeChunk(sounds[effect]);
+    }
     
-    // Multiplayer game over buttons
-    multiplayerGameOverButtons.clear();
+    // Close SDL_mixer
+    Mix_CloseAudio();
     
-    Button mpRestartBtn;
-    mpRestartBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    mpRestartBtn.rect.y = 400;
-    mpRestartBtn.rect.w = 300;
-    mpRestartBtn.rect.h = 60;
-    mpRestartBtn.text = "Play Again";
-    mpRestartBtn.isHovered = false;
-    multiplayerGameOverButtons.push_back(mpRestartBtn);
+    // Giải phóng các texture chữ đã cache
+    clearLabelCache();
     
-    Button mpMenuBtn;
-    mpMenuBtn.rect.x = SCREEN_WIDTH / 2 - 150;
-    mpMenuBtn.rect.y = 480;
-    mpMenuBtn.rect.w = 300;
-    mpMenuBtn.rect.h = 60;
-    mpMenuBtn.text = "Main Menu";
-    mpMenuBtn.isHovered = false;
-    multiplayerGameOverButtons.push_back(mpMenuBtn);
+    if (boardTexture != nullptr) SDL_DestroyTexture(boardTexture);
+    if (multiplayerBoardTexture != nullptr) SDL_DestroyTexture(multiplayerBoardTexture);
+    if (font != nullptr) TTF_CloseFont(font);
+    if (titleFont != nullptr) TTF_CloseFont(titleFont);
+    if (menuFont != nullptr) TTF_CloseFont(menuFont);
+    if (largeFont != nullptr) TTF_CloseFont(largeFont);
+    if (profilerFont != nullptr) TTF_CloseFont(profilerFont);
+    if (renderer != nullptr) SDL_DestroyRenderer(renderer);
+    if (headlessSurface != nullptr) SDL_FreeSurface(headlessSurface);
+    if (window != nullptr) SDL_DestroyWindow(window);
+    TTF_Quit();
+    Mix_Quit();
+    SDL_Quit();
 }
 
-void addRandomTile() {
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    std::vector<std::pair<int, int> >& currentNewTiles = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? newTilesP2 : newTiles;
+// Hàm lưu trạng thái game vào file. The save file is small and written after every move;
+// the undo histories (up to HISTORY_CAPACITY states per player) go to their own file only
+// with includeHistory: on autosave, when leaving a game and on exit.
+void saveGame(bool includeHistory = false) {
+    // Headless runs must not overwrite the player's saved games, and networked and bot
+    // games must not overwrite the local ones
+    if (headless || network.enabled || bot.enabled) return;
     
-    std::vector<std::pair<int, int> > emptyCells;
+    ScopedTickCounter saveTimer(saveCounterTicks);
     
-    // Find all empty cells
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            if (currentBoard[i][j] == 0) {
-                emptyCells.push_back(std::make_pair(i, j));
-            }
-        }
+    bool multiplayerSave = (currentState == MULTIPLAYER || currentState == MULTIPLAYER_GAME_OVER);
+    const char* filePath = multiplayerSave ? SAVE_FILE_MULTI_PATH : SAVE_FILE_SINGLE_PATH;
+    
+    std::ofstream saveFile(filePath, std::ios::binary);
+    if (!saveFile.is_open()) {
+        std::cerr << "Không thể mở file để lưu game!" << std::endl;
+        return;
     }
     
-    if (emptyCells.empty()) return;
+    // Lưu trạng thái game hiện tại
+    int stateInt = static_cast<int>(currentState);
+    saveFile.write(reinterpret_cast<char*>(&stateInt), sizeof(int));
     
-    // Choose a random empty cell
-    std::uniform_int_distribution<int> dist(0, emptyCells.size() - 1);
-    int index = dist(rng);
-    int row = emptyCells[index].first;
-    int col = emptyCells[index].second;
+    // Lưu điểm số
+    saveFile.write(reinterpret_cast<char*>(&players[0].score), sizeof(int));
+    saveFile.write(reinterpret_cast<char*>(&players[1].score), sizeof(int));
+    saveFile.write(reinterpret_cast<char*>(&bestScore), sizeof(int));
     
-    // 90% chance for a 2, 10% chance for a 4
-    std::uniform_int_distribution<int> valueDist(0, 9);
-    currentBoard[row][col] = (valueDist(rng) < 9) ? 2 : 4;
+    // Lưu trạng thái game over và win
+    saveFile.write(reinterpret_cast<char*>(&players[0].gameOver), sizeof(bool));
+    saveFile.write(reinterpret_cast<char*>(&players[1].gameOver), sizeof(bool));
+    saveFile.write(reinterpret_cast<char*>(&players[0].won), sizeof(bool));
+    saveFile.write(reinterpret_cast<char*>(&players[1].won), sizeof(bool));
     
-    // Add to new tiles for animation
-    currentNewTiles.push_back(std::make_pair(row, col));
+    // Lưu người chơi hiện tại
+    saveFile.write(reinterpret_cast<char*>(&currentPlayer), sizeof(int));
     
-    // Mark the board texture as needing update
-    boardTextureNeedsUpdate = true;
+    // Lưu bảng của người chơi 1 và 2
+    for (int p = 0; p < 2; p++) {
+        writeBoard(saveFile, players[p].board);
+    }
     
-    // Play new tile sound
-    playSound(mergeNewSound);
+    // Lưu vị trí RNG; lịch sử undo/redo nằm trong file lịch sử, ở đây chỉ giữ chỗ
+    // (the layout stays readable by older builds)
+    saveFile.write(reinterpret_cast<char*>(&rng.state), sizeof(Uint64));
+    writeEmptyHistory(saveFile);
+    writeEmptyHistory(saveFile);
+    
+    // Người chơi thứ 3 trở đi được ghi sau phần của hai người chơi đầu (file lưu cũ không có)
+    int savedPlayerCount = multiplayerSave ? playerCount : 2;
+    saveFile.write(reinterpret_cast<char*>(&savedPlayerCount), sizeof(int));
+    for (int p = 2; p < savedPlayerCount; p++) {
+        PlayerState& player = players[p];
+        saveFile.write(reinterpret_cast<char*>(&player.score), sizeof(int));
+        saveFile.write(reinterpret_cast<char*>(&player.gameOver), sizeof(bool));
+        saveFile.write(reinterpret_cast<char*>(&player.won), sizeof(bool));
+        writeBoard(saveFile, player.board);
+        writeEmptyHistory(saveFile);
+    }
+    
+    saveFile.close();
+    
+    if (includeHistory) {
+        saveHistories(multiplayerSave ? HISTORY_FILE_MULTI_PATH : HISTORY_FILE_SINGLE_PATH, savedPlayerCount);
+    }
+    std::cout << "Đã lưu game thành công!" << std::endl;
 }
 
-bool canMove(const std::vector<std::vector<int> >& checkBoard) {
-    // Check for empty cells
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            if (checkBoard[i][j] == 0) return true;
-        }
+// History file layout: player count, then each player's history
+void saveHistories(const char* filePath, int savedPlayerCount) {
+    std::ofstream historyFile(filePath, std::ios::binary);
+    if (!historyFile.is_open()) {
+        std::cerr << "Không thể mở file để lưu lịch sử!" << std::endl;
+        return;
     }
-    
-    // Check for adjacent cells with the same value
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            if (j < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i][j + 1] && checkBoard[i][j] != 0) return true;
-            if (i < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i][j + 1] && checkBoard[i][j] != 0) return true;
-            if (i < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i + 1][j] && checkBoard[i][j] != 0) return true;
-        }
+    historyFile.write(reinterpret_cast<char*>(&savedPlayerCount), sizeof(int));
+    for (int p = 0; p < savedPlayerCount; p++) {
+        writeHistory(historyFile, players[p].moveHistory);
     }
-    
-    return false;
 }
 
-void checkGameOver() {
-    if (currentState == MULTIPLAYER) {
-        if (currentPlayer == PLAYER_ONE) {
-            if (!canMove(board)) {
-                gameOver = true;
-                if (gameOverP2) {
-                    // Both players can't move, game is over
-                    currentState = MULTIPLAYER_GAME_OVER;
-                    playSound(gameoverSound);
-                } else {
-                    // Switch to player 2 if they can still move
-                    currentPlayer = PLAYER_TWO;
-                }
-            }
-        } else { // PLAYER_TWO
-            if (!canMove(boardP2)) {
-                gameOverP2 = true;
-                if (gameOver) {
-                    // Both players can't move, game is over
-                    currentState = MULTIPLAYER_GAME_OVER;
-                    playSound(gameoverSound);
-                } else {
-                    // Switch to player 1 if they can still move
-                    currentPlayer = PLAYER_ONE;
-                }
-            }
-        }
-    } else {
-        // Single player mode
-        if (!canMove(board)) {
-            currentState = GAME_OVER;
-            playSound(gameoverSound);
+// Replace the histories read from the save file with those of the history file. A history
+// that does not end on the loaded board (the game went on after the last history save) is
+// dropped and undo starts from the current board.
+void loadHistories(const char* filePath, int savedPlayerCount) {
+    std::ifstream historyFile(filePath, std::ios::binary);
+    if (!historyFile.is_open()) return;
+    
+    int filePlayerCount = 0;
+    historyFile.read(reinterpret_cast<char*>(&filePlayerCount), sizeof(int));
+    for (int p = 0; p < std::min(filePlayerCount, savedPlayerCount); p++) {
+        if (!readHistory(historyFile, players[p].moveHistory) || !isHistoryCurrent(p)) {
+            clearHistory(players[p].moveHistory);
+            recordHistory(p);
         }
     }
 }
 
-void checkWin() {
-    if (currentState == MULTIPLAYER) {
-        if (currentPlayer == PLAYER_ONE) {
-            for (int i = 0; i < BOARD_SIZE; i++) {
-                for (int j = 0; j < BOARD_SIZE; j++) {
-                    if (board[i][j] == 2048) {
-                        won = true;
-                        currentState = MULTIPLAYER_GAME_OVER;
-                        playSound(gameoverSound);
-                        return;
-                    }
-                }
-            }
-        } else { // PLAYER_TWO
-            for (int i = 0; i < BOARD_SIZE; i++) {
-                for (int j = 0; j < BOARD_SIZE; j++) {
-                    if (boardP2[i][j] == 2048) {
-                        wonP2 = true;
-                        currentState = MULTIPLAYER_GAME_OVER;
-                        playSound(gameoverSound);
-                        return;
-                    }
-                }
-            }
-        }
-    } else {
-        // Single player mode
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                if (board[i][j] == 2048) {
-                    won = true;
-                    currentState = GAME_OVER;
-                    playSound(gameoverSound);
-                    return;
-                }
-            }
-        }
-    }
-}
-
-void savePreviousBoard() {
-    // Save the current board state for animation
-    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                previousBoardP2[i][j] = boardP2[i][j];
-            }
-        }
-    } else {
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                previousBoard[i][j] = board[i][j];
-            }
-        }
+// Hàm tải trạng thái game từ file
+bool loadGame(bool isMultiplayer = false) {
+    const char* filePath = isMultiplayer ? SAVE_FILE_MULTI_PATH : SAVE_FILE_SINGLE_PATH;
+    
+    std::ifstream saveFile(filePath, std::ios::binary);
+    if (!saveFile.is_open()) {
+        std::cout << "Không tìm thấy file lưu game, bắt đầu game mới." << std::endl;
+        return false;
     }
-}
-
-// In the createMoveAnimations() function, modify to only create animations for tiles that actually move
-void createMoveAnimations() {
-    // Clear previous animations
-    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-        animationsP2.clear();
-        mergedTilesP2.clear();
-    } else {
-        animations.clear();
-        mergedTiles.clear();
+    
+    // Đọc trạng thái game
+    int stateInt;
+    saveFile.read(reinterpret_cast<char*>(&stateInt), sizeof(int));
+    currentState = static_cast<GameState>(stateInt);
+    
+    // Animations of the previous game are dropped
+    queuedKeys.clear();
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        players[p].animationTimeline.active = false;
+        clearAnimationPool(players[p].animationPool);
     }
     
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    std::vector<std::vector<int> >& prevBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? previousBoardP2 : previousBoard;
-    std::vector<TileAnimation>& currentAnimations = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? animationsP2 : animations;
-    std::map<std::pair<int, int>, std::pair<int, int>>& currentMergedTiles = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? mergedTilesP2 : mergedTiles;
+    // Đọc điểm số
+    saveFile.read(reinterpret_cast<char*>(&players[0].score), sizeof(int));
+    saveFile.read(reinterpret_cast<char*>(&players[1].score), sizeof(int));
+    saveFile.read(reinterpret_cast<char*>(&bestScore), sizeof(int));
     
-    // Track which tiles in the previous board have been accounted for
-    std::vector<std::vector<bool>> accounted(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    // Đọc trạng thái game over và win
+    saveFile.read(reinterpret_cast<char*>(&players[0].gameOver), sizeof(bool));
+    saveFile.read(reinterpret_cast<char*>(&players[1].gameOver), sizeof(bool));
+    saveFile.read(reinterpret_cast<char*>(&players[0].won), sizeof(bool));
+    saveFile.read(reinterpret_cast<char*>(&players[1].won), sizeof(bool));
     
-    // First, identify merged tiles
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            // Skip empty cells in the current board
-            if (currentBoard[i][j] == 0) continue;
-            
-            // Check if this is a merged tile (value is double of what was here before)
-            if (prevBoard[i][j] != 0 && currentBoard[i][j] == prevBoard[i][j] * 2) {
-                // This is a merged tile, we need to find where the other tile came from
-                
-                // First, mark this tile as accounted for
-                accounted[i][j] = true;
-                
-                // Look for another tile with the same value in the previous board
-                for (int ni = 0; ni < BOARD_SIZE; ni++) {
-                    for (int nj = 0; nj < BOARD_SIZE; nj++) {
-                        // Skip if already accounted for or not the same value
-                        if (accounted[ni][nj] || prevBoard[ni][nj] != prevBoard[i][j]) continue;
-                        
-                        // Only create animation if the tile actually moved
-                        if (ni != i || nj != j) {
-                            // Create animation for the tile that moved to merge
-                            TileAnimation anim;
-                            anim.startRow = ni;
-                            anim.startCol = nj;
-                            anim.endRow = i;
-                            anim.endCol = j;
-                            anim.startTime = 0.0f;
-                            anim.progress = 0.0f;
-                            anim.state = MOVING;
-                            anim.merged = true;
-                            anim.value = prevBoard[ni][nj];
-                            
-                            currentAnimations.push_back(anim);
-                            currentMergedTiles[std::make_pair(i, j)] = std::make_pair(ni, nj);
-                        }
-                        accounted[ni][nj] = true;
-                        break;
-                    }
-                }
-            }
+    // Đọc người chơi hiện tại
+    saveFile.read(reinterpret_cast<char*>(&currentPlayer), sizeof(int));
+    
+    // Đọc bảng của người chơi 1 và 2
+    for (int p = 0; p < 2; p++) {
+        readBoard(saveFile, players[p].board);
+    }
+    
+    // Đọc vị trí RNG và lịch sử undo/redo (file lưu cũ không có: bắt đầu lịch sử mới).
+    // A history that does not end on the loaded board is not trusted either.
+    Uint64 rngState = 0;
+    if (saveFile.read(reinterpret_cast<char*>(&rngState), sizeof(Uint64))) {
+        rng.seed(rngState);
+    }
+    // A board without a history gets a new spawn stream, the others continue theirs below
+    for (int p = 0; p < MAX_PLAYERS; p++) {
+        players[p].rng.seed(rng());
+    }
+    for (int p = 0; p < 2; p++) {
+        if (!readHistory(saveFile, players[p].moveHistory) || !isHistoryCurrent(p)) {
+            clearHistory(players[p].moveHistory);
+            recordHistory(p);
         }
     }
     
-    // Now identify moved tiles (not merged)
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            // Skip empty cells or already accounted for cells
-            if (currentBoard[i][j] == 0) continue;
-            
-            // If this is not a merged tile, find where it came from
-            if (currentMergedTiles.find(std::make_pair(i, j)) == currentMergedTiles.end()) {
-                for (int pi = 0; pi < BOARD_SIZE; pi++) {
-                    for (int pj = 0; pj < BOARD_SIZE; pj++) {
-                        if (!accounted[pi][pj] && prevBoard[pi][pj] == currentBoard[i][j]) {
-                            // Only create animation if the tile actually moved
-                            if (pi != i || pj != j) {
-                                // Create animation for the moved tile
-                                TileAnimation anim;
-                                anim.startRow = pi;
-                                anim.startCol = pj;
-                                anim.endRow = i;
-                                anim.endCol = j;
-                                anim.startTime = 0.0f;
-                                anim.progress = 0.0f;
-                                anim.state = MOVING;
-                                anim.merged = false;
-                                anim.value = prevBoard[pi][pj];
-                                
-                                currentAnimations.push_back(anim);
-                            }
-                            accounted[pi][pj] = true;
-                            break;
-                        }
-                    }
-                }
-            }
+    // Người chơi thứ 3 trở đi (file lưu cũ chỉ có 2 người chơi)
+    int savedPlayerCount = 2;
+    if (!saveFile.read(reinterpret_cast<char*>(&savedPlayerCount), sizeof(int)) ||
+        savedPlayerCount < 2 || savedPlayerCount > MAX_PLAYERS) {
+        savedPlayerCount = 2;
+    }
+    for (int p = 2; p < savedPlayerCount; p++) {
+        PlayerState& player = players[p];
+        saveFile.read(reinterpret_cast<char*>(&player.score), sizeof(int));
+        saveFile.read(reinterpret_cast<char*>(&player.gameOver), sizeof(bool));
+        saveFile.read(reinterpret_cast<char*>(&player.won), sizeof(bool));
+        readBoard(saveFile, player.board);
+        if (!saveFile) {
+            // Truncated file: only the first two players are usable
+            savedPlayerCount = 2;
+            break;
         }
+        if (!readHistory(saveFile, player.moveHistory) || !isHistoryCurrent(p)) {
+            clearHistory(player.moveHistory);
+            recordHistory(p);
+        }
+    }
+    if (isMultiplayer) {
+        playerCount = savedPlayerCount;
+    }
+    if (!isMultiplayer || currentPlayer < 0 || currentPlayer >= playerCount) {
+        currentPlayer = 0;
     }
     
-    // Start animation
-    animating = !currentAnimations.empty();
+    loadHistories(isMultiplayer ? HISTORY_FILE_MULTI_PATH : HISTORY_FILE_SINGLE_PATH, savedPlayerCount);
+    for (int p = 0; p < savedPlayerCount; p++) {
+        MoveHistory& history = players[p].moveHistory;
+        if (history.count > 0) {
+            players[p].rng.seed(getHistoryEntry(history, history.cursor).rngState);
+        }
+    }
     
-    // Reset animation timer
-    deltaTime = 0.0f;
-    lastFrameTime = std::chrono::steady_clock::now();
+    saveFile.close();
     
-    // Play move sound if there are animations
-    if (animating) {
-        playSound(moveSound);
-    }
+    std::cout << "Đã tải game thành công!" << std::endl;
+    return true;
 }
 
-bool moveLeft() {
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    bool moved = false;
-    bool merged = false;
-    
-    // Save the current board state for animation
-    savePreviousBoard();
-    
-    // Clear merged tiles tracking
-    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-        mergedTilesP2.clear();
-    } else {
-        mergedTiles.clear();
+bool initialize(bool headlessMode = false, bool startupProfileMode = false, int audioChunk = DEFAULT_AUDIO_CHUNK_SIZE) {
+    headless = headlessMode;
+    renderStatsEnabled = headless; // Draw calls are part of the headless frame report
+    startupProfileEnabled = startupProfileMode;
+    audioChunkSize = audioChunk;
+    startupCounter = SDL_GetPerformanceCounter();
+    if (headless) {
+        // Dummy video driver: runs on CI machines without a display or GPU
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
     }
     
-    // Create a temporary board to track merged tiles
-    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
-    
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        // Move all tiles to the left
-        for (int j = 1; j < BOARD_SIZE; j++) {
-            if (currentBoard[i][j] != 0) {
-                int col = j;
-                while (col > 0 && currentBoard[i][col - 1] == 0) {
-                    currentBoard[i][col - 1] = currentBoard[i][col];
-                    currentBoard[i][col] = 0;
-                    col--;
-                    moved = true;
-                }
-                
-                // Check if we can merge with the tile to the left
-                if (col > 0 && currentBoard[i][col - 1] == currentBoard[i][col] && !mergedTracker[i][col - 1]) {
-                    currentBoard[i][col - 1] *= 2;
-                    currentBoard[i][col] = 0;
-                    mergedTracker[i][col - 1] = true;
-                    
-                    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-                        scoreP2 += currentBoard[i][col - 1];
-                    } else {
-                        score += currentBoard[i][col - 1];
-                        if (score > bestScore) {
-                            bestScore = score;
-                        }
-                    }
-                    
-                    moved = true;
-                    merged = true;
-                }
-            }
+    // Initialize SDL
+    if (SDL_Init(headless ? SDL_INIT_VIDEO : (SDL_INIT_VIDEO | SDL_INIT_AUDIO)) < 0) {
+        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    // Initialize SDL_ttf
+    if (TTF_Init() < 0) {
+        std::cerr << "SDL_ttf could not initialize! TTF_Error: " << TTF_GetError() << std::endl;
+        return false;
+    }
+    startupProfile.sdlInitMs = getCounterMs(startupCounter, SDL_GetPerformanceCounter());
+    
+    // Embedded builds have no font on disk to fall back to, so a bad font must stop the
+    // game here rather than leave the fonts to fail later on the loader thread
+    if (hasEmbeddedAssets()) {
+        TTF_Font* embeddedFont = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 24);
+        if (embeddedFont == nullptr) {
+            std::cerr << "The embedded font " << FONT_PATH << " cannot be opened! TTF_Error: " << TTF_GetError() << std::endl;
+            return false;
         }
+        TTF_CloseFont(embeddedFont);
     }
     
-    if (moved) {
-        createMoveAnimations();
-        boardTextureNeedsUpdate = true;
-        
-        // Play merge sound if any tiles were merged
-        if (merged) {
-            playSound(mergeSound);
+    // Fonts and save files load on worker threads while the window and renderer are created.
+    // Sounds load on their own thread and may finish after the first menu frame is shown.
+    std::future<bool> fontsLoaded = std::async(std::launch::async, &Game2048::loadFonts, this);
+    std::future<void> saveLoaded = std::async(std::launch::async, &Game2048::loadSavedGame, this);
+    if (headless) {
+        // No audio device in headless mode - playSound() skips the null chunks
+        soundsReady.store(true, std::memory_order_release);
+    } else {
+        soundLoader = std::thread(&Game2048::loadSounds, this);
+    }
+
+    Uint64 windowStart = SDL_GetPerformanceCounter();
+    if (headless) {
+        // Software renderer drawing straight into a surface we can hash
+        headlessSurface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (headlessSurface == nullptr) {
+            std::cerr << "Headless surface could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
         }
         
-        // Lưu game sau mỗi lượt di chuyển
-        saveGame();
+        renderer = SDL_CreateSoftwareRenderer(headlessSurface);
+        if (renderer == nullptr) {
+            std::cerr << "Software renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+    } else {
+        // Create window
+        window = SDL_CreateWindow("2048 Game", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 
+                                 SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+        if (window == nullptr) {
+            std::cerr << "Window could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        // Create renderer with vsync enabled to prevent tearing
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (renderer == nullptr) {
+            std::cerr << "Renderer could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+            return false;
+        }
+    }
+    startupProfile.windowMs = getCounterMs(windowStart, SDL_GetPerformanceCounter());
+
+    // The first frame needs the fonts and the saved game
+    Uint64 waitStart = SDL_GetPerformanceCounter();
+    bool fontsOk = fontsLoaded.get();
+    saveLoaded.get();
+    startupProfile.workerWaitMs = getCounterMs(waitStart, SDL_GetPerformanceCounter());
+    if (!fontsOk) {
+        return false;
     }
+
+    // Initialize menu buttons
+    initializeMenuButtons();
     
-    return moved;
+    // The render functions need a snapshot from the start
+    publishSnapshot();
+    snapshots.update();
+
+    return true;
 }
 
-bool moveRight() {
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    bool moved = false;
-    bool merged = false;
-    
-    // Save the current board state for animation
-    savePreviousBoard();
+// Font worker: SDL_ttf is not thread-safe, so all fonts are opened here one after another
+bool loadFonts() {
+    Uint64 fontsStart = SDL_GetPerformanceCounter();
     
-    // Create a temporary board to track merged tiles
-    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    // Load fonts with smaller sizes
+    font = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 24); // Smaller font for tile numbers and buttons
+    titleFont = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 24); // Smaller title font
+    menuFont = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 28); // Smaller menu font
+    largeFont = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 48); // Smaller large font for title
     
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        // Move all tiles to the right
-        for (int j = BOARD_SIZE - 2; j >= 0; j--) {
-            if (currentBoard[i][j] != 0) {
-                int col = j;
-                while (col < BOARD_SIZE - 1 && currentBoard[i][col + 1] == 0) {
-                    currentBoard[i][col + 1] = currentBoard[i][col];
-                    currentBoard[i][col] = 0;
-                    col++;
-                    moved = true;
-                }
-                
-                // Check if we can merge with the tile to the right
-                if (col < BOARD_SIZE - 1 && currentBoard[i][col + 1] == currentBoard[i][col] && !mergedTracker[i][col + 1]) {
-                    currentBoard[i][col + 1] *= 2;
-                    currentBoard[i][col] = 0;
-                    mergedTracker[i][col + 1] = true;
-                    
-                    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-                        scoreP2 += currentBoard[i][col + 1];
-                    } else {
-                        score += currentBoard[i][col + 1];
-                        if (score > bestScore) {
-                            bestScore = score;
-                        }
-                    }
-                    
-                    moved = true;
-                    merged = true;
-                }
-            }
-        }
+    if ((font == nullptr || titleFont == nullptr || menuFont == nullptr || largeFont == nullptr) && hasEmbeddedAssets()) {
+        std::cerr << "Failed to load the embedded font! TTF_Error: " << TTF_GetError() << std::endl;
+        return false;
     }
     
-    if (moved) {
-        createMoveAnimations();
-        boardTextureNeedsUpdate = true;
-        
-        // Play merge sound if any tiles were merged
-        if (merged) {
-            playSound(mergeSound);
+    if (font == nullptr || titleFont == nullptr || menuFont == nullptr || largeFont == nullptr) {
+        std::cerr << "Failed to load font! TTF_Error: " << TTF_GetError() << std::endl;
+        std::cerr << "Make sure the font file is located at " << FONT_PATH << std::endl;
+    
+        // Thử tìm font ở vị trí khác
+        const char* altFontPath = "arial.ttf";
+        font = TTF_OpenFont(altFontPath, 22);
+        titleFont = TTF_OpenFont(altFontPath, 36);
+        menuFont = TTF_OpenFont(altFontPath, 24);
+        largeFont = TTF_OpenFont(altFontPath, 54);
+    
+        if (font == nullptr || titleFont == nullptr || menuFont == nullptr || largeFont == nullptr) {
+            std::cerr << "Also tried " << altFontPath << " but failed." << std::endl;
+            return false;
+        } else {
+            std::cout << "Successfully loaded font from " << altFontPath << std::endl;
         }
-        
-        // Lưu game sau mỗi lượt di chuyển
-        saveGame();
+    }
+
+    // Small font for the profiler overlay - the overlay draws only the histogram without it
+    profilerFont = TTF_OpenFontRW(openAsset(FONT_PATH), 1, 14);
+    if (profilerFont == nullptr && !hasEmbeddedAssets()) {
+        profilerFont = TTF_OpenFont("arial.ttf", 14);
     }
     
-    return moved;
+    startupProfile.fontsMs = getCounterMs(fontsStart, SDL_GetPerformanceCounter());
+    return true;
 }
 
-bool moveUp() {
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    bool moved = false;
-    bool merged = false;
+// Save file worker
+void loadSavedGame() {
+    Uint64 saveLoadStart = SDL_GetPerformanceCounter();
     
-    // Save the current board state for animation
-    savePreviousBoard();
+    // Thử tải game đã lưu (headless runs always start from the menu)
+    if (headless || (!loadGame() && !loadGame(true))) {
+        // Nếu không có file lưu nào, bắt đầu với menu
+        currentState = MENU;
+    }
     
-    // Create a temporary board to track merged tiles
-    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    startupProfile.saveLoadMs = getCounterMs(saveLoadStart, SDL_GetPerformanceCounter());
+}
+
+// Sound worker: open the audio device and decode the sound effects. The game runs
+// without sound until soundsReady is set, and for good if loading fails.
+void loadSounds() {
+    Uint64 audioStart = SDL_GetPerformanceCounter();
     
-    for (int j = 0; j < BOARD_SIZE; j++) {
-        // Move all tiles up
-        for (int i = 1; i < BOARD_SIZE; i++) {
-            if (currentBoard[i][j] != 0) {
-                int row = i;
-                while (row > 0 && currentBoard[row - 1][j] == 0) {
-                    currentBoard[row - 1][j] = currentBoard[row][j];
-                    currentBoard[row][j] = 0;
-                    row--;
-                    moved = true;
-                }
-                
-                // Check if we can merge with the tile above
-                if (row > 0 && currentBoard[row - 1][j] == currentBoard[row][j] && !mergedTracker[row - 1][j]) {
-                    currentBoard[row - 1][j] *= 2;
-                    currentBoard[row][j] = 0;
-                    mergedTracker[row - 1][j] = true;
-                    
-                    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-                        scoreP2 += currentBoard[row - 1][j];
-                    } else {
-                        score += currentBoard[row - 1][j];
-                        if (score > bestScore) {
-                            bestScore = score;
-                        }
-                    }
-                    
-                    moved = true;
-                    merged = true;
-                }
-            }
+    // Initialize SDL_mixer
+    if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, audioChunkSize) < 0) {
+        std::cerr << "SDL_mixer could not initialize! Mix_Error: " << Mix_GetError() << std::endl;
+        // Continue without sound
+    } else {
+        startupProfile.audioOpenMs = getCounterMs(audioStart, SDL_GetPerformanceCounter());
+        Uint64 decodeStart = SDL_GetPerformanceCounter();
+        
+        // Each sound effect gets its own group of channels (group tag = SoundEffect)
+        Mix_AllocateChannels(SOUND_EFFECT_COUNT * MAX_VOICES_PER_SOUND);
+        bool allLoaded = true;
+        for (int effect = 0; effect < SOUND_EFFECT_COUNT; effect++) {
+            Mix_GroupChannels(effect * MAX_VOICES_PER_SOUND, (effect + 1) * MAX_VOICES_PER_SOUND - 1, effect);
+            
+            // Load sound effects
+            sounds[effect] = Mix_LoadWAV_RW(openAsset(SOUND_PATHS[effect]), 1);
+            allLoaded = allLoaded && sounds[effect] != nullptr;
+        }
+        
+        if (!allLoaded) {
+            std::cerr << "Warning: Could not load sound effects! Mix_Error: " << Mix_GetError() << std::endl;
+            // Continue without sound
         }
+        startupProfile.soundDecodeMs = getCounterMs(decodeStart, SDL_GetPerformanceCounter());
     }
     
-    if (moved) {
-        createMoveAnimations();
-        boardTextureNeedsUpdate = true;
+    startupProfile.soundsReadyMs = getCounterMs(startupCounter, SDL_GetPerformanceCounter());
+    soundsReady.store(true, std::memory_order_release);
+}
+
+// Print the --startup-profile breakdown once the first frame is shown and the sounds are loaded
+void printStartupProfile() {
+    const StartupProfile& profile = startupProfile;
+    std::cout << "Startup profile (ms):" << std::endl
+              << "  SDL init               " << profile.sdlInitMs << std::endl
+              << "  window + renderer      " << profile.windowMs << std::endl
+              << "  fonts (worker)         " << profile.fontsMs << std::endl
+              << "  save files (worker)    " << profile.saveLoadMs << std::endl
+              << "  waiting for workers    " << profile.workerWaitMs << std::endl
+              << "  audio open (worker)    " << profile.audioOpenMs << std::endl
+              << "  sound decode (worker)  " << profile.soundDecodeMs << std::endl
+              << "  first frame at         " << profile.firstFrameMs << std::endl
+              << "  sounds ready at        " << profile.soundsReadyMs << std::endl;
+    startupProfilePrinted = true;
+}
+
+// Request a sound effect. Requests are coalesced: a sound asked for several times in one
+// update (e.g. several merges in one move) is played once by flushSounds().
+void playSound(SoundEffect effect) {
+    pendingSounds |= 1u << effect;
+}
+
+// Play the sounds requested since the last flush. A sound plays on a free channel of its
+// group; when all MAX_VOICES_PER_SOUND are busy its oldest voice is stopped and reused, so
+// key spam never piles up voices in the mixer.
+void flushSounds() {
+    if (pendingSounds == 0) return;
+    Uint32 requested = pendingSounds;
+    pendingSounds = 0;
+    
+    // Sounds are dropped until the sound worker is done
+    if (!soundsReady.load(std::memory_order_acquire)) return;
+    
+    for (int effect = 0; effect < SOUND_EFFECT_COUNT; effect++) {
+        if (!(requested & (1u << effect)) || sounds[effect] == nullptr) continue;
         
-        // Play merge sound if any tiles were merged
-        if (merged) {
-            playSound(mergeSound);
+        int channel = Mix_GroupAvailable(effect);
+        if (channel == -1) {
+            channel = Mix_GroupOldest(effect);
+            if (channel == -1) continue;
+            Mix_HaltChannel(channel);
         }
-        
-        // Lưu game sau mỗi lượt di chuyển
-        saveGame();
+        Mix_PlayChannel(channel, sounds[effect], 0);
     }
-    
-    return moved;
 }
 
-bool moveDown() {
-    std::vector<std::vector<int> >& currentBoard = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? boardP2 : board;
-    bool moved = false;
-    bool merged = false;
+// Menu label of the multiplayer button, with the player count of a new game
+std::string getMultiplayerButtonText() const {
+    return "Multiplayer (" + std::to_string(selectedPlayerCount) + "P)";
+}
+
+// Player count for new multiplayer games (2 to MAX_PLAYERS)
+void setSelectedPlayerCount(int count) {
+    selectedPlayerCount = std::max(2, std::min(MAX_PLAYERS, count));
+    if (menuButtons.size() > 1) {
+        menuButtons[1].text = getMultiplayerButtonText();
+    }
+}
+
+// Start the multiplayer screen: the saved game continues if it has the selected number
+// of players, otherwise a new game starts
+void startMultiplayer() {
+    if (loadGame(true) && playerCount == selectedPlayerCount) {
+        currentState = MULTIPLAYER;
+    } else {
+        // Không có game đã lưu, khởi tạo mới
+        playerCount = selectedPlayerCount;
+        currentState = MULTIPLAYER;
+        restart();
+    }
+}
+
+void initializeMenuButtons() {
+    // Main menu buttons
+    menuButtons.clear();
     
-    // Save the current board state for animation
-    savePreviousBoard();
+    Button singleplayerBtn;
+    singleplayerBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    singleplayerBtn.rect.y = 200;
+    singleplayerBtn.rect.w = 300;
+    singleplayerBtn.rect.h = 60;
+    singleplayerBtn.text = "Singleplayer";
+    singleplayerBtn.isHovered = false;
+    menuButtons.push_back(singleplayerBtn);
     
-    // Create a temporary board to track merged tiles
-    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    Button multiplayerBtn;
+    multiplayerBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    multiplayerBtn.rect.y = 280;
+    multiplayerBtn.rect.w = 300;
+    multiplayerBtn.rect.h = 60;
+    multiplayerBtn.text = getMultiplayerButtonText();
+    multiplayerBtn.isHovered = false;
+    menuButtons.push_back(multiplayerBtn);
     
-    for (int j = 0; j < BOARD_SIZE; j++) {
-        // Move all tiles down
-        for (int i = BOARD_SIZE - 2; i >= 0; i--) {
-            if (currentBoard[i][j] != 0) {
-                int row = i;
-                while (row < BOARD_SIZE - 1 && currentBoard[row + 1][j] == 0) {
-                    currentBoard[row + 1][j] = currentBoard[row][j];
-                    currentBoard[row][j] = 0;
-                    row++;
-                    moved = true;
-                }
-                
-                // Check if we can merge with the tile below
-                if (row < BOARD_SIZE - 1 && currentBoard[row + 1][j] == currentBoard[row][j] && !mergedTracker[row + 1][j]) {
-                    currentBoard[row + 1][j] *= 2;
-                    currentBoard[row][j] = 0;
-                    mergedTracker[row + 1][j] = true;
-                    
-                    if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-                        scoreP2 += currentBoard[row + 1][j];
-                    } else {
-                        score += currentBoard[row + 1][j];
-                        if (score > bestScore) {
-                            bestScore = score;
-                        }
-                    }
-                    
-                    moved = true;
-                    merged = true;
-                }
-            }
-        }
-    }
+    Button howToPlayBtn;
+    howToPlayBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    howToPlayBtn.rect.y = 360;
+    howToPlayBtn.rect.w = 300;
+    howToPlayBtn.rect.h = 60;
+    howToPlayBtn.text = "How to Play";
+    howToPlayBtn.isHovered = false;
+    menuButtons.push_back(howToPlayBtn);
     
-    if (moved) {
-        createMoveAnimations();
-        boardTextureNeedsUpdate = true;
-        
-        // Play merge sound if any tiles were merged
-        if (merged) {
-            playSound(mergeSound);
-        }
-        
-        // Lưu game sau mỗi lượt di chuyển
-        saveGame();
-    }
+    Button exitBtn;
+    exitBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    exitBtn.rect.y = 440;
+    exitBtn.rect.w = 300;
+    exitBtn.rect.h = 60;
+    exitBtn.text = "Exit";
+    exitBtn.isHovered = false;
+    menuButtons.push_back(exitBtn);
     
-    return moved;
+    // How to play screen buttons
+    howToPlayButtons.clear();
+    
+    Button backBtn;
+    backBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    backBtn.rect.y = 575;
+    backBtn.rect.w = 300;
+    backBtn.rect.h = 60;
+    backBtn.text = "Back to Menu";
+    backBtn.isHovered = false;
+    howToPlayButtons.push_back(backBtn);
+    
+    // Game over buttons
+    gameOverButtons.clear();
+    
+    Button restartBtn;
+    restartBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    restartBtn.rect.y = 350;
+    restartBtn.rect.w = 300;
+    restartBtn.rect.h = 60;
+    restartBtn.text = "Play Again";
+    restartBtn.isHovered = false;
+    gameOverButtons.push_back(restartBtn);
+    
+    Button menuBtn;
+    menuBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    menuBtn.rect.y = 430;
+    menuBtn.rect.w = 300;
+    menuBtn.rect.h = 60;
+    menuBtn.text = "Main Menu";
+    menuBtn.isHovered = false;
+    gameOverButtons.push_back(menuBtn);
+    
+    // Multiplayer game over buttons
+    multiplayerGameOverButtons.clear();
+    
+    Button mpRestartBtn;
+    mpRestartBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    mpRestartBtn.rect.y = 400;
+    mpRestartBtn.rect.w = 300;
+    mpRestartBtn.rect.h = 60;
+    mpRestartBtn.text = "Play Again";
+    mpRestartBtn.isHovered = false;
+    multiplayerGameOverButtons.push_back(mpRestartBtn);
+    
+    Button mpMenuBtn;
+    mpMenuBtn.rect.x = SCREEN_WIDTH / 2 - 150;
+    mpMenuBtn.rect.y = 480;
+    mpMenuBtn.rect.w = 300;
+    mpMenuBtn.rect.h = 60;
+    mpMenuBtn.text = "Main Menu";
+    mpMenuBtn.isHovered = false;
+    multiplayerGameOverButtons.push_back(mpMenuBtn);
 }
 
-void updateBoardTexture() {
-    if (!boardTextureNeedsUpdate) return;
+// The board the move functions work on
+PlayerState& getCurrentPlayerState() {
+    return players[currentPlayer];
+}
+
+// Boards in play on the current screen
+int getActivePlayerCount() const {
+    return (currentState == MULTIPLAYER || currentState == MULTIPLAYER_GAME_OVER) ? playerCount : 1;
+}
+
+// Spawn a tile in a random empty cell; returns the cell (row * BOARD_SIZE + col), -1 if the board is full
+int addRandomTile() {
+    std::vector<std::vector<int> >& currentBoard = getCurrentPlayerState().board;
+    AnimationPool& currentPool = getCurrentPlayerState().animationPool;
     
-    // Calculate board dimensions
-    int boardWidth = BOARD_SIZE * TILE_SIZE + (BOARD_SIZE - 1) * TILE_MARGIN;
-    int boardHeight = boardWidth;
-    int boardX = (SCREEN_WIDTH - boardWidth) / 2;
-    int boardY = HEADER_HEIGHT - 30;
+    std::vector<std::pair<int, int> > emptyCells;
     
-    // Create or recreate the texture if needed
-    if (boardTexture == nullptr) {
-        boardTexture = SDL_CreateTexture(renderer, 
-                                        SDL_PIXELFORMAT_RGBA8888, 
-                                        SDL_TEXTUREACCESS_TARGET, 
-                                        SCREEN_WIDTH, SCREEN_HEIGHT);
+    // Find all empty cells
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            if (currentBoard[i][j] == 0) {
+                emptyCells.push_back(std::make_pair(i, j));
+            }
+        }
     }
     
-    // Save the current render target
-    SDL_Texture* currentTarget = SDL_GetRenderTarget(renderer);
+    if (emptyCells.empty()) return -1;
     
-    // Set the board texture as the render target
-    SDL_SetRenderTarget(renderer, boardTexture);
+    // Choose a random empty cell
+    std::uniform_int_distribution<int> dist(0, emptyCells.size() - 1);
+    TileRng& playerRng = getCurrentPlayerState().rng;
+    int index = dist(playerRng);
+    int row = emptyCells[index].first;
+    int col = emptyCells[index].second;
     
-    // Clear the texture
-    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
-    SDL_RenderClear(renderer);
+    // 90% chance for a 2, 10% chance for a 4
+    std::uniform_int_distribution<int> valueDist(0, 9);
+    currentBoard[row][col] = (valueDist(playerRng) < 9) ? 2 : 4;
     
-    // Draw board background
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    drawRoundedRect(renderer, boardX - TILE_MARGIN, boardY - TILE_MARGIN, 
-                    boardWidth + TILE_MARGIN * 2, boardHeight + TILE_MARGIN * 2, 8);
+    // Add to new tiles for animation
+    currentPool.newCells |= getCellBit(row, col);
+    
+    // Play new tile sound
+    playSound(SOUND_EFFECT_MERGE_NEW);
     
-    // Draw empty cells
+    return row * BOARD_SIZE + col;
+}
+
+bool canMove(const std::vector<std::vector<int> >& checkBoard) {
+    // Check for empty cells
     for (int i = 0; i < BOARD_SIZE; i++) {
         for (int j = 0; j < BOARD_SIZE; j++) {
-            int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
-            int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
-            renderTile(0, x, y);
+            if (checkBoard[i][j] == 0) return true;
         }
     }
     
-    // Draw static tiles (non-animated)
+    // Check for adjacent cells with the same value
     for (int i = 0; i < BOARD_SIZE; i++) {
         for (int j = 0; j < BOARD_SIZE; j++) {
-            if (board[i][j] != 0) {
-                // Skip tiles that are being animated
-                bool isAnimated = false;
-                
-                // Check if this tile is part of an animation
-                for (const auto& anim : animations) {
-                    if ((anim.endRow == i && anim.endCol == j) || 
-                        (anim.startRow == i && anim.startCol == j && anim.state == MOVING)) {
-                        isAnimated = true;
-                        break;
-                    }
-                }
-                
-                // Check if this is a new tile
-                for (const auto& newTile : newTiles) {
-                    if (newTile.first == i && newTile.second == j) {
-                        isAnimated = true;
-                        break;
-                    }
-                }
-                
-                // Check if this is a merged tile
-                if (mergedTiles.find(std::make_pair(i, j)) != mergedTiles.end()) {
-                    isAnimated = true;
-                }
-                
-                // Only render if not animated
-                if (!isAnimated) {
-                    int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
-                    int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
-                    renderTile(board[i][j], x, y);
-                }
-            }
+            if (j < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i][j + 1] && checkBoard[i][j] != 0) return true;
+            if (i < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i][j + 1] && checkBoard[i][j] != 0) return true;
+            if (i < BOARD_SIZE - 1 && checkBoard[i][j] == checkBoard[i + 1][j] && checkBoard[i][j] != 0) return true;
         }
     }
     
-    // Restore the original render target
-    SDL_SetRenderTarget(renderer, currentTarget);
-    
-    boardTextureNeedsUpdate = false;
+    return false;
 }
 
-void renderAnimatedTile(int value, float x, float y, float scale) {
-    // Set tile color based on value
-    Color tileColor;
-    if (value == 0) {
-        tileColor = EMPTY_TILE_COLOR;
-    } else {
-        int colorIndex = std::min(static_cast<int>(log2(value)) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-        tileColor = TILE_COLORS[colorIndex];
+void checkGameOver() {
+    PlayerState& player = getCurrentPlayerState();
+    if (canMove(player.board)) return;
+    
+    if (currentState != MULTIPLAYER) {
+        // Single player mode
+        currentState = GAME_OVER;
+        playSound(SOUND_EFFECT_GAMEOVER);
+        return;
     }
     
-    // Calculate the size based on scale
-    int size = static_cast<int>(TILE_SIZE * scale);
-    int xOffset = static_cast<int>((TILE_SIZE - size) / 2);
-    int yOffset = static_cast<int>((TILE_SIZE - size) / 2);
+    // The game is over once no player can move; the others keep playing until then
+    player.gameOver = true;
+    for (int p = 0; p < playerCount; p++) {
+        if (!players[p].gameOver) return;
+    }
+    currentState = MULTIPLAYER_GAME_OVER;
+    playSound(SOUND_EFFECT_GAMEOVER);
+}
+
+void checkWin() {
+    // Bots play on past 2048, also when their moves finish animating in the window
+    if (bot.enabled) return;
     
-    // Draw rounded rectangle for the tile
-    SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-    drawRoundedRect(renderer, static_cast<int>(x) + xOffset, static_cast<int>(y) + yOffset, size, size, static_cast<int>(6 * scale)); // Scale the corner radius
+    PlayerState& player = getCurrentPlayerState();
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            if (player.board[i][j] == 2048) {
+                player.won = true;
+                currentState = (currentState == MULTIPLAYER) ? MULTIPLAYER_GAME_OVER : GAME_OVER;
+                playSound(SOUND_EFFECT_GAMEOVER);
+                return;
+            }
+        }
+    }
+}
+
+void savePreviousBoard() {
+    // Save the current board state for animation
+    PlayerState& player = getCurrentPlayerState();
+    player.previousBoard = player.board;
+}
+
+// In the createMoveAnimations() function, modify to only create animations for tiles that actually move
+void createMoveAnimations() {
+    PlayerState& player = getCurrentPlayerState();
+    std::vector<std::vector<int> >& currentBoard = player.board;
+    std::vector<std::vector<int> >& prevBoard = player.previousBoard;
+    AnimationPool& currentPool = player.animationPool;
     
-    // Don't render text for empty tiles
-    if (value == 0) return;
+    // Clear previous moves and merges (new tiles are cleared when their animation ends)
+    currentPool.moveCount = 0;
+    currentPool.moveCells = 0;
+    currentPool.mergedCells = 0;
     
-    // Render tile value
-    std::string valueStr = std::to_string(value);
-    SDL_Color textColor = (value >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
+    // Track which tiles in the previous board have been accounted for
+    std::vector<std::vector<bool>> accounted(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
     
-    // Adjust font size based on number of digits
-    TTF_Font* tileFont = font;
-    if (value >= 1000) {
-        tileFont = TTF_OpenFont(FONT_PATH, 24); // Smaller font for 4-digit numbers
-        if (tileFont == nullptr) {
-            tileFont = font; // Fallback to regular font
+    // First, identify merged tiles
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            // Skip empty cells in the current board
+            if (currentBoard[i][j] == 0) continue;
+            
+            // Check if this is a merged tile (value is double of what was here before)
+            if (prevBoard[i][j] != 0 && currentBoard[i][j] == prevBoard[i][j] * 2) {
+                // This is a merged tile, we need to find where the other tile came from
+                
+                // First, mark this tile as accounted for
+                accounted[i][j] = true;
+                
+                // Look for another tile with the same value in the previous board
+                for (int ni = 0; ni < BOARD_SIZE; ni++) {
+                    for (int nj = 0; nj < BOARD_SIZE; nj++) {
+                        // Skip if already accounted for or not the same value
+                        if (accounted[ni][nj] || prevBoard[ni][nj] != prevBoard[i][j]) continue;
+                        
+                        // Only create animation if the tile actually moved
+                        if (ni != i || nj != j) {
+                            // Create animation for the tile that moved to merge
+                            addMoveAnimation(currentPool, ni, nj, i, j, prevBoard[ni][nj]);
+                            currentPool.mergedCells |= getCellBit(i, j);
+                        }
+                        accounted[ni][nj] = true;
+                        break;
+                    }
+                }
+            }
         }
     }
     
-    SDL_Surface* textSurface = TTF_RenderText_Blended(tileFont, valueStr.c_str(), textColor);
-    if (textSurface == nullptr) {
-        // Handle error
-        if (tileFont != font && tileFont != nullptr) {
-            TTF_CloseFont(tileFont);
+    // Now identify moved tiles (not merged)
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            // Skip empty cells or already accounted for cells
+            if (currentBoard[i][j] == 0) continue;
+            
+            // If this is not a merged tile, find where it came from
+            if (!(currentPool.mergedCells & getCellBit(i, j))) {
+                for (int pi = 0; pi < BOARD_SIZE; pi++) {
+                    for (int pj = 0; pj < BOARD_SIZE; pj++) {
+                        if (!accounted[pi][pj] && prevBoard[pi][pj] == currentBoard[i][j]) {
+                            // Only create animation if the tile actually moved
+                            if (pi != i || pj != j) {
+                                // Create animation for the moved tile
+                                addMoveAnimation(currentPool, pi, pj, i, j, prevBoard[pi][pj]);
+                            }
+                            accounted[pi][pj] = true;
+                            break;
+                        }
+                    }
+                }
+            }
         }
-        return;
     }
     
-    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
+    // Start animation
+    AnimationTimeline& timeline = player.animationTimeline;
+    timeline.active = currentPool.moveCount > 0;
     
-    int textWidth = static_cast<int>(textSurface->w * scale);
-    int textHeight = static_cast<int>(textSurface->h * scale);
+    // Reset animation timer
+    resetAnimationTimeline(timeline);
     
-    SDL_Rect textRect = {
-        static_cast<int>(x + (TILE_SIZE - textWidth) / 2),
-        static_cast<int>(y + (TILE_SIZE - textHeight) / 2),
-        textWidth,
-        textHeight
-    };
-    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-    SDL_FreeSurface(textSurface);
-    SDL_DestroyTexture(textTexture);
+    // Play move sound if there are animations
+    if (timeline.active) {
+        playSound(SOUND_EFFECT_MOVE);
+    }
     
-    // Close the custom font if we created one
-    if (tileFont != font && tileFont != nullptr) {
-        TTF_CloseFont(tileFont);
+    if (trackedInput.active) {
+        trackedInput.animationStartCounter = SDL_GetPerformanceCounter();
     }
 }
 
-void renderTile(int value, int x, int y) {
-    renderAnimatedTile(value, static_cast<float>(x), static_cast<float>(y), 1.0f);
-}
-
-void renderButton(const Button& button, TTF_Font* buttonFont) {
-    // Render button background with rounded corners
-    SDL_SetRenderDrawColor(renderer, 
-                      button.isHovered ? BUTTON_HOVER_COLOR.r : BUTTON_COLOR.r,
-                      button.isHovered ? BUTTON_HOVER_COLOR.g : BUTTON_COLOR.g,
-                      button.isHovered ? BUTTON_HOVER_COLOR.b : BUTTON_COLOR.b,
-                      255);
-    drawRoundedRect(renderer, button.rect.x, button.rect.y, button.rect.w, button.rect.h, 10);
-    
-    // Render button text
-    SDL_Color textColor = toSDLColor(LIGHT_TEXT);
-    SDL_Surface* textSurface = TTF_RenderText_Blended(buttonFont, button.text.c_str(), textColor);
-    if (textSurface == nullptr) {
-        return; // Handle error
-    }
+bool moveLeft() {
+    PlayerState& player = getCurrentPlayerState();
+    std::vector<std::vector<int> >& currentBoard = player.board;
+    bool moved = false;
+    bool merged = false;
     
-    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
+    // Save the current board state for animation
+    savePreviousBoard();
     
-    SDL_Rect textRect = {
-        button.rect.x + (button.rect.w - textSurface->w) / 2,
-        button.rect.y + (button.rect.h - textSurface->h) / 2,
-        textSurface->w,
-        textSurface->h
-    };
+    // Clear merged tiles tracking
+    player.animationPool.mergedCells = 0;
     
-    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-    SDL_FreeSurface(textSurface);
-    SDL_DestroyTexture(textTexture);
-}
-
-void renderGameUI() {
-    // Render "Back" button in top left corner
-    Button backButton;
-    backButton.rect.x = BOARD_MARGIN;
-    backButton.rect.y = BOARD_MARGIN;
-    backButton.rect.w = 100;
-    backButton.rect.h = 40;
-    backButton.text = "Back";
-    backButton.isHovered = isPointInRect(mouseX, mouseY, backButton.rect);
-    renderButton(backButton, font);
-
-    // Render "New Game" button next to "Back" button
-    Button newGameButton;
-    newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
-    newGameButton.rect.y = BOARD_MARGIN;
-    newGameButton.rect.w = 120;
-    newGameButton.rect.h = 40;
-    newGameButton.text = "New Game";
-    newGameButton.isHovered = isPointInRect(mouseX, mouseY, newGameButton.rect);
-    renderButton(newGameButton, font);
-
-    // Render "2048" title
-    SDL_Color textColor = toSDLColor(TEXT_COLOR);
-    SDL_Surface* titleSurface = TTF_RenderText_Blended(titleFont, "2048", textColor);
-    if (titleSurface != nullptr) {
-        SDL_Texture* titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
-        SDL_Rect titleRect = {
-            BOARD_MARGIN,
-            backButton.rect.y + backButton.rect.h + 10,
-            titleSurface->w,
-            titleSurface->h
-        };
-        SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-        SDL_FreeSurface(titleSurface);
-        SDL_DestroyTexture(titleTexture);
-    }
-
-    // Render score boxes
-    int boxWidth = 100;
-    int boxHeight = 60;
-    int boxMargin = 10;
-
-    // Best score box
-    static SDL_Texture* bestLabelTexture = nullptr;
-    static SDL_Texture* bestScoreTexture = nullptr;
-    static int lastBestScore = -1;
-    static SDL_Rect bestLabelRect;
-    static SDL_Rect bestScoreRect;
+    // Create a temporary board to track merged tiles
+    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
     
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    SDL_Rect bestScoreBox = {SCREEN_WIDTH - boxWidth - BOARD_MARGIN, BOARD_MARGIN, boxWidth, boxHeight};
-    drawRoundedRect(renderer, bestScoreBox.x, bestScoreBox.y, bestScoreBox.w, bestScoreBox.h, 5);
-
-    // Chỉ tạo texture mới khi cần thiết
-    if (bestLabelTexture == nullptr) {
-        SDL_Surface* bestLabelSurface = TTF_RenderText_Blended(menuFont, "BEST", textColor);
-        if (bestLabelSurface != nullptr) {
-            bestLabelTexture = SDL_CreateTextureFromSurface(renderer, bestLabelSurface);
-            bestLabelRect = {
-                bestScoreBox.x + (bestScoreBox.w - bestLabelSurface->w) / 2,
-                bestScoreBox.y + 8,
-                bestLabelSurface->w,
-                bestLabelSurface->h
-            };
-            SDL_FreeSurface(bestLabelSurface);
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        // Move all tiles to the left
+        for (int j = 1; j < BOARD_SIZE; j++) {
+            if (currentBoard[i][j] != 0) {
+                int col = j;
+                while (col > 0 && currentBoard[i][col - 1] == 0) {
+                    currentBoard[i][col - 1] = currentBoard[i][col];
+                    currentBoard[i][col] = 0;
+                    col--;
+                    moved = true;
+                }
+                
+                // Check if we can merge with the tile to the left
+                if (col > 0 && currentBoard[i][col - 1] == currentBoard[i][col] && !mergedTracker[i][col - 1]) {
+                    currentBoard[i][col - 1] *= 2;
+                    currentBoard[i][col] = 0;
+                    mergedTracker[i][col - 1] = true;
+                    
+                    player.score += currentBoard[i][col - 1];
+                    bestScore = std::max(bestScore, player.score);
+                    
+                    moved = true;
+                    merged = true;
+                }
+            }
         }
     }
     
-    // Chỉ cập nhật texture điểm số khi điểm thay đổi
-    if (lastBestScore != bestScore) {
-        if (bestScoreTexture != nullptr) {
-            SDL_DestroyTexture(bestScoreTexture);
-            bestScoreTexture = nullptr;
-        }
+    if (moved) {
+        createMoveAnimations();
         
-        std::string bestScoreStr = std::to_string(bestScore);
-        SDL_Surface* bestScoreSurface = TTF_RenderText_Blended(font, bestScoreStr.c_str(), textColor);
-        if (bestScoreSurface != nullptr) {
-            bestScoreTexture = SDL_CreateTextureFromSurface(renderer, bestScoreSurface);
-            bestScoreRect = {
-                bestScoreBox.x + (bestScoreBox.w - bestScoreSurface->w) / 2,
-                bestScoreBox.y + bestLabelRect.h + 5,
-                bestScoreSurface->w,
-                bestScoreSurface->h
-            };
-            SDL_FreeSurface(bestScoreSurface);
+        // Play merge sound if any tiles were merged
+        if (merged) {
+            playSound(SOUND_EFFECT_MERGE);
         }
-        
-        lastBestScore = bestScore;
-    }
-    
-    // Render các texture đã tạo
-    if (bestLabelTexture != nullptr) {
-        SDL_RenderCopy(renderer, bestLabelTexture, NULL, &bestLabelRect);
     }
     
-    if (bestScoreTexture != nullptr) {
-        SDL_RenderCopy(renderer, bestScoreTexture, NULL, &bestScoreRect);
-    }
+    return moved;
+}
 
-    // Current score box
-    static SDL_Texture* scoreLabelTexture = nullptr;
-    static SDL_Texture* scoreTexture = nullptr;
-    static int lastScore = -1;
-    static SDL_Rect scoreLabelRect;
-    static SDL_Rect scoreRect;
+bool moveRight() {
+    PlayerState& player = getCurrentPlayerState();
+    std::vector<std::vector<int> >& currentBoard = player.board;
+    bool moved = false;
+    bool merged = false;
     
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    SDL_Rect scoreBox = {bestScoreBox.x - boxWidth - boxMargin, BOARD_MARGIN, boxWidth, boxHeight};
-    drawRoundedRect(renderer, scoreBox.x, scoreBox.y, scoreBox.w, scoreBox.h, 5);
-
-    // Chỉ tạo texture mới khi cần thiết
-    if (scoreLabelTexture == nullptr) {
-        SDL_Surface* scoreLabelSurface = TTF_RenderText_Blended(menuFont, "SCORE", textColor);
-        if (scoreLabelSurface != nullptr) {
-            scoreLabelTexture = SDL_CreateTextureFromSurface(renderer, scoreLabelSurface);
-            scoreLabelRect = {
-                scoreBox.x + (scoreBox.w - scoreLabelSurface->w) / 2,
-                scoreBox.y + 8,
-                scoreLabelSurface->w,
-                scoreLabelSurface->h
-            };
-            SDL_FreeSurface(scoreLabelSurface);
+    // Save the current board state for animation
+    savePreviousBoard();
+    
+    // Create a temporary board to track merged tiles
+    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        // Move all tiles to the right
+        for (int j = BOARD_SIZE - 2; j >= 0; j--) {
+            if (currentBoard[i][j] != 0) {
+                int col = j;
+                while (col < BOARD_SIZE - 1 && currentBoard[i][col + 1] == 0) {
+                    currentBoard[i][col + 1] = currentBoard[i][col];
+                    currentBoard[i][col] = 0;
+                    col++;
+                    moved = true;
+                }
+                
+                // Check if we can merge with the tile to the right
+                if (col < BOARD_SIZE - 1 && currentBoard[i][col + 1] == currentBoard[i][col] && !mergedTracker[i][col + 1]) {
+                    currentBoard[i][col + 1] *= 2;
+                    currentBoard[i][col] = 0;
+                    mergedTracker[i][col + 1] = true;
+                    
+                    player.score += currentBoard[i][col + 1];
+                    bestScore = std::max(bestScore, player.score);
+                    
+                    moved = true;
+                    merged = true;
+                }
+            }
         }
     }
     
-    // Chỉ cập nhật texture điểm số khi điểm thay đổi
-    if (lastScore != score) {
-        if (scoreTexture != nullptr) {
-            SDL_DestroyTexture(scoreTexture);
-            scoreTexture = nullptr;
-        }
+    if (moved) {
+        createMoveAnimations();
         
-        std::string scoreStr = std::to_string(score);
-        SDL_Surface* scoreSurface = TTF_RenderText_Blended(font, scoreStr.c_str(), textColor);
-        if (scoreSurface != nullptr) {
-            scoreTexture = SDL_CreateTextureFromSurface(renderer, scoreSurface);
-            scoreRect = {
-                scoreBox.x + (scoreBox.w - scoreSurface->w) / 2,
-                scoreBox.y + scoreLabelRect.h + 5,
-                scoreSurface->w,
-                scoreSurface->h
-            };
-            SDL_FreeSurface(scoreSurface);
+        // Play merge sound if any tiles were merged
+        if (merged) {
+            playSound(SOUND_EFFECT_MERGE);
         }
-        
-        lastScore = score;
-    }
-    
-    // Render các texture đã tạo
-    if (scoreLabelTexture != nullptr) {
-        SDL_RenderCopy(renderer, scoreLabelTexture, NULL, &scoreLabelRect);
     }
     
-    if (scoreTexture != nullptr) {
-        SDL_RenderCopy(renderer, scoreTexture, NULL, &scoreRect);
-    }
+    return moved;
 }
 
-void renderMenu() {
-    // Clear screen with menu background color
-    SDL_SetRenderDrawColor(renderer, MENU_BACKGROUND_COLOR.r, MENU_BACKGROUND_COLOR.g, MENU_BACKGROUND_COLOR.b, 255);
-    SDL_RenderClear(renderer);
+bool moveUp() {
+    PlayerState& player = getCurrentPlayerState();
+    std::vector<std::vector<int> >& currentBoard = player.board;
+    bool moved = false;
+    bool merged = false;
     
-    // Render title
-    SDL_Color titleColor = toSDLColor(TEXT_COLOR);
-    SDL_Surface* titleSurface = TTF_RenderText_Blended(largeFont, "2048", titleColor);
-    if (titleSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    // Save the current board state for animation
+    savePreviousBoard();
+    
+    // Create a temporary board to track merged tiles
+    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        // Move all tiles up
+        for (int i = 1; i < BOARD_SIZE; i++) {
+            if (currentBoard[i][j] != 0) {
+                int row = i;
+                while (row > 0 && currentBoard[row - 1][j] == 0) {
+                    currentBoard[row - 1][j] = currentBoard[row][j];
+                    currentBoard[row][j] = 0;
+                    row--;
+                    moved = true;
+                }
+                
+                // Check if we can merge with the tile above
+                if (row > 0 && currentBoard[row - 1][j] == currentBoard[row][j] && !mergedTracker[row - 1][j]) {
+                    currentBoard[row - 1][j] *= 2;
+                    currentBoard[row][j] = 0;
+                    mergedTracker[row - 1][j] = true;
+                    
+                    player.score += currentBoard[row - 1][j];
+                    bestScore = std::max(bestScore, player.score);
+                    
+                    moved = true;
+                    merged = true;
+                }
+            }
+        }
+    }
+    
+    if (moved) {
+        createMoveAnimations();
+        
+        // Play merge sound if any tiles were merged
+        if (merged) {
+            playSound(SOUND_EFFECT_MERGE);
+        }
     }
     
-    SDL_Texture* titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
+    return moved;
+}
+
+bool moveDown() {
+    PlayerState& player = getCurrentPlayerState();
+    std::vector<std::vector<int> >& currentBoard = player.board;
+    bool moved = false;
+    bool merged = false;
     
-    SDL_Rect titleRect = {
-        (SCREEN_WIDTH - titleSurface->w) / 2,
-        80,
-        titleSurface->w,
-        titleSurface->h
-    };
+    // Save the current board state for animation
+    savePreviousBoard();
     
-    SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-    SDL_FreeSurface(titleSurface);
-    SDL_DestroyTexture(titleTexture);
+    // Create a temporary board to track merged tiles
+    std::vector<std::vector<bool>> mergedTracker(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
     
-    // Render buttons
-    for (size_t i = 0; i < menuButtons.size(); i++) {
-        renderButton(menuButtons[i], menuFont);
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        // Move all tiles down
+        for (int i = BOARD_SIZE - 2; i >= 0; i--) {
+            if (currentBoard[i][j] != 0) {
+                int row = i;
+                while (row < BOARD_SIZE - 1 && currentBoard[row + 1][j] == 0) {
+                    currentBoard[row + 1][j] = currentBoard[row][j];
+                    currentBoard[row][j] = 0;
+                    row++;
+                    moved = true;
+                }
+                
+                // Check if we can merge with the tile below
+                if (row < BOARD_SIZE - 1 && currentBoard[row + 1][j] == currentBoard[row][j] && !mergedTracker[row + 1][j]) {
+                    currentBoard[row + 1][j] *= 2;
+                    currentBoard[row][j] = 0;
+                    mergedTracker[row + 1][j] = true;
+                    
+                    player.score += currentBoard[row + 1][j];
+                    bestScore = std::max(bestScore, player.score);
+                    
+                    moved = true;
+                    merged = true;
+                }
+            }
+        }
     }
     
-    // Update screen
-    SDL_RenderPresent(renderer);
+    if (moved) {
+        createMoveAnimations();
+        
+        // Play merge sound if any tiles were merged
+        if (merged) {
+            playSound(SOUND_EFFECT_MERGE);
+        }
+    }
+    
+    return moved;
 }
 
-void renderHowToPlay() {
-    // Clear screen with menu background color
-    SDL_SetRenderDrawColor(renderer, MENU_BACKGROUND_COLOR.r, MENU_BACKGROUND_COLOR.g, MENU_BACKGROUND_COLOR.b, 255);
-    SDL_RenderClear(renderer);
-    
-    // Render title
-    SDL_Color textColor = toSDLColor(TEXT_COLOR);
-    SDL_Surface* titleSurface = TTF_RenderText_Blended(titleFont, "How to Play", textColor);
-    if (titleSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+// Force a full redraw of every cached board texture (lost render targets)
+void invalidateBoardTextures() {
+    boardTextureNeedsUpdate = true;
+    multiplayerBoardTextureNeedsUpdate = true;
+}
+
+// Fill cellValues with the tile resting in each cell of a board (0 for empty or animating cells),
+// the value a cached board texture should show. Returns true if any cell differs from drawnCells.
+bool getRestingCells(const std::vector<std::vector<int> >& cellBoard, const AnimationPool& cellPool,
+                     const int* drawnCells, int* cellValues) {
+    bool changed = false;
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = i * BOARD_SIZE + j;
+            cellValues[cell] = isCellAnimated(cellPool, i, j) ? 0 : cellBoard[i][j];
+            changed = changed || cellValues[cell] != drawnCells[cell];
+        }
     }
+    return changed;
+}
+
+// Board position and tile metrics for the single player screen
+BoardLayout getBoardLayout() {
+    BoardLayout layout;
+    layout.width = BOARD_SIZE * TILE_SIZE + (BOARD_SIZE - 1) * TILE_MARGIN;
+    layout.height = layout.width;
+    layout.tileSize = TILE_SIZE;
+    layout.tileMargin = TILE_MARGIN;
+    layout.x = (SCREEN_WIDTH - layout.width) / 2;
+    layout.y = HEADER_HEIGHT - 30;
+    return layout;
+}
+
+// Bring the cached single player board texture up to date with the snapshot. Only cells whose
+// resting tile differs from what the texture shows are redrawn; the board background is redrawn
+// only on a full update.
+void updateBoardTexture() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    int cellValues[BOARD_SIZE * BOARD_SIZE];
+    if (!getRestingCells(view.players[0].board, view.players[0].animationPool, boardTextureCells, cellValues) &&
+        !boardTextureNeedsUpdate) return;
     
-    SDL_Texture* titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
+    ScopedPhaseTimer boardTextureTimer(PHASE_BOARD_TEXTURE);
     
-    SDL_Rect titleRect = {
-        (SCREEN_WIDTH - titleSurface->w) / 2,
-        50,
-        titleSurface->w,
-        titleSurface->h
-    };
+    // The texture covers the board rect only, not the whole screen
+    BoardLayout layout = getBoardLayout();
+    SDL_Rect backgroundRect = getBoardBackgroundRect(layout);
     
-    SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-    SDL_FreeSurface(titleSurface);
-    SDL_DestroyTexture(titleTexture);
+    // Create the texture if needed
+    if (boardTexture == nullptr) {
+        boardTexture = createTexture(renderer, 
+                                        SDL_PIXELFORMAT_RGBA8888, 
+                                        SDL_TEXTUREACCESS_TARGET, 
+                                        backgroundRect.w, backgroundRect.h);
+    }
     
-    // Render instructions
-    const char* instructions[] = {
-        "Single Player: Use arrow keys or WASD to move tiles",
-        "Tiles with the same number merge into one when they touch",
-        "A new tile appears after each move",
-        "Try to create a tile with the number 2048!",
-        "Press R to restart the game at any time",
-        "In multiplayer mode:",
-        "Player 1 (left) uses WASD keys",
-        "Player 2 (right) uses arrow keys",
-        "The player who reaches 2048 first or has the highest",
-        "score when no more moves are possible wins!",
-        ""
+    // Save the current render target
+    SDL_Texture* currentTarget = SDL_GetRenderTarget(renderer);
     
-    };
+    // Set the board texture as the render target
+    SDL_SetRenderTarget(renderer, boardTexture);
     
-    for (int i = 0; i < 11; i++) {
-        SDL_Surface* textSurface = TTF_RenderText_Blended(font, instructions[i], textColor);
-        if (textSurface == nullptr) continue; // Skip if error
-        
-        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
+    if (boardTextureNeedsUpdate) {
+        // Clear the texture to the screen background so the rounded corners blend in
+        SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+        renderClear(renderer);
         
-        SDL_Rect textRect = {
-            (SCREEN_WIDTH - textSurface->w) / 2,
-            150 + i * 40,
-            textSurface->w,
-            textSurface->h
-        };
-        
-        SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-        SDL_FreeSurface(textSurface);
-        SDL_DestroyTexture(textTexture);
+        // Draw board background
+        SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+        drawRoundedRect(renderer, 0, 0, backgroundRect.w, backgroundRect.h, 8);
     }
     
-    // Render back button
-    for (size_t i = 0; i < howToPlayButtons.size(); i++) {
-        renderButton(howToPlayButtons[i], menuFont);
+    // Redraw changed cells: empty cell first, then the resting tile
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        for (int j = 0; j < BOARD_SIZE; j++) {
+            int cell = i * BOARD_SIZE + j;
+            if (!boardTextureNeedsUpdate && cellValues[cell] == boardTextureCells[cell]) continue;
+            boardTextureCells[cell] = cellValues[cell];
+            
+            int x = layout.tileMargin + j * (TILE_SIZE + TILE_MARGIN);
+            int y = layout.tileMargin + i * (TILE_SIZE + TILE_MARGIN);
+            
+            // Reset the cell area to the board color before drawing into it
+            SDL_Rect cellRect = {x, y, TILE_SIZE, TILE_SIZE};
+            SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+            renderFillRect(renderer, &cellRect);
+            renderTile(0, x, y);
+            
+            if (cellValues[cell] != 0) {
+                renderTile(cellValues[cell], x, y);
+            }
+        }
     }
     
-    // Update screen
-    SDL_RenderPresent(renderer);
+    // Restore the original render target
+    SDL_SetRenderTarget(renderer, currentTarget);
+    
+    boardTextureNeedsUpdate = false;
 }
 
-void renderGameBoard() {
-    // Clear screen
-    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
-    SDL_RenderClear(renderer);
+// Render text into a new texture (caller owns the result)
+TextTexture createTextTexture(TTF_Font* textFont, const std::string& text, SDL_Color color) {
+    TextTexture label = {nullptr, 0, 0};
     
-    // Update the board texture if needed
-    if (!animating || boardTextureNeedsUpdate) {
-        updateBoardTexture();
+    SDL_Surface* textSurface = renderTextBlended(textFont, text.c_str(), color);
+    if (textSurface == nullptr) {
+        return label; // Handle error
     }
     
-    // Render the board texture
-    SDL_RenderCopy(renderer, boardTexture, NULL, NULL);
+    label.texture = createTextureFromSurface(renderer, textSurface);
+    label.w = textSurface->w;
+    label.h = textSurface->h;
+    SDL_FreeSurface(textSurface);
+    return label;
+}
+
+// Get a persistent texture for static text, rendering it only the first time it is requested
+const TextTexture* getLabel(TTF_Font* labelFont, const std::string& text, SDL_Color color) {
+    LabelKey key = {labelFont, text, (Uint32(color.r) << 24) | (Uint32(color.g) << 16) | (Uint32(color.b) << 8) | color.a};
     
-    // Calculate board position
-    int boardWidth = BOARD_SIZE * TILE_SIZE + (BOARD_SIZE - 1) * TILE_MARGIN;
-    int boardHeight = boardWidth;
-    int boardX = (SCREEN_WIDTH - boardWidth) / 2;
-    int boardY = HEADER_HEIGHT - 30;
+    auto it = labelCache.find(key);
+    if (it == labelCache.end()) {
+        it = labelCache.insert(std::make_pair(key, createTextTexture(labelFont, text, color))).first;
+    }
     
-    // Create a map to track which cells have animated tiles
-    std::vector<std::vector<bool>> cellAnimated(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
+    return it->second.texture != nullptr ? &it->second : nullptr;
+}
+
+// Get the digit atlas for a font, building it the first time. Glyphs are rendered in white
+// and tinted with a color mod, so one atlas serves every text color.
+const DigitAtlas* getDigitAtlas(TTF_Font* atlasFont) {
+    auto it = digitAtlases.find(atlasFont);
+    if (it != digitAtlases.end()) {
+        return it->second.texture != nullptr ? &it->second : nullptr;
+    }
     
-    // Render animated tiles on top
-    if (animating) {
-        // Render moving tiles
-        for (const auto& anim : animations) {
-            if (anim.state == MOVING) {
-                // Calculate interpolated position
-                float progress = std::min(1.0f, anim.progress / ANIMATION_DURATION);
-                float eased = easeInOut(progress);
-                
-                float startX = static_cast<float>(boardX + anim.startCol * (TILE_SIZE + TILE_MARGIN));
-                float startY = static_cast<float>(boardY + anim.startRow * (TILE_SIZE + TILE_MARGIN));
-                float endX = static_cast<float>(boardX + anim.endCol * (TILE_SIZE + TILE_MARGIN));
-                float endY = static_cast<float>(boardY + anim.endRow * (TILE_SIZE + TILE_MARGIN));
-                
-                // Để tránh di chuyển chéo, di chuyển theo hai bước: ngang trước, dọc sau
-                float x, y;
-                
-                // Nếu cùng hàng, chỉ di chuyển ngang
-                if (anim.startRow == anim.endRow) {
-                    x = lerp(startX, endX, eased);
-                    y = startY; // Giữ nguyên y
-                }
-                // Nếu cùng cột, chỉ di chuyển dọc
-                else if (anim.startCol == anim.endCol) {
-                    x = startX; // Giữ nguyên x
-                    y = lerp(startY, endY, eased);
-                }
-                // Nếu khác cả hàng và cột (trường hợp hiếm gặp), di chuyển ngang trước, dọc sau
-                else {
-                    if (progress < 0.5f) {
-                        // Di chuyển ngang trước
-                        x = lerp(startX, endX, eased * 2.0f);
-                        y = startY;
-                    } else {
-                        // Di chuyển dọc sau
-                        x = endX;
-                        y = lerp(startY, endY, (eased - 0.5f) * 2.0f);
-                    }
-                }
-                
-                renderAnimatedTile(anim.value, x, y, 1.0f);
-                
-                // Mark both source and destination cells as animated
-                cellAnimated[anim.startRow][anim.startCol] = true;
-                cellAnimated[anim.endRow][anim.endCol] = true;
-            }
-        }
-        
-        // Render merged tiles
-        for (const auto& [pos, srcPos] : mergedTiles) {
-            int i = pos.first;
-            int j = pos.second;
-            int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
-            int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
-            
-            // Calculate animation progress
-            float maxTime = ANIMATION_DURATION + MERGE_ANIMATION_DURATION;
-            float progress = deltaTime / maxTime;
-            
-            if (progress > ANIMATION_DURATION / maxTime) {
-                // Calculate merge animation progress
-                float mergeProgress = (progress - ANIMATION_DURATION / maxTime) / (MERGE_ANIMATION_DURATION / maxTime);
-                mergeProgress = std::min(1.0f, mergeProgress);
-                
-                // Scale animation - more like original 2048
-                float scale;
-                if (mergeProgress < 0.5f) {
-                    // Grow phase - faster growth to 1.2x
-                    scale = lerp(1.0f, 1.2f, mergeProgress * 2.0f);
-                } else {
-                    // Shrink phase - smooth return to normal size
-                    scale = lerp(1.2f, 1.0f, (mergeProgress - 0.5f) * 2.0f);
-                }
-                
-                renderAnimatedTile(board[i][j], static_cast<float>(x), static_cast<float>(y), scale);
-                
-                // Mark the cell as animated
-                cellAnimated[i][j] = true;
-            }
-        }
-        
-        // Render new tiles with pop-up animation
-        for (const auto& [row, col] : newTiles) {
-            int x = boardX + col * (TILE_SIZE + TILE_MARGIN);
-            int y = boardY + row * (TILE_SIZE + TILE_MARGIN);
-            
-            // Calculate scale for appear animation - start from 0 and grow with slight bounce
-            float progress = (deltaTime - ANIMATION_DURATION - NEW_TILE_DELAY) / NEW_TILE_ANIMATION_DURATION;
-            progress = std::max(0.0f, std::min(1.0f, progress));
-            
-            float scale = 0.0f;
-            if (progress > 0.0f) {
-                // Simple grow animation from 0 to 1 with slight overshoot
-                if (progress < 0.7f) {
-                    // Grow from 0 to 1.05 (slight overshoot)
-                    scale = progress / 0.7f * 1.05f;
-                } else {
-                    // Settle back from 1.05 to 1.0
-                    scale = 1.05f - ((progress - 0.7f) / 0.3f * 0.05f);
-                }
-                
-                // Center the tile as it grows
-                float centerX = x + TILE_SIZE / 2.0f;
-                float centerY = y + TILE_SIZE / 2.0f;
-                float scaledX = centerX - (TILE_SIZE * scale) / 2.0f;
-                float scaledY = centerY - (TILE_SIZE * scale) / 2.0f;
-                
-                renderAnimatedTile(board[row][col], scaledX, scaledY, scale);
-                
-                // Mark the cell as animated
-                cellAnimated[row][col] = true;
-            }
+    DigitAtlas atlas;
+    atlas.texture = nullptr;
+    atlas.height = 0;
+    
+    // Render each digit separately and lay them out side by side
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface* digitSurfaces[10];
+    int atlasWidth = 0;
+    bool allRendered = true;
+    for (int d = 0; d < 10; d++) {
+        char digit[2] = {static_cast<char>('0' + d), '\0'};
+        digitSurfaces[d] = renderTextBlended(atlasFont, digit, white);
+        if (digitSurfaces[d] == nullptr) {
+            allRendered = false;
+            continue;
         }
         
-        // Render static tiles (tiles that don't move)
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                if (board[i][j] != 0 && !cellAnimated[i][j]) {
-                    int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
-                    int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
-                    renderTile(board[i][j], x, y);
-                }
+        atlas.glyphs[d] = {atlasWidth, 0, digitSurfaces[d]->w, digitSurfaces[d]->h};
+        atlasWidth += digitSurfaces[d]->w;
+        atlas.height = std::max(atlas.height, digitSurfaces[d]->h);
+    }
+    
+    if (allRendered) {
+        SDL_Surface* atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlas.height, 32, SDL_PIXELFORMAT_RGBA32);
+        if (atlasSurface != nullptr) {
+            for (int d = 0; d < 10; d++) {
+                // Copy the glyph's alpha as-is instead of blending it onto the empty atlas
+                SDL_SetSurfaceBlendMode(digitSurfaces[d], SDL_BLENDMODE_NONE);
+                SDL_Rect glyphRect = atlas.glyphs[d];
+                SDL_BlitSurface(digitSurfaces[d], NULL, atlasSurface, &glyphRect);
             }
+            atlas.texture = createTextureFromSurface(renderer, atlasSurface);
+            SDL_FreeSurface(atlasSurface);
         }
     }
     
-    // Render UI elements (buttons, scores, etc.)
-    renderGameUI();
+    for (int d = 0; d < 10; d++) {
+        if (digitSurfaces[d] != nullptr) SDL_FreeSurface(digitSurfaces[d]);
+    }
     
-    // Present the renderer
-    SDL_RenderPresent(renderer);
+    it = digitAtlases.insert(std::make_pair(atlasFont, atlas)).first;
+    return it->second.texture != nullptr ? &it->second : nullptr;
 }
 
-void renderMultiplayerGameBoard() {
-    // Clear screen with background color (light cream)
-    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
-    SDL_RenderClear(renderer);
+// Width in pixels of a non-negative number laid out from the digit atlas
+int measureNumber(const DigitAtlas* atlas, int value) {
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", value);
+    
+    int width = 0;
+    for (int i = 0; i < length; i++) {
+        width += atlas->glyphs[digits[i] - '0'].w;
+    }
+    return width;
+}
 
-    // Render "Back" button in top left corner
-    Button backButton;
-    backButton.rect.x = BOARD_MARGIN;
-    backButton.rect.y = BOARD_MARGIN;
-    backButton.rect.w = 100;
-    backButton.rect.h = 40;
-    backButton.text = "Back";
-    backButton.isHovered = isPointInRect(mouseX, mouseY, backButton.rect);
-    renderButton(backButton, font);
+// Draw a non-negative number from the digit atlas with its top-left corner at (x, y)
+void renderNumber(const DigitAtlas* atlas, int value, int x, int y, SDL_Color color) {
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", value);
+    
+    SDL_SetTextureColorMod(atlas->texture, color.r, color.g, color.b);
+    for (int i = 0; i < length; i++) {
+        const SDL_Rect& glyph = atlas->glyphs[digits[i] - '0'];
+        SDL_Rect glyphRect = {x, y, glyph.w, glyph.h};
+        renderCopy(renderer, atlas->texture, &glyph, &glyphRect);
+        x += glyph.w;
+    }
+}
 
-    // Render "New Game" button next to "Back" button
-    Button newGameButton;
-    newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10; // 10px spacing between buttons
+// Width of "<prefix><value>" drawn with renderPrefixedNumber (0 if the text can't be rendered)
+int measurePrefixedNumber(TTF_Font* textFont, const std::string& prefix, int value, SDL_Color color) {
+    const TextTexture* prefixLabel = getLabel(textFont, prefix, color);
+    const DigitAtlas* atlas = getDigitAtlas(textFont);
+    if (prefixLabel == nullptr || atlas == nullptr) return 0;
+    
+    return prefixLabel->w + measureNumber(atlas, value);
+}
+
+// Draw "<prefix><value>" with the prefix from the label cache and the digits from the atlas
+void renderPrefixedNumber(TTF_Font* textFont, const std::string& prefix, int value, int x, int y, SDL_Color color) {
+    const TextTexture* prefixLabel = getLabel(textFont, prefix, color);
+    const DigitAtlas* atlas = getDigitAtlas(textFont);
+    if (prefixLabel == nullptr || atlas == nullptr) return;
+    
+    renderLabel(prefixLabel, x, y);
+    renderNumber(atlas, value, x + prefixLabel->w, y, color);
+}
+
+// Draw a cached label with its top-left corner at (x, y)
+void renderLabel(const TextTexture* label, int x, int y) {
+    if (label == nullptr) return;
+    
+    SDL_Rect labelRect = {x, y, label->w, label->h};
+    renderCopy(renderer, label->texture, NULL, &labelRect);
+}
+
+// Free every cached text texture
+void clearLabelCache() {
+    for (auto& entry : labelCache) {
+        if (entry.second.texture != nullptr) SDL_DestroyTexture(entry.second.texture);
+    }
+    for (auto& entry : digitAtlases) {
+        if (entry.second.texture != nullptr) SDL_DestroyTexture(entry.second.texture);
+    }
+    labelCache.clear();
+    digitAtlases.clear();
+}
+
+void renderAnimatedTile(int value, float x, float y, float scale) {
+    // Set tile color based on value
+    Color tileColor;
+    if (value == 0) {
+        tileColor = EMPTY_TILE_COLOR;
+    } else {
+        int colorIndex = std::min(static_cast<int>(log2(value)) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
+        tileColor = TILE_COLORS[colorIndex];
+    }
+    
+    // Calculate the size based on scale
+    int size = static_cast<int>(TILE_SIZE * scale);
+    int xOffset = static_cast<int>((TILE_SIZE - size) / 2);
+    int yOffset = static_cast<int>((TILE_SIZE - size) / 2);
+    
+    // Draw rounded rectangle for the tile
+    SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
+    drawRoundedRect(renderer, static_cast<int>(x) + xOffset, static_cast<int>(y) + yOffset, size, size, static_cast<int>(6 * scale)); // Scale the corner radius
+    
+    // Don't render text for empty tiles
+    if (value == 0) return;
+    
+    // Render tile value - tile values are a small fixed set, so they live in the label cache
+    SDL_Color textColor = (value >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
+    const TextTexture* valueLabel = getLabel(font, std::to_string(value), textColor);
+    if (valueLabel == nullptr) return;
+    
+    int textWidth = static_cast<int>(valueLabel->w * scale);
+    int textHeight = static_cast<int>(valueLabel->h * scale);
+    
+    SDL_Rect textRect = {
+        static_cast<int>(x + (TILE_SIZE - textWidth) / 2),
+        static_cast<int>(y + (TILE_SIZE - textHeight) / 2),
+        textWidth,
+        textHeight
+    };
+    renderCopy(renderer, valueLabel->texture, NULL, &textRect);
+}
+
+void renderTile(int value, int x, int y) {
+    renderAnimatedTile(value, static_cast<float>(x), static_cast<float>(y), 1.0f);
+}
+
+// Board position and tile metrics for a player on the multiplayer screen. Up to four
+// boards share a row (five to eight players use two rows, the last one centered), scaled
+// to fit the screen and at most 85% of the single player size.
+BoardLayout getMultiplayerBoardLayout(int player, int count) {
+    int columns = (count <= 4) ? count : (count + 1) / 2;
+    int rows = (count + columns - 1) / columns;
+    int boardSpacing = (columns <= 2) ? 60 : 30; // Space between boards
+    int fullWidth = BOARD_SIZE * TILE_SIZE + (BOARD_SIZE - 1) * TILE_MARGIN;
+    
+    // Each row holds the boards and the player headers below them
+    double widthScale = static_cast<double>(SCREEN_WIDTH - (columns - 1) * boardSpacing - 4 * TILE_MARGIN) / (columns * fullWidth);
+    double heightScale = static_cast<double>((SCREEN_HEIGHT - HEADER_HEIGHT) / rows - PLAYER_HEADER_SPACE) / fullWidth;
+    double scale = std::min(0.85, std::min(widthScale, heightScale));
+    
+    BoardLayout layout;
+    layout.width = static_cast<int>(fullWidth * scale);
+    layout.height = layout.width;
+    layout.tileSize = static_cast<int>(TILE_SIZE * scale);
+    layout.tileMargin = static_cast<int>(TILE_MARGIN * scale);
+    
+    int row = player / columns;
+    int column = player % columns;
+    int rowColumns = std::min(columns, count - row * columns);
+    int rowWidth = rowColumns * layout.width + (rowColumns - 1) * boardSpacing;
+    layout.x = (SCREEN_WIDTH - rowWidth) / 2 + column * (layout.width + boardSpacing);
+    layout.y = HEADER_HEIGHT + row * (layout.height + PLAYER_HEADER_SPACE);
+    return layout;
+}
+
+// Screen area of the multiplayer boards, covered by the shared static layer texture
+SDL_Rect getMultiplayerBoardsArea() {
+    SDL_Rect area = {0, HEADER_HEIGHT - TILE_MARGIN, SCREEN_WIDTH, SCREEN_HEIGHT - HEADER_HEIGHT + TILE_MARGIN};
+    return area;
+}
+
+// Screen area covered by a board including its rounded background
+SDL_Rect getBoardBackgroundRect(const BoardLayout& layout) {
+    SDL_Rect rect = {
+        layout.x - layout.tileMargin,
+        layout.y - layout.tileMargin,
+        layout.width + layout.tileMargin * 2,
+        layout.height + layout.tileMargin * 2
+    };
+    return rect;
+}
+
+// Draw a multiplayer tile in the cell whose top-left corner is (x, y), scaled around the cell center.
+// The number shrinks on tiles smaller than those of the two player screen.
+void renderMultiplayerTile(int value, float x, float y, int tileSize, float scale) {
+    Color tileColor = getTileColor(value);
+    int scaledSize = static_cast<int>(tileSize * scale);
+    int offset = (tileSize - scaledSize) / 2;
+    
+    SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
+    drawRoundedRect(renderer, static_cast<int>(x) + offset, static_cast<int>(y) + offset, 
+                    scaledSize, scaledSize, static_cast<int>(6 * scale));
+    
+    // Don't render text for empty tiles
+    if (value == 0) return;
+    
+    SDL_Color textColor = (value >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
+    const TextTexture* valueLabel = getLabel(menuFont, std::to_string(value), textColor);
+    if (valueLabel == nullptr) return;
+    
+    float textScale = scale;
+    int twoPlayerTileSize = static_cast<int>(TILE_SIZE * 0.85);
+    if (tileSize < twoPlayerTileSize) {
+        textScale *= static_cast<float>(tileSize) / twoPlayerTileSize;
+    }
+    int textWidth = static_cast<int>(valueLabel->w * textScale);
+    int textHeight = static_cast<int>(valueLabel->h * textScale);
+    
+    SDL_Rect textRect = {
+        static_cast<int>(x + (tileSize - textWidth) / 2),
+        static_cast<int>(y + (tileSize - textHeight) / 2),
+        textWidth,
+        textHeight
+    };
+    renderCopy(renderer, valueLabel->texture, NULL, &textRect);
+}
+
+// Bring the cached static layer (boards, empty cells, resting tiles) of the multiplayer screen up to date.
+// All boards share one texture so the screen draws them with a single copy; only the cells whose
+// resting tile changed are redrawn, so a move by one player never re-rasterizes the other boards.
+void updateMultiplayerBoardTexture() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    
+    // A different number of players moves every board
+    if (view.playerCount != multiplayerBoardTexturePlayers) {
+        multiplayerBoardTextureNeedsUpdate = true;
+        multiplayerBoardTexturePlayers = view.playerCount;
+    }
+    
+    int cellValues[MAX_PLAYERS][BOARD_SIZE * BOARD_SIZE];
+    bool changed = false;
+    for (int p = 0; p < view.playerCount; p++) {
+        const PlayerSnapshot& player = view.players[p];
+        if (getRestingCells(player.board, player.animationPool, multiplayerBoardTextureCells[p], cellValues[p])) {
+            changed = true;
+        }
+    }
+    if (!changed && !multiplayerBoardTextureNeedsUpdate) return;
+    
+    ScopedPhaseTimer boardTextureTimer(PHASE_BOARD_TEXTURE);
+    
+    SDL_Rect area = getMultiplayerBoardsArea();
+    
+    if (multiplayerBoardTexture == nullptr) {
+        multiplayerBoardTexture = createTexture(renderer, 
+                                                    SDL_PIXELFORMAT_RGBA8888, 
+                                                    SDL_TEXTUREACCESS_TARGET, 
+                                                    area.w, area.h);
+    }
+    
+    SDL_Texture* currentTarget = SDL_GetRenderTarget(renderer);
+    SDL_SetRenderTarget(renderer, multiplayerBoardTexture);
+    
+    if (multiplayerBoardTextureNeedsUpdate) {
+        // Clear to the screen background so the rounded corners blend in
+        SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+        renderClear(renderer);
+    }
+    
+    for (int p = 0; p < view.playerCount; p++) {
+        BoardLayout layout = getMultiplayerBoardLayout(p, view.playerCount);
+        int* textureCells = multiplayerBoardTextureCells[p];
+        
+        // Positions relative to the texture origin
+        int originX = layout.x - area.x;
+        int originY = layout.y - area.y;
+        
+        if (multiplayerBoardTextureNeedsUpdate) {
+            // Draw board background
+            SDL_Rect backgroundRect = getBoardBackgroundRect(layout);
+            SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+            drawRoundedRect(renderer, backgroundRect.x - area.x, backgroundRect.y - area.y, backgroundRect.w, backgroundRect.h, 8);
+        }
+        
+        // Redraw changed cells: empty cell first, then the resting tile
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                int cell = i * BOARD_SIZE + j;
+                if (!multiplayerBoardTextureNeedsUpdate && cellValues[p][cell] == textureCells[cell]) continue;
+                textureCells[cell] = cellValues[p][cell];
+                
+                int x = originX + j * (layout.tileSize + layout.tileMargin);
+                int y = originY + i * (layout.tileSize + layout.tileMargin);
+                
+                // Reset the cell area to the board color before drawing into it
+                SDL_Rect cellRect = {x, y, layout.tileSize, layout.tileSize};
+                SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+                renderFillRect(renderer, &cellRect);
+                renderMultiplayerTile(0, static_cast<float>(x), static_cast<float>(y), layout.tileSize, 1.0f);
+                
+                if (cellValues[p][cell] != 0) {
+                    renderMultiplayerTile(cellValues[p][cell], static_cast<float>(x), static_cast<float>(y), layout.tileSize, 1.0f);
+                }
+            }
+        }
+    }
+    
+    SDL_SetRenderTarget(renderer, currentTarget);
+    
+    multiplayerBoardTextureNeedsUpdate = false;
+}
+
+// Draw the moving, merging and appearing tiles of one multiplayer board on top of its static layer
+void renderMultiplayerAnimations(int player) {
+    const GameSnapshot& view = snapshots.readBuffer();
+    const std::vector<std::vector<int> >& playerBoard = view.players[player].board;
+    const AnimationPool& playerPool = view.players[player].animationPool;
+    float deltaTime = view.players[player].animationTimeline.elapsed;
+    
+    BoardLayout layout = getMultiplayerBoardLayout(player, view.playerCount);
+    int cellStep = layout.tileSize + layout.tileMargin;
+    
+    // Render moving tiles
+    float tileX[MAX_TILE_ANIMATIONS];
+    float tileY[MAX_TILE_ANIMATIONS];
+    getMovePositions(playerPool, std::min(1.0f, deltaTime / ANIMATION_DURATION), layout.x, layout.y, cellStep, tileX, tileY);
+    for (int k = 0; k < playerPool.moveCount; k++) {
+        renderMultiplayerTile(playerPool.value[k], tileX[k], tileY[k], layout.tileSize, 1.0f);
+    }
+    
+    // Render merged tiles once the movement phase is over
+    float maxTime = ANIMATION_DURATION + MERGE_ANIMATION_DURATION;
+    float mergeTime = deltaTime / maxTime;
+    if (mergeTime > ANIMATION_DURATION / maxTime) {
+        float mergeProgress = (mergeTime - ANIMATION_DURATION / maxTime) / (MERGE_ANIMATION_DURATION / maxTime);
+        mergeProgress = std::min(1.0f, mergeProgress);
+        
+        // Scale animation - grow to 1.2x then return to normal size
+        float scale = (mergeProgress < 0.5f) ? lerp(1.0f, 1.2f, mergeProgress * 2.0f)
+                                             : lerp(1.2f, 1.0f, (mergeProgress - 0.5f) * 2.0f);
+        
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            if (!(playerPool.mergedCells & (1u << cell))) continue;
+            int row = cell / BOARD_SIZE;
+            int col = cell % BOARD_SIZE;
+            renderMultiplayerTile(playerBoard[row][col], 
+                                  static_cast<float>(layout.x + col * cellStep), 
+                                  static_cast<float>(layout.y + row * cellStep), 
+                                  layout.tileSize, scale);
+        }
+    }
+    
+    // Render new tiles with pop-up animation
+    float newTileProgress = (deltaTime - ANIMATION_DURATION - NEW_TILE_DELAY) / NEW_TILE_ANIMATION_DURATION;
+    newTileProgress = std::max(0.0f, std::min(1.0f, newTileProgress));
+    if (newTileProgress > 0.0f) {
+        // Grow from 0 to 1.05 (slight overshoot), then settle back to 1.0
+        float scale = (newTileProgress < 0.7f) ? newTileProgress / 0.7f * 1.05f
+                                               : 1.05f - ((newTileProgress - 0.7f) / 0.3f * 0.05f);
+        
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            if (!(playerPool.newCells & (1u << cell))) continue;
+            int row = cell / BOARD_SIZE;
+            int col = cell % BOARD_SIZE;
+            renderMultiplayerTile(playerBoard[row][col], 
+                                  static_cast<float>(layout.x + col * cellStep), 
+                                  static_cast<float>(layout.y + row * cellStep), 
+                                  layout.tileSize, scale);
+        }
+    }
+}
+
+void renderButton(const Button& button, TTF_Font* buttonFont) {
+    // Render button background with rounded corners
+    SDL_SetRenderDrawColor(renderer, 
+                      button.isHovered ? BUTTON_HOVER_COLOR.r : BUTTON_COLOR.r,
+                      button.isHovered ? BUTTON_HOVER_COLOR.g : BUTTON_COLOR.g,
+                      button.isHovered ? BUTTON_HOVER_COLOR.b : BUTTON_COLOR.b,
+                      255);
+    drawRoundedRect(renderer, button.rect.x, button.rect.y, button.rect.w, button.rect.h, 10);
+    
+    // Render button text
+    const TextTexture* textLabel = getLabel(buttonFont, button.text, toSDLColor(LIGHT_TEXT));
+    if (textLabel == nullptr) {
+        return; // Handle error
+    }
+    
+    renderLabel(textLabel,
+                button.rect.x + (button.rect.w - textLabel->w) / 2,
+                button.rect.y + (button.rect.h - textLabel->h) / 2);
+}
+
+void renderGameUI() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Render "Back" button in top left corner
+    Button backButton;
+    backButton.rect.x = BOARD_MARGIN;
+    backButton.rect.y = BOARD_MARGIN;
+    backButton.rect.w = 100;
+    backButton.rect.h = 40;
+    backButton.text = "Back";
+    backButton.isHovered = isPointInRect(view.mouseX, view.mouseY, backButton.rect);
+    renderButton(backButton, font);
+
+    // Render "New Game" button next to "Back" button
+    Button newGameButton;
+    newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
+    newGameButton.rect.y = BOARD_MARGIN;
+    newGameButton.rect.w = 120;
+    newGameButton.rect.h = 40;
+    newGameButton.text = "New Game";
+    newGameButton.isHovered = isPointInRect(view.mouseX, view.mouseY, newGameButton.rect);
+    renderButton(newGameButton, font);
+
+    // Render "2048" title
+    SDL_Color textColor = toSDLColor(TEXT_COLOR);
+    renderLabel(getLabel(titleFont, "2048", textColor), BOARD_MARGIN, backButton.rect.y + backButton.rect.h + 10);
+
+    // Render score boxes
+    int boxWidth = 100;
+    int boxHeight = 60;
+    int boxMargin = 10;
+
+    // Best score box
+    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+    SDL_Rect bestScoreBox = {SCREEN_WIDTH - boxWidth - BOARD_MARGIN, BOARD_MARGIN, boxWidth, boxHeight};
+    drawRoundedRect(renderer, bestScoreBox.x, bestScoreBox.y, bestScoreBox.w, bestScoreBox.h, 5);
+
+    // Nhãn lấy từ cache, điểm số được ghép từ atlas chữ số nên không cần tạo texture mới
+    const TextTexture* bestLabel = getLabel(menuFont, "BEST", textColor);
+    const DigitAtlas* scoreDigits = getDigitAtlas(font);
+    int bestLabelHeight = 0;
+    if (bestLabel != nullptr) {
+        bestLabelHeight = bestLabel->h;
+        renderLabel(bestLabel, bestScoreBox.x + (bestScoreBox.w - bestLabel->w) / 2, bestScoreBox.y + 8);
+    }
+    if (scoreDigits != nullptr) {
+        renderNumber(scoreDigits, view.bestScore, bestScoreBox.x + (bestScoreBox.w - measureNumber(scoreDigits, view.bestScore)) / 2, 
+                     bestScoreBox.y + bestLabelHeight + 5, textColor);
+    }
+
+    // Current score box
+    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+    SDL_Rect scoreBox = {bestScoreBox.x - boxWidth - boxMargin, BOARD_MARGIN, boxWidth, boxHeight};
+    drawRoundedRect(renderer, scoreBox.x, scoreBox.y, scoreBox.w, scoreBox.h, 5);
+
+    const TextTexture* scoreLabel = getLabel(menuFont, "SCORE", textColor);
+    int scoreLabelHeight = 0;
+    if (scoreLabel != nullptr) {
+        scoreLabelHeight = scoreLabel->h;
+        renderLabel(scoreLabel, scoreBox.x + (scoreBox.w - scoreLabel->w) / 2, scoreBox.y + 8);
+    }
+    if (scoreDigits != nullptr) {
+        renderNumber(scoreDigits, view.players[0].score, scoreBox.x + (scoreBox.w - measureNumber(scoreDigits, view.players[0].score)) / 2, 
+                     scoreBox.y + scoreLabelHeight + 5, textColor);
+    }
+
+    // Suggested move (H)
+    if (view.hintDirection >= 0) {
+        static const char* const HINT_TEXT[4] = {"Hint: Left", "Hint: Right", "Hint: Up", "Hint: Down"};
+        const TextTexture* hintLabel = getLabel(font, HINT_TEXT[view.hintDirection], textColor);
+        if (hintLabel != nullptr) {
+            renderLabel(hintLabel, scoreBox.x, scoreBox.y + scoreBox.h + 10);
+        }
+    }
+}
+
+void renderMenu() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Clear screen with menu background color
+    SDL_SetRenderDrawColor(renderer, MENU_BACKGROUND_COLOR.r, MENU_BACKGROUND_COLOR.g, MENU_BACKGROUND_COLOR.b, 255);
+    renderClear(renderer);
+    
+    // Render title
+    const TextTexture* titleLabel = getLabel(largeFont, "2048", toSDLColor(TEXT_COLOR));
+    if (titleLabel == nullptr) {
+        // Handle error
+        presentFrame();
+        return;
+    }
+    
+    renderLabel(titleLabel, (SCREEN_WIDTH - titleLabel->w) / 2, 80);
+    
+    // Render buttons
+    for (size_t i = 0; i < view.menuButtons.size(); i++) {
+        renderButton(view.menuButtons[i], menuFont);
+    }
+    
+    // Update screen
+    presentFrame();
+}
+
+void renderHowToPlay() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Clear screen with menu background color
+    SDL_SetRenderDrawColor(renderer, MENU_BACKGROUND_COLOR.r, MENU_BACKGROUND_COLOR.g, MENU_BACKGROUND_COLOR.b, 255);
+    renderClear(renderer);
+    
+    // Render title
+    SDL_Color textColor = toSDLColor(TEXT_COLOR);
+    const TextTexture* titleLabel = getLabel(titleFont, "How to Play", textColor);
+    if (titleLabel == nullptr) {
+        // Handle error
+        presentFrame();
+        return;
+    }
+    
+    renderLabel(titleLabel, (SCREEN_WIDTH - titleLabel->w) / 2, 50);
+    
+    // Render instructions
+    const char* instructions[] = {
+        "Single Player: Use arrow keys or WASD to move tiles",
+        "Tiles with the same number merge into one when they touch",
+        "A new tile appears after each move",
+        "Try to create a tile with the number 2048!",
+        "Press R to restart the game at any time",
+        "In multiplayer mode:",
+        "2-8 players (press 2-8 in the menu): WASD, arrows, IJKL,",
+        "TFGH, numpad, Home/Del/End/PgDn, ZXCV, NM,.",
+        "The player who reaches 2048 first or has the highest",
+        "score when no more moves are possible wins!",
+        "Undo/redo: Z/Y (single), Q/E (player 1), [/] (player 2), ..."
+    
+    };
+    
+    for (int i = 0; i < 11; i++) {
+        const TextTexture* textLabel = getLabel(font, instructions[i], textColor);
+        if (textLabel == nullptr) continue; // Skip if error
+        
+        renderLabel(textLabel, (SCREEN_WIDTH - textLabel->w) / 2, 150 + i * 40);
+    }
+    
+    // Render back button
+    for (size_t i = 0; i < view.howToPlayButtons.size(); i++) {
+        renderButton(view.howToPlayButtons[i], menuFont);
+    }
+    
+    // Update screen
+    presentFrame();
+}
+
+void renderGameBoard() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Clear screen
+    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+    renderClear(renderer);
+    
+    // Update the dirty parts of the board texture, if any
+    updateBoardTexture();
+    
+    // Calculate board position
+    BoardLayout layout = getBoardLayout();
+    int boardX = layout.x;
+    int boardY = layout.y;
+    
+    // Render the board texture
+    SDL_Rect boardRect = getBoardBackgroundRect(layout);
+    renderCopy(renderer, boardTexture, NULL, &boardRect);
+    
+    // Track which cells have animated tiles (one bit per cell)
+    Uint16 cellAnimated = 0;
+    
+    // Render animated tiles on top
+    const AnimationPool& pool = view.players[0].animationPool;
+    float deltaTime = view.players[0].animationTimeline.elapsed;
+    if (view.players[0].animationTimeline.active) {
+        // Render moving tiles
+        float tileX[MAX_TILE_ANIMATIONS];
+        float tileY[MAX_TILE_ANIMATIONS];
+        getMovePositions(pool, std::min(1.0f, deltaTime / ANIMATION_DURATION), boardX, boardY, TILE_SIZE + TILE_MARGIN, tileX, tileY);
+        for (int k = 0; k < pool.moveCount; k++) {
+            renderAnimatedTile(pool.value[k], tileX[k], tileY[k], 1.0f);
+        }
+        
+        // Mark both source and destination cells as animated
+        cellAnimated |= pool.moveCells;
+        
+        // Render merged tiles
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            if (!(pool.mergedCells & (1u << cell))) continue;
+            int i = cell / BOARD_SIZE;
+            int j = cell % BOARD_SIZE;
+            int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
+            int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
+            
+            // Calculate animation progress
+            float maxTime = ANIMATION_DURATION + MERGE_ANIMATION_DURATION;
+            float progress = deltaTime / maxTime;
+            
+            if (progress > ANIMATION_DURATION / maxTime) {
+                // Calculate merge animation progress
+                float mergeProgress = (progress - ANIMATION_DURATION / maxTime) / (MERGE_ANIMATION_DURATION / maxTime);
+                mergeProgress = std::min(1.0f, mergeProgress);
+                
+                // Scale animation - more like original 2048
+                float scale;
+                if (mergeProgress < 0.5f) {
+                    // Grow phase - faster growth to 1.2x
+                    scale = lerp(1.0f, 1.2f, mergeProgress * 2.0f);
+                } else {
+                    // Shrink phase - smooth return to normal size
+                    scale = lerp(1.2f, 1.0f, (mergeProgress - 0.5f) * 2.0f);
+                }
+                
+                renderAnimatedTile(view.players[0].board[i][j], static_cast<float>(x), static_cast<float>(y), scale);
+                
+                // Mark the cell as animated
+                cellAnimated |= getCellBit(i, j);
+            }
+        }
+        
+        // Render new tiles with pop-up animation
+        for (int cell = 0; cell < BOARD_SIZE * BOARD_SIZE; cell++) {
+            if (!(pool.newCells & (1u << cell))) continue;
+            int row = cell / BOARD_SIZE;
+            int col = cell % BOARD_SIZE;
+            int x = boardX + col * (TILE_SIZE + TILE_MARGIN);
+            int y = boardY + row * (TILE_SIZE + TILE_MARGIN);
+            
+            // Calculate scale for appear animation - start from 0 and grow with slight bounce
+            float progress = (deltaTime - ANIMATION_DURATION - NEW_TILE_DELAY) / NEW_TILE_ANIMATION_DURATION;
+            progress = std::max(0.0f, std::min(1.0f, progress));
+            
+            float scale = 0.0f;
+            if (progress > 0.0f) {
+                // Simple grow animation from 0 to 1 with slight overshoot
+                if (progress < 0.7f) {
+                    // Grow from 0 to 1.05 (slight overshoot)
+                    scale = progress / 0.7f * 1.05f;
+                } else {
+                    // Settle back from 1.05 to 1.0
+                    scale = 1.05f - ((progress - 0.7f) / 0.3f * 0.05f);
+                }
+                
+                // Center the tile as it grows
+                float centerX = x + TILE_SIZE / 2.0f;
+                float centerY = y + TILE_SIZE / 2.0f;
+                float scaledX = centerX - (TILE_SIZE * scale) / 2.0f;
+                float scaledY = centerY - (TILE_SIZE * scale) / 2.0f;
+                
+                renderAnimatedTile(view.players[0].board[row][col], scaledX, scaledY, scale);
+                
+                // Mark the cell as animated
+                cellAnimated |= getCellBit(row, col);
+            }
+        }
+        
+        // Render static tiles (tiles that don't move)
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                if (view.players[0].board[i][j] != 0 && !(cellAnimated & getCellBit(i, j))) {
+                    int x = boardX + j * (TILE_SIZE + TILE_MARGIN);
+                    int y = boardY + i * (TILE_SIZE + TILE_MARGIN);
+                    renderTile(view.players[0].board[i][j], x, y);
+                }
+            }
+        }
+    }
+    
+    // Render UI elements (buttons, scores, etc.)
+    renderGameUI();
+    
+    // Present the renderer
+    presentFrame();
+}
+
+void renderMultiplayerGameBoard() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Clear screen with background color (light cream)
+    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+    renderClear(renderer);
+
+    // Render "Back" button in top left corner
+    Button backButton;
+    backButton.rect.x = BOARD_MARGIN;
+    backButton.rect.y = BOARD_MARGIN;
+    backButton.rect.w = 100;
+    backButton.rect.h = 40;
+    backButton.text = "Back";
+    backButton.isHovered = isPointInRect(view.mouseX, view.mouseY, backButton.rect);
+    renderButton(backButton, font);
+
+    // Render "New Game" button next to "Back" button
+    Button newGameButton;
+    newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10; // 10px spacing between buttons
     newGameButton.rect.y = BOARD_MARGIN;
     newGameButton.rect.w = 120;
     newGameButton.rect.h = 40;
     newGameButton.text = "New Game";
-    newGameButton.isHovered = isPointInRect(mouseX, mouseY, newGameButton.rect);
+    newGameButton.isHovered = isPointInRect(view.mouseX, view.mouseY, newGameButton.rect);
     renderButton(newGameButton, font);
 
     // Render "2048" title in the top right corner
     SDL_Color textColor = toSDLColor(TEXT_COLOR);
-    SDL_Surface* titleSurface = TTF_RenderText_Blended(titleFont, "2048", textColor);
-    if (titleSurface == nullptr) {
+    const TextTexture* titleLabel = getLabel(titleFont, "2048", textColor);
+    if (titleLabel == nullptr) {
         // Handle error
-        SDL_RenderPresent(renderer);
+        presentFrame();
         return;
     }
-    
-    SDL_Texture* titleTexture = SDL_CreateTextureFromSurface(renderer, titleSurface);
+    
+    renderLabel(titleLabel, SCREEN_WIDTH - titleLabel->w - BOARD_MARGIN, BOARD_MARGIN);
+
+    // All boards are drawn from the shared cached static layer in one copy
+    updateMultiplayerBoardTexture();
+    SDL_Rect boardsArea = getMultiplayerBoardsArea();
+    renderCopy(renderer, multiplayerBoardTexture, NULL, &boardsArea);
+    
+    // Render animated tiles on top of the boards whose animations are running
+    for (int p = 0; p < view.playerCount; p++) {
+        if (view.players[p].animationTimeline.active) {
+            renderMultiplayerAnimations(p);
+        }
+    }
+    
+    // Player headers with score below the boards. With more than two players the boards
+    // are narrow, so the header shows "P3" and the score only.
+    bool compactHeaders = view.playerCount > 2;
+    TTF_Font* headerFont = compactHeaders ? font : menuFont;
+    for (int p = 0; p < view.playerCount; p++) {
+        BoardLayout layout = getMultiplayerBoardLayout(p, view.playerCount);
+        SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
+        SDL_Rect header = {layout.x, layout.y + layout.height + 15, layout.width, 40};
+        drawRoundedRect(renderer, header.x, header.y, header.w, header.h, 5);
+        
+        // Player label
+        std::string labelText = compactHeaders 
+            ? "P" + std::to_string(p + 1)
+            : "Player " + std::to_string(p + 1) + " (" + PLAYER_CONTROLS[p].name + ")";
+        if (view.networkEnabled) {
+            labelText = (p == 0) ? "You (WASD/Arrows)" : "Opponent";
+        }
+        const TextTexture* playerLabel = getLabel(headerFont, labelText, textColor);
+        if (playerLabel == nullptr) {
+            // Handle error
+            presentFrame();
+            return;
+        }
+        
+        renderLabel(playerLabel, header.x + 10, header.y + (header.h - playerLabel->h) / 2);
+        
+        // Player score
+        int playerScore = view.players[p].score;
+        int scoreY = header.y + (header.h - playerLabel->h) / 2;
+        if (compactHeaders) {
+            const DigitAtlas* scoreDigits = getDigitAtlas(headerFont);
+            if (scoreDigits != nullptr) {
+                renderNumber(scoreDigits, playerScore, header.x + header.w - measureNumber(scoreDigits, playerScore) - 10, 
+                             scoreY, textColor);
+            }
+        } else {
+            int scoreWidth = measurePrefixedNumber(headerFont, "Score: ", playerScore, textColor);
+            renderPrefixedNumber(headerFont, "Score: ", playerScore, header.x + header.w - scoreWidth - 10, scoreY, textColor);
+        }
+    }
+    
+    if (view.networkEnabled) {
+        renderNetworkStatus();
+    }
+    
+    // Update screen
+    presentFrame();
+}
+
+// Networked game HUD between the buttons and the boards: connection state, or the latency
+// of the opponent's moves and the round trip time
+void renderNetworkStatus() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    SDL_Color textColor = toSDLColor(TEXT_COLOR);
+    
+    if (!view.networkConnected) {
+        std::string status = view.networkHost 
+            ? "Waiting for an opponent on port " + std::to_string(view.networkPort)
+            : "Opponent disconnected";
+        const TextTexture* statusLabel = getLabel(font, status, textColor);
+        if (statusLabel != nullptr) {
+            renderLabel(statusLabel, (SCREEN_WIDTH - statusLabel->w) / 2, 70);
+        }
+        return;
+    }
+    
+    int latencyMs = static_cast<int>(remoteMoveLatencyMs + 0.5f);
+    int latencyWidth = measurePrefixedNumber(font, "Opponent move latency (ms): ", latencyMs, textColor);
+    renderPrefixedNumber(font, "Opponent move latency (ms): ", latencyMs, (SCREEN_WIDTH - latencyWidth) / 2, 60, textColor);
+    
+    // Localhost round trips are well below a millisecond
+    int rttUs = static_cast<int>(view.networkRttMs * 1000.0f);
+    int rttWidth = measurePrefixedNumber(font, "Round trip (us): ", rttUs, textColor);
+    renderPrefixedNumber(font, "Round trip (us): ", rttUs, (SCREEN_WIDTH - rttWidth) / 2, 95, textColor);
+}
+
+void renderGameOver() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Create semi-transparent overlay
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
+    SDL_Rect overlay = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    renderFillRect(renderer, &overlay);
+    
+    // Render message
+    std::string message = view.players[0].won ? "You Win!" : "Game Over!";
+    SDL_Color whiteColor;
+    whiteColor.r = 255;
+    whiteColor.g = 255;
+    whiteColor.b = 255;
+    whiteColor.a = 255;
+    
+    const TextTexture* messageText = getLabel(largeFont, message, whiteColor);
+    if (messageText == nullptr) {
+        // Handle error
+        presentFrame();
+        return;
+    }
+    
+    renderLabel(messageText, (SCREEN_WIDTH - messageText->w) / 2, 200);
+    
+    // Render final score
+    int scoreWidth = measurePrefixedNumber(titleFont, "Score: ", view.players[0].score, whiteColor);
+    renderPrefixedNumber(titleFont, "Score: ", view.players[0].score, (SCREEN_WIDTH - scoreWidth) / 2, 280, whiteColor);
+    
+    // Render buttons
+    for (size_t i = 0; i < view.gameOverButtons.size(); i++) {
+        renderButton(view.gameOverButtons[i], menuFont);
+    }
+    
+    // Update screen
+    presentFrame();
+}
+
+void renderMultiplayerGameOver() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    // Create semi-transparent overlay
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
+    SDL_Rect overlay = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    renderFillRect(renderer, &overlay);
+    
+    // Determine winner: the player who reached 2048, otherwise the highest score
+    int winner = -1;
+    bool tie = false;
+    for (int p = 0; p < view.playerCount; p++) {
+        if (view.players[p].won) {
+            winner = p;
+            tie = false;
+            break;
+        }
+        if (winner < 0 || view.players[p].score > view.players[winner].score) {
+            winner = p;
+            tie = false;
+        } else if (view.players[p].score == view.players[winner].score) {
+            tie = true;
+        }
+    }
+    std::string message = tie ? "It's a Tie!" : "Player " + std::to_string(winner + 1) + " Wins!";
+    
+    SDL_Color whiteColor;
+    whiteColor.r = 255;
+    whiteColor.g = 255;
+    whiteColor.b = 255;
+    whiteColor.a = 255;
+    
+    const TextTexture* messageText = getLabel(largeFont, message, whiteColor);
+    if (messageText == nullptr) {
+        // Handle error
+        presentFrame();
+        return;
+    }
+    
+    renderLabel(messageText, (SCREEN_WIDTH - messageText->w) / 2, 180);
+    
+    // Render player scores: one centered line each for two players, two columns of
+    // smaller lines for more so the list stays above the buttons
+    bool twoColumns = view.playerCount > 2;
+    TTF_Font* scoreFont = twoColumns ? font : titleFont;
+    int lineHeight = twoColumns ? 34 : 60;
+    int linesPerColumn = twoColumns ? (view.playerCount + 1) / 2 : view.playerCount;
+    for (int p = 0; p < view.playerCount; p++) {
+        std::string prefix = "Player " + std::to_string(p + 1) + " Score: ";
+        int scoreWidth = measurePrefixedNumber(scoreFont, prefix, view.players[p].score, whiteColor);
+        int centerX = twoColumns ? SCREEN_WIDTH / 4 + (p / linesPerColumn) * SCREEN_WIDTH / 2 : SCREEN_WIDTH / 2;
+        int y = 260 + (p % linesPerColumn) * lineHeight;
+        renderPrefixedNumber(scoreFont, prefix, view.players[p].score, centerX - scoreWidth / 2, y, whiteColor);
+    }
+    
+    // Render buttons
+    for (size_t i = 0; i < view.multiplayerGameOverButtons.size(); i++) {
+        renderButton(view.multiplayerGameOverButtons[i], menuFont);
+    }
+    
+    // Update screen
+    presentFrame();
+}
+
+void updateButtonHoverStates() {
+    // Update menu buttons
+    if (currentState == MENU) {
+        for (size_t i = 0; i < menuButtons.size(); i++) {
+            menuButtons[i].isHovered = isPointInRect(mouseX, mouseY, menuButtons[i].rect);
+        }
+    }
+    // Update how to play buttons
+    else if (currentState == HOW_TO_PLAY) {
+        for (size_t i = 0; i < howToPlayButtons.size(); i++) {
+            howToPlayButtons[i].isHovered = isPointInRect(mouseX, mouseY, howToPlayButtons[i].rect);
+        }
+    }
+    // Update game over buttons
+    else if (currentState == GAME_OVER) {
+        for (size_t i = 0; i < gameOverButtons.size(); i++) {
+            gameOverButtons[i].isHovered = isPointInRect(mouseX, mouseY, gameOverButtons[i].rect);
+        }
+    }
+    // Update multiplayer game over buttons
+    else if (currentState == MULTIPLAYER_GAME_OVER) {
+        for (size_t i = 0; i < multiplayerGameOverButtons.size(); i++) {
+            multiplayerGameOverButtons[i].isHovered = isPointInRect(mouseX, mouseY, multiplayerGameOverButtons[i].rect);
+        }
+    }
+}
+
+void restart() {
+    // A networked game restarts the local board only; the opponent's mirror follows
+    // their NET_BOARD message
+    int resetPlayers = network.enabled ? 1 : MAX_PLAYERS;
+    
+    // Reset game state
+    for (int p = 0; p < resetPlayers; p++) {
+        PlayerState& player = players[p];
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                player.board[i][j] = 0;
+            }
+        }
+        player.score = 0;
+        player.gameOver = false;
+        player.won = false;
+        
+        // Clear animations
+        clearAnimationPool(player.animationPool);
+        player.animationTimeline.active = false;
+    }
+    currentPlayer = 0;
+    queuedKeys.clear();
+    
+    // Multiplayer restarts every board in play, single player only the first
+    if (currentState == MULTIPLAYER || currentState == MULTIPLAYER_GAME_OVER) {
+        currentState = MULTIPLAYER;
+    } else {
+        currentState = PLAYING;
+    }
+    
+    // Thêm 2 ô ngẫu nhiên trực tiếp vào mỗi bảng thay vì qua animation.
+    // Each board draws its spawns from its own stream, seeded from rng, so undoing one
+    // player's move does not change the tiles of the others.
+    std::uniform_int_distribution<int> valueDist(0, 9);
+    for (int p = 0; p < std::min(resetPlayers, getActivePlayerCount()); p++) {
+        TileRng& playerRng = players[p].rng;
+        playerRng.seed(rng());
+        std::vector<std::pair<int, int>> emptyCells;
+        
+        // Tìm tất cả các ô trống
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                emptyCells.push_back(std::make_pair(i, j));
+            }
+        }
+        
+        // Chọn 2 ô ngẫu nhiên
+        std::shuffle(emptyCells.begin(), emptyCells.end(), playerRng);
+        
+        // Thêm hai ô đầu tiên (90% là 2, 10% là 4)
+        for (int k = 0; k < 2; k++) {
+            players[p].board[emptyCells[k].first][emptyCells[k].second] = (valueDist(playerRng) < 9) ? 2 : 4;
+        }
+    }
+    
+    // Lịch sử undo bắt đầu lại từ bàn cờ mới
+    for (int p = 0; p < resetPlayers; p++) {
+        clearHistory(players[p].moveHistory);
+    }
+    for (int p = 0; p < std::min(resetPlayers, getActivePlayerCount()); p++) {
+        recordHistory(p);
+    }
+    
+    // Lưu game sau khi khởi tạo lại
+    saveGame();
+    sendBoard();
+    
+    // Play button sound
+    playSound(SOUND_EFFECT_BUTTON);
+}
+
+// Add the current state of a player's board to its history
+void recordHistory(int player) {
+    MoveHistory& history = players[player].moveHistory;
+    HistoryEntry entry;
+    entry.rngState = players[player].rng.state;
+    entry.score = players[player].score;
+    if (!packBoard(players[player].board, entry.board)) {
+        // Tiles above 32768 do not fit the packed board: undo stops here
+        clearHistory(history);
+        return;
+    }
+    pushHistory(history, entry);
+}
+
+// True if the history's current state is the board and score on screen
+bool isHistoryCurrent(int player) {
+    MoveHistory& history = players[player].moveHistory;
+    Uint64 packed = 0;
+    if (history.count == 0 || !packBoard(players[player].board, packed)) return false;
+    
+    const HistoryEntry& entry = getHistoryEntry(history, history.cursor);
+    return entry.board == packed && entry.score == players[player].score;
+}
+
+// Undo (step = -1) or redo (step = 1) one move of a player. A running animation of that board
+// is dropped and the restored board is shown as is. The player's RNG goes back to where it
+// was, so repeating an undone move spawns the same tile; the other boards are not affected.
+void stepHistory(int player, int step) {
+    PlayerState& state = players[player];
+    const HistoryEntry* entry = (step < 0) ? undoHistory(state.moveHistory) : redoHistory(state.moveHistory);
+    if (entry == nullptr) return;
+    
+    state.animationTimeline.active = false;
+    resetAnimationTimeline(state.animationTimeline);
+    clearAnimationPool(state.animationPool);
+    
+    unpackBoard(entry->board, state.board);
+    state.score = entry->score;
+    state.rng.seed(entry->rngState);
+    // Undoing out of a lost position puts the player back in the game
+    state.gameOver = !canMove(state.board);
+    
+    playSound(SOUND_EFFECT_MOVE);
+    saveGame();
+}
+
+// Restart an animation clock at the beginning of a move
+void resetAnimationTimeline(AnimationTimeline& timeline) {
+    timeline.elapsed = 0.0f;
+    timeline.time = 0.0f;
+    timeline.previousTime = 0.0f;
+    timeline.accumulator = 0.0f;
+    timeline.lastFrameTime = std::chrono::steady_clock::now();
+}
+
+// True while any board is animating
+bool isAnimating() const {
+    for (int p = 0; p < getActivePlayerCount(); p++) {
+        if (players[p].animationTimeline.active) return true;
+    }
+    return false;
+}
+
+// The player whose controls include a key: in multiplayer the PLAYER_CONTROLS entry the key
+// belongs to (-1 for none), in single player always the one board
+int getKeyPlayer(SDL_Keycode key) const {
+    if (currentState != MULTIPLAYER) return 0;
+    
+    // A networked game has one local board, moved by WASD and the arrow keys
+    if (network.enabled) return (getMoveDirection(key) >= 0) ? 0 : -1;
+    
+    for (int p = 0; p < playerCount; p++) {
+        const PlayerControls& controls = PLAYER_CONTROLS[p];
+        if (isMoveKey(controls, key) || key == controls.undo || key == controls.redo) return p;
+    }
+    return -1;
+}
+
+// Whether a key has to wait for a running animation. In multiplayer only the moves of
+// a player whose board is animating wait; undo, restart and menu keys never do.
+bool isKeyBlockedByAnimation(SDL_Keycode key) const {
+    if (currentState != MULTIPLAYER) {
+        return players[0].animationTimeline.active;
+    }
+    
+    int player = getKeyPlayer(key);
+    return player >= 0 && getMoveDirection(key) >= 0 && players[player].animationTimeline.active;
+}
+
+// The direction a move key stands for, -1 for other keys. Single player and networked games
+// accept both WASD and the arrow keys.
+int getMoveDirection(SDL_Keycode key) const {
+    int controlSets = (currentState == MULTIPLAYER && !network.enabled) ? playerCount : 2;
+    for (int p = 0; p < controlSets; p++) {
+        const PlayerControls& controls = PLAYER_CONTROLS[p];
+        if (key == controls.left) return MOVE_LEFT;
+        if (key == controls.right) return MOVE_RIGHT;
+        if (key == controls.up) return MOVE_UP;
+        if (key == controls.down) return MOVE_DOWN;
+    }
+    return -1;
+}
 
-    SDL_Rect titleRect = {
-        SCREEN_WIDTH - titleSurface->w - BOARD_MARGIN,
-        BOARD_MARGIN,
-        titleSurface->w,
-        titleSurface->h
-    };
+// Move the board of currentPlayer; returns true if any tile moved
+bool applyMove(int direction) {
+    switch (direction) {
+        case MOVE_LEFT: return moveLeft();
+        case MOVE_RIGHT: return moveRight();
+        case MOVE_UP: return moveUp();
+        case MOVE_DOWN: return moveDown();
+    }
+    return false;
+}
 
-    SDL_RenderCopy(renderer, titleTexture, NULL, &titleRect);
-    SDL_FreeSurface(titleSurface);
-    SDL_DestroyTexture(titleTexture);
+void updateAnimations() {
+    // Advance each board's timeline on its own, a finished board does not wait for the others
+    for (int p = 0; p < getActivePlayerCount(); p++) {
+        if (players[p].animationTimeline.active) {
+            advanceAnimationTimeline(p);
+        }
+    }
+}
 
-    // Calculate board positions - two boards side by side with full size
-    int boardWidth = static_cast<int>((BOARD_SIZE * TILE_SIZE + (BOARD_SIZE - 1) * TILE_MARGIN) * 0.85); // 85% of original size
-    int boardHeight = boardWidth;
-    int tileSize = static_cast<int>(TILE_SIZE * 0.85);
-    int tileMargin = static_cast<int>(TILE_MARGIN * 0.85);
-    int boardSpacing = 60; // Reduced space between boards
+void advanceAnimationTimeline(int player) {
+    AnimationTimeline& timeline = players[player].animationTimeline;
+    
+    // Real time since the last frame. A slow frame advances the animation by more steps
+    // (frames are dropped, the animation does not slow down); only long stalls are cut.
+    auto currentTime = std::chrono::steady_clock::now();
+    float frameTime = std::chrono::duration<float>(currentTime - timeline.lastFrameTime).count();
+    frameTime = std::min(frameTime, MAX_ANIMATION_FRAME_TIME);
+    
+    // Headless frames must not depend on how fast the machine renders them
+    if (headless) {
+        frameTime = HEADLESS_FRAME_DT;
+    }
+    
+    timeline.lastFrameTime = currentTime;
+    
+    // Advance the animation in fixed steps
+    timeline.accumulator += frameTime;
+    while (timeline.accumulator >= ANIMATION_STEP) {
+        timeline.previousTime = timeline.time;
+        timeline.time += ANIMATION_STEP;
+        timeline.accumulator -= ANIMATION_STEP;
+    }
+    
+    // Render between the last two steps so motion follows the display rate smoothly
+    timeline.elapsed = lerp(timeline.previousTime, timeline.time, timeline.accumulator / ANIMATION_STEP);
+    
+    // Check if animations are complete
+    bool allComplete = true;
+    float totalAnimationTime = ANIMATION_DURATION + NEW_TILE_DELAY + NEW_TILE_ANIMATION_DURATION;
+    
+    if (timeline.time < totalAnimationTime) {
+        allComplete = false;
+    }
     
-    int boardP1X = (SCREEN_WIDTH / 2) - boardWidth - (boardSpacing / 2);
-    int boardP2X = (SCREEN_WIDTH / 2) + (boardSpacing / 2);
-    int boardY = HEADER_HEIGHT;
+    if (allComplete) {
+        finishAnimation(player);
+    }
+}
 
-    // Draw player 1 board background with rounded corners - using same color as single player
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    drawRoundedRect(renderer, boardP1X - tileMargin, boardY - tileMargin, 
-                    boardWidth + tileMargin * 2, boardHeight + tileMargin * 2, 8);
+// End the running animation of one board: tiles settle into their final cells and
+// the win/game over checks run. Also used to snap an animation when a key is queued.
+void finishAnimation(int player) {
+    // The helpers below work on the board of currentPlayer
+    currentPlayer = player;
+    
+    // Reset animation state
+    AnimationTimeline& timeline = players[player].animationTimeline;
+    timeline.active = false;
+    resetAnimationTimeline(timeline);
+    
+    // Clear animation data
+    clearAnimationPool(players[player].animationPool);
+    
+    // Check game state after animations complete (not again once the game has ended)
+    if (currentState == PLAYING || currentState == MULTIPLAYER) {
+        checkWin();
+        checkGameOver();
+    }
+}
 
-    // Draw player 2 board background with rounded corners - using same color as single player
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    drawRoundedRect(renderer, boardP2X - tileMargin, boardY - tileMargin, 
-                    boardWidth + tileMargin * 2, boardHeight + tileMargin * 2, 8);
+// Keep a key pressed during an animation; when the queue is full the newest key is dropped.
+// The whole event is kept so its timestamp still counts for the input latency.
+void queueKey(const SDL_Event& e) {
+    if (queuedKeys.size() < MAX_QUEUED_KEYS) {
+        queuedKeys.push_back(e);
+    }
+}
 
-    // Render empty cells for player 1 board
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            int x = boardP1X + j * (tileSize + tileMargin);
-            int y = boardY + i * (tileSize + tileMargin);
+// Apply the queued keys in order. The animation a key waits for is snapped to its end
+// state first, so rapid key sequences are played at input rate instead of animation rate.
+void processQueuedKeys() {
+    while (!queuedKeys.empty()) {
+        // A finished game or another screen discards the rest of the queue
+        if (currentState != PLAYING && currentState != MULTIPLAYER) {
+            queuedKeys.clear();
+            break;
+        }
+        
+        SDL_Event e = queuedKeys.front();
+        if (isKeyBlockedByAnimation(e.key.keysym.sym)) {
+            finishAnimation(getKeyPlayer(e.key.keysym.sym));
+            continue;
+        }
+        
+        queuedKeys.pop_front();
+        handleEvent(e);
+    }
+}
+
+void handleMenuInput(SDL_Event& e) {
+    if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+        updateButtonHoverStates();
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
             
-            // Draw empty tile
-            SDL_SetRenderDrawColor(renderer, EMPTY_TILE_COLOR.r, EMPTY_TILE_COLOR.g, EMPTY_TILE_COLOR.b, 255);
-            drawRoundedRect(renderer, x, y, tileSize, tileSize, 6);
+            // Check which button was clicked
+            for (size_t i = 0; i < menuButtons.size(); i++) {
+                if (isPointInRect(mouseX, mouseY, menuButtons[i].rect)) {
+                    // Play button sound
+                    playSound(SOUND_EFFECT_BUTTON);
+                    
+                    // Handle button click
+                    switch (i) {
+                        case 0: // Singleplayer
+                            // Tải game chế độ đơn nếu có
+                            if (loadGame(false)) {
+                                currentState = PLAYING;
+                            } else {
+                                // Không có game đã lưu, khởi tạo mới
+                                currentState = PLAYING;
+                                restart();
+                            }
+                            break;
+                        case 1: // Multiplayer
+                            // Tải game chế độ đa người nếu có
+                            startMultiplayer();
+                            break;
+                        case 2: // How to Play
+                            currentState = HOW_TO_PLAY;
+                            break;
+                        case 3: // Exit
+                            gameOver = true; // This will cause the application to exit
+                            break;
+                    }
+                }
+            }
         }
     }
-    
-    // Render empty cells for player 2 board
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            int x = boardP2X + j * (tileSize + tileMargin);
-            int y = boardY + i * (tileSize + tileMargin);
+    else if (e.type == SDL_KEYDOWN) {
+        // Number keys 2-8 choose the player count of a new multiplayer game
+        SDL_Keycode key = e.key.keysym.sym;
+        if (key >= SDLK_2 && key <= SDLK_0 + MAX_PLAYERS) {
+            playSound(SOUND_EFFECT_BUTTON);
+            setSelectedPlayerCount(static_cast<int>(key - SDLK_0));
+        }
+    }
+}
+
+void handleHowToPlayInput(SDL_Event& e) {
+    if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+        updateButtonHoverStates();
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
             
-            // Draw empty tile
-            SDL_SetRenderDrawColor(renderer, EMPTY_TILE_COLOR.r, EMPTY_TILE_COLOR.g, EMPTY_TILE_COLOR.b, 255);
-            drawRoundedRect(renderer, x, y, tileSize, tileSize, 6);
+            // Check if back button was clicked
+            if (isPointInRect(mouseX, mouseY, howToPlayButtons[0].rect)) {
+                playSound(SOUND_EFFECT_BUTTON);
+                currentState = MENU;
+            }
         }
     }
-    
-    // Create a map to track which cells have animated tiles for each player
-    std::vector<std::vector<bool>> cellOccupiedP1(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
-    std::vector<std::vector<bool>> cellOccupiedP2(BOARD_SIZE, std::vector<bool>(BOARD_SIZE, false));
-    
-    // Render animated tiles for player 1
-    if (animating && currentPlayer == PLAYER_ONE) {
-        // First render all non-merged tiles that are moving
-        for (size_t i = 0; i < animations.size(); i++) {
-            TileAnimation& anim = animations[i];
+    else if (e.type == SDL_KEYDOWN) {
+        if (e.key.keysym.sym == SDLK_ESCAPE) {
+            playSound(SOUND_EFFECT_BUTTON);
+            currentState = MENU;
+        }
+    }
+}
+
+void handleGameOverInput(SDL_Event& e) {
+    if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+        updateButtonHoverStates();
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
             
-            if (anim.state == MOVING && !anim.merged) {
-                // Calculate interpolated position with improved easing
-                float progress = std::min(1.0f, anim.progress / ANIMATION_DURATION);
-                float eased = easeInOut(progress);
-                
-                float startX = static_cast<float>(boardP1X + anim.startCol * (tileSize + tileMargin));
-                float startY = static_cast<float>(boardY + anim.startRow * (tileSize + tileMargin));
-                float endX = static_cast<float>(boardP1X + anim.endCol * (tileSize + tileMargin));
-                float endY = static_cast<float>(boardY + anim.endRow * (tileSize + tileMargin));
-                
-                // Để tránh di chuyển chéo, di chuyển theo hai bước: ngang trước, dọc sau
-                float x, y;
-                
-                // Nếu cùng hàng, chỉ di chuyển ngang
-                if (anim.startRow == anim.endRow) {
-                    x = lerp(startX, endX, eased);
-                    y = startY; // Giữ nguyên y
-                }
-                // Nếu cùng cột, chỉ di chuyển dọc
-                else if (anim.startCol == anim.endCol) {
-                    x = startX; // Giữ nguyên x
-                    y = lerp(startY, endY, eased);
-                }
-                // Nếu khác cả hàng và cột (trường hợp hiếm gặp), di chuyển ngang trước, dọc sau
-                else {
-                    if (progress < 0.5f) {
-                        // Di chuyển ngang trước
-                        x = lerp(startX, endX, eased * 2.0f);
-                        y = startY;
-                    } else {
-                        // Di chuyển dọc sau
-                        x = endX;
-                        y = lerp(startY, endY, (eased - 0.5f) * 2.0f);
-                    }
-                }
-                
-                // Set tile color based on value
-                Color tileColor;
-                if (anim.value == 0) {
-                    tileColor = EMPTY_TILE_COLOR;
-                } else {
-                    int colorIndex = std::min(static_cast<int>(log2(anim.value)) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                    tileColor = TILE_COLORS[colorIndex];
-                }
-                
-                // Draw tile
-                SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                drawRoundedRect(renderer, static_cast<int>(x), static_cast<int>(y), tileSize, tileSize, 6);
-                
-                // Render tile value
-                if (anim.value > 0) {
-                    std::string valueStr = std::to_string(anim.value);
-                    SDL_Color textColor = (anim.value >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                    
-                    SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                    if (textSurface == nullptr) continue; // Skip if error
-                    
-                    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                    
-                    SDL_Rect textRect = {
-                        static_cast<int>(x + (tileSize - textSurface->w) / 2),
-                        static_cast<int>(y + (tileSize - textSurface->h) / 2),
-                        textSurface->w,
-                        textSurface->h
-                    };
+            // Check which button was clicked
+            for (size_t i = 0; i < gameOverButtons.size(); i++) {
+                if (isPointInRect(mouseX, mouseY, gameOverButtons[i].rect)) {
+                    playSound(SOUND_EFFECT_BUTTON);
                     
-                    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                    SDL_FreeSurface(textSurface);
-                    SDL_DestroyTexture(textTexture);
-                }
-                
-                // Mark destination cell as occupied
-                if (progress >= 0.99f) {
-                    cellOccupiedP1[anim.endRow][anim.endCol] = true;
+                    // Handle button click
+                    switch (i) {
+                        case 0: // Play Again
+                            restart();
+                            break;
+                        case 1: // Main Menu
+                            currentState = MENU;
+                            break;
+                    }
                 }
             }
         }
-        
-        // Then render merged tiles with separate animations
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                std::pair<int, int> pos = std::make_pair(i, j);
-                if (mergedTiles.find(pos) != mergedTiles.end()) {
-                    int x = boardP1X + j * (tileSize + tileMargin);
-                    int y = boardY + i * (tileSize + tileMargin);
-                    
-                    // Calculate animation progress
-                    float maxTime = ANIMATION_DURATION + MERGE_ANIMATION_DURATION;
-                    float progress = deltaTime / maxTime;
+    }
+    else if (e.type == SDL_KEYDOWN) {
+        if (e.key.keysym.sym == SDLK_r) {
+            playSound(SOUND_EFFECT_BUTTON);
+            restart();
+        }
+        else if (e.key.keysym.sym == SDLK_ESCAPE) {
+            playSound(SOUND_EFFECT_BUTTON);
+            currentState = MENU;
+        }
+    }
+}
+
+void handleMultiplayerGameOverInput(SDL_Event& e) {
+    if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+        updateButtonHoverStates();
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
+            
+            // Check which button was clicked
+            for (size_t i = 0; i < multiplayerGameOverButtons.size(); i++) {
+                if (isPointInRect(mouseX, mouseY, multiplayerGameOverButtons[i].rect)) {
+                    playSound(SOUND_EFFECT_BUTTON);
                     
-                    // If we're in the merge phase (after movement)
-                    if (progress > ANIMATION_DURATION / maxTime) {
-                        // Calculate merge animation progress
-                        float mergeProgress = (progress - ANIMATION_DURATION / maxTime) / (MERGE_ANIMATION_DURATION / maxTime);
-                        mergeProgress = std::min(1.0f, mergeProgress);
-                        
-                        // Scale animation - more like original 2048
-                        float scale;
-                        if (mergeProgress < 0.5f) {
-                            // Grow phase - faster growth to 1.2x
-                            scale = lerp(1.0f, 1.2f, mergeProgress * 2.0f);
-                        } else {
-                            // Shrink phase - smooth return to normal size
-                            scale = lerp(1.2f, 1.0f, (mergeProgress - 0.5f) * 2.0f);
-                        }
-                        
-                        // Calculate size based on scale
-                        int scaledSize = static_cast<int>(tileSize * scale);
-                        int xOffset = static_cast<int>((tileSize - scaledSize) / 2);
-                        int yOffset = static_cast<int>((tileSize - scaledSize) / 2);
-                        
-                        // Set tile color
-                        Color tileColor;
-                        int colorIndex = std::min(static_cast<int>(log2(board[i][j])) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                        tileColor = TILE_COLORS[colorIndex];
-                        
-                        // Draw tile
-                        SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                        drawRoundedRect(renderer, x + xOffset, y + yOffset, scaledSize, scaledSize, static_cast<int>(6 * scale));
-                        
-                        // Render tile value
-                        std::string valueStr = std::to_string(board[i][j]);
-                        SDL_Color textColor = (board[i][j] >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                        
-                        SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                        if (textSurface == nullptr) continue; // Skip if error
-                        
-                        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                        
-                        int textWidth = static_cast<int>(textSurface->w * scale);
-                        int textHeight = static_cast<int>(textSurface->h * scale);
-                        
-                        SDL_Rect textRect = {
-                            static_cast<int>(x + (tileSize - textWidth) / 2),
-                            static_cast<int>(y + (tileSize - textHeight) / 2),
-                            textWidth,
-                            textHeight
-                        };
-                        
-                        SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                        SDL_FreeSurface(textSurface);
-                        SDL_DestroyTexture(textTexture);
-                        
-                        cellOccupiedP1[i][j] = true;
+                    // Handle button click
+                    switch (i) {
+                        case 0: // Play Again
+                            restart();
+                            break;
+                        case 1: // Main Menu
+                            currentState = MENU;
+                            break;
                     }
                 }
             }
         }
+    }
+    else if (e.type == SDL_KEYDOWN) {
+        if (e.key.keysym.sym == SDLK_r) {
+            playSound(SOUND_EFFECT_BUTTON);
+            restart();
+        }
+        else if (e.key.keysym.sym == SDLK_ESCAPE) {
+            playSound(SOUND_EFFECT_BUTTON);
+            currentState = MENU;
+        }
+    }
+}
+
+void handleGameInput(SDL_Event& e) {
+    if (e.type == SDL_QUIT) {
+        gameOver = true;
+    }
+    else if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
+
+            // Check if "Back" button was clicked
+            Button backButton;
+            backButton.rect.x = BOARD_MARGIN;
+            backButton.rect.y = BOARD_MARGIN;
+            backButton.rect.w = 100;
+            backButton.rect.h = 40;
+
+            if (isPointInRect(mouseX, mouseY, backButton.rect)) {
+                playSound(SOUND_EFFECT_BUTTON);
+                saveGame(true); // Lưu game khi quay lại menu
+                currentState = MENU;
+            }
+
+            // Check if "New Game" button was clicked
+            Button newGameButton;
+            newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
+            newGameButton.rect.y = BOARD_MARGIN;
+            newGameButton.rect.w = 120;
+            newGameButton.rect.h = 40;
+
+            if (isPointInRect(mouseX, mouseY, newGameButton.rect)) {
+                playSound(SOUND_EFFECT_BUTTON);
+                // Đảm bảo chúng ta ở chế độ chơi đơn
+                currentState = PLAYING;
+                restart();
+            }
+        }
+    }
+    else if (e.type == SDL_KEYDOWN && isKeyBlockedByAnimation(e.key.keysym.sym)) {
+        // Play it once the current animation has been snapped to its end
+        queueKey(e);
+    }
+    else if (e.type == SDL_KEYDOWN) {
+        bool moved = false;
+        
+        switch (e.key.keysym.sym) {
+            case SDLK_LEFT:
+            case SDLK_a:
+                moved = moveLeft();
+                break;
+            case SDLK_RIGHT:
+            case SDLK_d:
+                moved = moveRight();
+                break;
+            case SDLK_UP:
+            case SDLK_w:
+                moved = moveUp();
+                break;
+            case SDLK_DOWN:
+            case SDLK_s:
+                moved = moveDown();
+                break;
+            case SDLK_z:
+                stepHistory(0, -1);
+                break;
+            case SDLK_y:
+                stepHistory(0, 1);
+                break;
+            case SDLK_m:
+                aiAutoplay = !aiAutoplay;
+                break;
+            case SDLK_h:
+                showHint();
+                break;
+            case SDLK_r:
+                playSound(SOUND_EFFECT_BUTTON);
+                restart();
+                break;
+            case SDLK_ESCAPE:
+                playSound(SOUND_EFFECT_BUTTON);
+                saveGame(true); // Lưu game khi quay lại menu
+                currentState = MENU;
+                break;
+        }
         
-        // Render new tiles with pop-up animation
-        for (size_t i = 0; i < newTiles.size(); i++) {
-            int row = newTiles[i].first;
-            int col = newTiles[i].second;
-            int x = boardP1X + col * (tileSize + tileMargin);
-            int y = boardY + row * (tileSize + tileMargin);
+        if (moved) {
+            // Start animation timer
+            resetAnimationTimeline(players[0].animationTimeline);
             
-            // Calculate scale for appear animation - start from 0 and grow with slight bounce
-            float progress = (deltaTime - ANIMATION_DURATION - NEW_TILE_DELAY) / NEW_TILE_ANIMATION_DURATION;
-            progress = std::max(0.0f, std::min(1.0f, progress));
+            // Add a new tile after animation completes
+            addRandomTile();
+            recordHistory(0);
             
-            float scale = 0.0f;
-            if (progress > 0.0f) {
-                if (progress < 0.7f) {
-                    // Grow from 0 to 1.05 (slight overshoot)
-                    scale = progress / 0.7f * 1.05f;
-                } else {
-                    // Settle back from 1.05 to 1.0
-                    scale = 1.05f - ((progress - 0.7f) / 0.3f * 0.05f);
-                }
-                
-                // Center the tile as it grows
-                float centerX = x + tileSize / 2.0f;
-                float centerY = y + tileSize / 2.0f;
-                float scaledX = centerX - (tileSize * scale) / 2.0f;
-                float scaledY = centerY - (tileSize * scale) / 2.0f;
-                
-                // Set tile color
-                Color tileColor;
-                int colorIndex = std::min(static_cast<int>(log2(board[row][col])) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                tileColor = TILE_COLORS[colorIndex];
-                
-                // Draw tile
-                SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                drawRoundedRect(renderer, static_cast<int>(scaledX), static_cast<int>(scaledY), 
-                               static_cast<int>(tileSize * scale), static_cast<int>(tileSize * scale), 
-                               static_cast<int>(6 * scale));
-                
-                // Render tile value
-                std::string valueStr = std::to_string(board[row][col]);
-                SDL_Color textColor = (board[row][col] >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                
-                SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                if (textSurface == nullptr) continue; // Skip if error
-                
-                SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                
-                int textWidth = static_cast<int>(textSurface->w * scale);
-                int textHeight = static_cast<int>(textSurface->h * scale);
-                
-                SDL_Rect textRect = {
-                    static_cast<int>(scaledX + (tileSize * scale - textWidth) / 2),
-                    static_cast<int>(scaledY + (tileSize * scale - textHeight) / 2),
-                    textWidth,
-                    textHeight
-                };
-                
-                SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                SDL_FreeSurface(textSurface);
-                SDL_DestroyTexture(textTexture);
-                
-                cellOccupiedP1[row][col] = true;
-            }
+            // Lưu game sau mỗi lượt di chuyển
+            saveGame();
+            
+            checkWin();
+            checkGameOver();
+            
+            recordMoveApplied();
         }
     }
-    
-    // Render player 1 board without animations or static tiles
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            if (board[i][j] != 0 && !cellOccupiedP1[i][j]) {
-                int x = boardP1X + j * (tileSize + tileMargin);
-                int y = boardY + i * (tileSize + tileMargin);
-                
-                // Set tile color based on value
-                Color tileColor;
-                int colorIndex = std::min(static_cast<int>(log2(board[i][j])) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                tileColor = TILE_COLORS[colorIndex];
-                
-                // Draw tile
-                SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                drawRoundedRect(renderer, x, y, tileSize, tileSize, 6);
-                
-                // Render tile value
-                std::string valueStr = std::to_string(board[i][j]);
-                SDL_Color textColor = (board[i][j] >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                
-                SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                if (textSurface == nullptr) continue; // Skip if error
-                
-                SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                
-                SDL_Rect textRect = {
-                    x + (tileSize - textSurface->w) / 2,
-                    y + (tileSize - textSurface->h) / 2,
-                    textSurface->w,
-                    textSurface->h
-                };
-                
-                SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                SDL_FreeSurface(textSurface);
-                SDL_DestroyTexture(textTexture);
-            }
-        }
+}
+
+void handleMultiplayerInput(SDL_Event& e) {
+    if (e.type == SDL_QUIT) {
+        gameOver = true;
     }
-    
-    // Render animated tiles for player 2
-    if (animating && currentPlayer == PLAYER_TWO) {
-        // First render all non-merged tiles that are moving
-        for (size_t i = 0; i < animationsP2.size(); i++) {
-            TileAnimation& anim = animationsP2[i];
-            
-            if (anim.state == MOVING && !anim.merged) {
-                // Calculate interpolated position with improved easing
-                float progress = std::min(1.0f, anim.progress / ANIMATION_DURATION);
-                float eased = easeInOut(progress);
-                
-                float startX = static_cast<float>(boardP2X + anim.startCol * (tileSize + tileMargin));
-                float startY = static_cast<float>(boardY + anim.startRow * (tileSize + tileMargin));
-                float endX = static_cast<float>(boardP2X + anim.endCol * (tileSize + tileMargin));
-                float endY = static_cast<float>(boardY + anim.endRow * (tileSize + tileMargin));
-                
-                // Để tránh di chuyển chéo, di chuyển theo hai bước: ngang trước, dọc sau
-                float x, y;
-                
-                // Nếu cùng hàng, chỉ di chuyển ngang
-                if (anim.startRow == anim.endRow) {
-                    x = lerp(startX, endX, eased);
-                    y = startY; // Giữ nguyên y
-                }
-                // Nếu cùng cột, chỉ di chuyển dọc
-                else if (anim.startCol == anim.endCol) {
-                    x = startX; // Giữ nguyên x
-                    y = lerp(startY, endY, eased);
-                }
-                // Nếu khác cả hàng và cột (trường hợp hiếm gặp), di chuyển ngang trước, dọc sau
-                else {
-                    if (progress < 0.5f) {
-                        // Di chuyển ngang trước
-                        x = lerp(startX, endX, eased * 2.0f);
-                        y = startY;
-                    } else {
-                        // Di chuyển dọc sau
-                        x = endX;
-                        y = lerp(startY, endY, (eased - 0.5f) * 2.0f);
-                    }
-                }
-                
-                // Set tile color based on value
-                Color tileColor;
-                if (anim.value == 0) {
-                    tileColor = EMPTY_TILE_COLOR;
-                } else {
-                    int colorIndex = std::min(static_cast<int>(log2(anim.value)) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                    tileColor = TILE_COLORS[colorIndex];
-                }
-                
-                // Draw tile
-                SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                drawRoundedRect(renderer, static_cast<int>(x), static_cast<int>(y), tileSize, tileSize, 6);
-                
-                // Render tile value
-                if (anim.value > 0) {
-                    std::string valueStr = std::to_string(anim.value);
-                    SDL_Color textColor = (anim.value >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                    
-                    SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                    if (textSurface == nullptr) continue; // Skip if error
-                    
-                    SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                    
-                    SDL_Rect textRect = {
-                        static_cast<int>(x + (tileSize - textSurface->w) / 2),
-                        static_cast<int>(y + (tileSize - textSurface->h) / 2),
-                        textSurface->w,
-                        textSurface->h
-                    };
-                    
-                    SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                    SDL_FreeSurface(textSurface);
-                    SDL_DestroyTexture(textTexture);
-                }
-                
-                // Mark destination cell as occupied
-                if (progress >= 0.99f) {
-                    cellOccupiedP2[anim.endRow][anim.endCol] = true;
-                }
+    else if (e.type == SDL_MOUSEMOTION) {
+        mouseX = e.motion.x;
+        mouseY = e.motion.y;
+    }
+    else if (e.type == SDL_MOUSEBUTTONDOWN) {
+        if (e.button.button == SDL_BUTTON_LEFT) {
+            mouseX = e.button.x;
+            mouseY = e.button.y;
+
+            // Check if "Back" button was clicked
+            Button backButton;
+            backButton.rect.x = BOARD_MARGIN;
+            backButton.rect.y = BOARD_MARGIN;
+            backButton.rect.w = 100;
+            backButton.rect.h = 40;
+
+            if (isPointInRect(mouseX, mouseY, backButton.rect)) {
+                playSound(SOUND_EFFECT_BUTTON);
+                saveGame(true); // Lưu game khi quay lại menu
+                currentState = MENU;
             }
-        }
-        
-        // Then render merged tiles with separate animations
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                std::pair<int, int> pos = std::make_pair(i, j);
-                if (mergedTilesP2.find(pos) != mergedTilesP2.end()) {
-                    int x = boardP2X + j * (tileSize + tileMargin);
-                    int y = boardY + i * (tileSize + tileMargin);
-                    
-                    // Calculate animation progress
-                    float maxTime = ANIMATION_DURATION + MERGE_ANIMATION_DURATION;
-                    float progress = deltaTime / maxTime;
-                    
-                    // If we're in the merge phase (after movement)
-                    if (progress > ANIMATION_DURATION / maxTime) {
-                        // Calculate merge animation progress
-                        float mergeProgress = (progress - ANIMATION_DURATION / maxTime) / (MERGE_ANIMATION_DURATION / maxTime);
-                        mergeProgress = std::min(1.0f, mergeProgress);
-                        
-                        // Scale animation - more like original 2048
-                        float scale;
-                        if (mergeProgress < 0.5f) {
-                            // Grow phase - faster growth to 1.2x
-                            scale = lerp(1.0f, 1.2f, mergeProgress * 2.0f);
-                        } else {
-                            // Shrink phase - smooth return to normal size
-                            scale = lerp(1.2f, 1.0f, (mergeProgress - 0.5f) * 2.0f);
-                        }
-                        
-                        // Calculate size based on scale
-                        int scaledSize = static_cast<int>(tileSize * scale);
-                        int xOffset = static_cast<int>((tileSize - scaledSize) / 2);
-                        int yOffset = static_cast<int>((tileSize - scaledSize) / 2);
-                        
-                        // Set tile color
-                        Color tileColor;
-                        int colorIndex = std::min(static_cast<int>(log2(boardP2[i][j])) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                        tileColor = TILE_COLORS[colorIndex];
-                        
-                        // Draw tile
-                        SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                        drawRoundedRect(renderer, x + xOffset, y + yOffset, scaledSize, scaledSize, static_cast<int>(6 * scale));
-                        
-                        // Render tile value
-                        std::string valueStr = std::to_string(boardP2[i][j]);
-                        SDL_Color textColor = (boardP2[i][j] >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
-                        
-                        SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                        if (textSurface == nullptr) continue; // Skip if error
-                        
-                        SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
-                        
-                        int textWidth = static_cast<int>(textSurface->w * scale);
-                        int textHeight = static_cast<int>(textSurface->h * scale);
-                        
-                        SDL_Rect textRect = {
-                            static_cast<int>(x + (tileSize - textWidth) / 2),
-                            static_cast<int>(y + (tileSize - textHeight) / 2),
-                            textWidth,
-                            textHeight
-                        };
-                        
-SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                        SDL_FreeSurface(textSurface);
-                        SDL_DestroyTexture(textTexture);
-                        
-                        cellOccupiedP2[i][j] = true;
-                    }
-                }
+
+            // Check if "New Game" button was clicked
+            Button newGameButton;
+            newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
+            newGameButton.rect.y = BOARD_MARGIN;
+            newGameButton.rect.w = 120;
+            newGameButton.rect.h = 40;
+
+            if (isPointInRect(mouseX, mouseY, newGameButton.rect)) {
+                playSound(SOUND_EFFECT_BUTTON);
+                restart();
             }
         }
     }
-    
-    // Render player 2 board without animations
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            if (boardP2[i][j] != 0 && !cellOccupiedP2[i][j]) {
-                int x = boardP2X + j * (tileSize + tileMargin);
-                int y = boardY + i * (tileSize + tileMargin);
-                
-                // Set tile color based on value
-                Color tileColor;
-                int colorIndex = std::min(static_cast<int>(log2(boardP2[i][j])) - 1, static_cast<int>(TILE_COLORS.size()) - 1);
-                tileColor = TILE_COLORS[colorIndex];
-                
-                // Draw tile
-                SDL_SetRenderDrawColor(renderer, tileColor.r, tileColor.g, tileColor.b, 255);
-                drawRoundedRect(renderer, x, y, tileSize, tileSize, 6);
-                
-                // Render tile value
-                std::string valueStr = std::to_string(boardP2[i][j]);
-                SDL_Color textColor = (boardP2[i][j] >= 8) ? toSDLColor(LIGHT_TEXT) : toSDLColor(TEXT_COLOR);
+    else if (e.type == SDL_KEYDOWN && isKeyBlockedByAnimation(e.key.keysym.sym)) {
+        // Play it once the current animation has been snapped to its end
+        queueKey(e);
+    }
+    else if (e.type == SDL_KEYDOWN) {
+        SDL_Keycode key = e.key.keysym.sym;
+        int player = getKeyPlayer(key);
+        
+        if (player >= 0) {
+            // Each player's keys move their own board (see PLAYER_CONTROLS)
+            const PlayerControls& controls = PLAYER_CONTROLS[player];
+            int direction = getMoveDirection(key);
+            bool moved = false;
+            currentPlayer = player;
+            
+            if (direction >= 0) {
+                moved = applyMove(direction);
+            } else if (key == controls.undo) {
+                stepHistory(player, -1);
+            } else if (key == controls.redo) {
+                stepHistory(player, 1);
+            }
+            
+            if (moved) {
+                // Start animation timer
+                resetAnimationTimeline(players[player].animationTimeline);
                 
-                SDL_Surface* textSurface = TTF_RenderText_Blended(menuFont, valueStr.c_str(), textColor);
-                if (textSurface == nullptr) continue; // Skip if error
+                int spawnCell = addRandomTile();
+                recordHistory(player);
                 
-                SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, textSurface);
+                // The opponent replays the move and places the same tile (client-side
+                // prediction: the local board never waits for the network)
+                if (network.enabled) {
+                    sendMove(direction, spawnCell);
+                }
                 
-                SDL_Rect textRect = {
-                    x + (tileSize - textSurface->w) / 2,
-                    y + (tileSize - textSurface->h) / 2,
-                    textSurface->w,
-                    textSurface->h
-                };
+                saveGame();
+                checkWin();
+                checkGameOver();
                 
-                SDL_RenderCopy(renderer, textTexture, NULL, &textRect);
-                SDL_FreeSurface(textSurface);
-                SDL_DestroyTexture(textTexture);
+                recordMoveApplied();
             }
+        } else if (key == SDLK_r) {
+            playSound(SOUND_EFFECT_BUTTON);
+            restart();
+        } else if (key == SDLK_ESCAPE) {
+            playSound(SOUND_EFFECT_BUTTON);
+            saveGame(true); // Lưu game khi quay lại menu
+            currentState = MENU;
         }
     }
+}
 
-    // Player 1 header with score - moved below the board
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    SDL_Rect p1Header = {boardP1X, boardY + boardHeight + 15, boardWidth, 40};
-    drawRoundedRect(renderer, p1Header.x, p1Header.y, p1Header.w, p1Header.h, 5);
+// Handle input based on current state
+void handleEvent(SDL_Event& e) {
+    if (e.type == SDL_KEYDOWN) {
+        beginInputLatency(e);
+    }
     
-    // Player 1 label
-    SDL_Surface* p1LabelSurface = TTF_RenderText_Blended(menuFont, "Player 1 (WASD)", textColor);
-    if (p1LabelSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    switch (currentState) {
+        case MENU:
+            handleMenuInput(e);
+            break;
+        case PLAYING:
+            handleGameInput(e);
+            break;
+        case MULTIPLAYER:
+            handleMultiplayerInput(e);
+            break;
+        case HOW_TO_PLAY:
+            handleHowToPlayInput(e);
+            break;
+        case GAME_OVER:
+            handleGameOverInput(e);
+            break;
+        case MULTIPLAYER_GAME_OVER:
+            handleMultiplayerGameOverInput(e);
+            break;
     }
     
-    SDL_Texture* p1LabelTexture = SDL_CreateTextureFromSurface(renderer, p1LabelSurface);
-    SDL_Rect p1LabelRect = {
-        p1Header.x + 10,
-        p1Header.y + (p1Header.h - p1LabelSurface->h) / 2,
-        p1LabelSurface->w,
-        p1LabelSurface->h
-    };
-    SDL_RenderCopy(renderer, p1LabelTexture, NULL, &p1LabelRect);
-    SDL_FreeSurface(p1LabelSurface);
-    SDL_DestroyTexture(p1LabelTexture);
-    
-    // Player 1 score
-    std::string p1ScoreStr = "Score: " + std::to_string(score);
-    SDL_Surface* p1ScoreSurface = TTF_RenderText_Blended(menuFont, p1ScoreStr.c_str(), textColor);
-    if (p1ScoreSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    // Keys that did not move a board are not measured
+    trackedInput.active = false;
+}
+
+// Present the frame, with the profiler overlay drawn on top when it is enabled
+void presentFrame() {
+    if (profilerEnabled) {
+        renderProfilerOverlay();
     }
     
-    SDL_Texture* p1ScoreTexture = SDL_CreateTextureFromSurface(renderer, p1ScoreSurface);
-    SDL_Rect p1ScoreRect = {
-        p1Header.x + p1Header.w - p1ScoreSurface->w - 10,
-        p1Header.y + (p1Header.h - p1ScoreSurface->h) / 2,
-        p1ScoreSurface->w,
-        p1ScoreSurface->h
-    };
-    SDL_RenderCopy(renderer, p1ScoreTexture, NULL, &p1ScoreRect);
-    SDL_FreeSurface(p1ScoreSurface);
-    SDL_DestroyTexture(p1ScoreTexture);
+    ScopedPhaseTimer presentTimer(PHASE_PRESENT);
+    Uint64 frameDrawnCounter = SDL_GetPerformanceCounter();
+    SDL_RenderPresent(renderer);
     
-    // Player 2 header with score - moved below the board
-    SDL_SetRenderDrawColor(renderer, BOARD_COLOR.r, BOARD_COLOR.g, BOARD_COLOR.b, 255);
-    SDL_Rect p2Header = {boardP2X, boardY + boardHeight + 15, boardWidth, 40};
-    drawRoundedRect(renderer, p2Header.x, p2Header.y, p2Header.w, p2Header.h, 5);
+    if (startupProfile.firstFrameMs == 0.0) {
+        startupProfile.firstFrameMs = getCounterMs(startupCounter, SDL_GetPerformanceCounter());
+    }
     
-    // Player 2 label
-    SDL_Surface* p2LabelSurface = TTF_RenderText_Blended(menuFont, "Player 2 (Arrows)", textColor);
-    if (p2LabelSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    // Moves shown for the first time in this frame become latency samples
+    Uint64 frameMoveSequence = snapshots.readBuffer().moveSequence;
+    if (frameMoveSequence != presentedMoveSequence) {
+        finishInputLatency(frameMoveSequence, frameDrawnCounter, SDL_GetPerformanceCounter());
+        presentedMoveSequence = frameMoveSequence;
+    }
+}
+
+// Start measuring a key press (headless runs replay synthetic events without timestamps)
+void beginInputLatency(const SDL_Event& e) {
+    if (headless) return;
+    
+    trackedInput.active = true;
+    trackedInput.eventTicks = e.common.timestamp;
+    trackedInput.dispatchTicks = SDL_GetTicks();
+    trackedInput.dispatchCounter = SDL_GetPerformanceCounter();
+    trackedInput.animationStartCounter = 0;
+    trackedInput.saveTicksAtDispatch = saveCounterTicks;
+}
+
+// The key moved a board: wait for the first frame that shows it
+void recordMoveApplied() {
+    moveSequence++;
+    if (!trackedInput.active) return;
+    
+    trackedInput.moveSequence = moveSequence;
+    trackedInput.appliedCounter = SDL_GetPerformanceCounter();
+    trackedInput.saveTicks = saveCounterTicks - trackedInput.saveTicksAtDispatch;
+    if (trackedInput.animationStartCounter == 0) {
+        trackedInput.animationStartCounter = trackedInput.appliedCounter;
+    }
+    {
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        inputsAwaitingFrame.push_back(trackedInput);
+    }
+    trackedInput.active = false;
+}
+
+// A frame showing the snapshot with frameMoveSequence was presented: every move it contains
+// becomes a latency sample
+void finishInputLatency(Uint64 frameMoveSequence, Uint64 frameDrawnCounter, Uint64 presentedCounter) {
+    double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+    
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    size_t shown = 0;
+    for (; shown < inputsAwaitingFrame.size() && inputsAwaitingFrame[shown].moveSequence <= frameMoveSequence; shown++) {
+        const InputLatency& input = inputsAwaitingFrame[shown];
+        LatencySample sample;
+        sample.eventMs = static_cast<float>(input.dispatchTicks - input.eventTicks);
+        sample.saveMs = static_cast<float>(input.saveTicks * msPerTick);
+        sample.moveMs = static_cast<float>((input.animationStartCounter - input.dispatchCounter) * msPerTick);
+        sample.frameMs = static_cast<float>((frameDrawnCounter - input.appliedCounter) * msPerTick);
+        sample.presentMs = static_cast<float>((presentedCounter - frameDrawnCounter) * msPerTick);
+        sample.totalMs = sample.eventMs + static_cast<float>((presentedCounter - input.dispatchCounter) * msPerTick);
+        latencySamples.push_back(sample);
+    }
+    inputsAwaitingFrame.erase(inputsAwaitingFrame.begin(), inputsAwaitingFrame.begin() + shown);
+    
+    // Opponent moves: socket to screen on this side, plus half the round trip for the way here
+    size_t remoteShown = 0;
+    for (; remoteShown < remoteMovesAwaitingFrame.size() && remoteMovesAwaitingFrame[remoteShown].moveSequence <= frameMoveSequence; remoteShown++) {
+        const RemoteMove& move = remoteMovesAwaitingFrame[remoteShown];
+        float latencyMs = static_cast<float>((presentedCounter - move.receivedCounter) * msPerTick) + move.rttMs / 2.0f;
+        remoteMoveLatencyMs = (remoteMoveLatencyMs == 0.0f) ? latencyMs : lerp(remoteMoveLatencyMs, latencyMs, 0.2f);
+    }
+    remoteMovesAwaitingFrame.erase(remoteMovesAwaitingFrame.begin(), remoteMovesAwaitingFrame.begin() + remoteShown);
+}
+
+// Print the latency distribution of this session and append it to LATENCY_LOG_PATH
+void reportInputLatency() {
+    if (latencySamples.empty()) return;
+    
+    const char* stageNames[6] = {"event", "move", "save", "frame", "present", "total"};
+    std::vector<float> stages[6];
+    for (size_t i = 0; i < latencySamples.size(); i++) {
+        const LatencySample& sample = latencySamples[i];
+        stages[0].push_back(sample.eventMs);
+        stages[1].push_back(sample.moveMs);
+        stages[2].push_back(sample.saveMs);
+        stages[3].push_back(sample.frameMs);
+        stages[4].push_back(sample.presentMs);
+        stages[5].push_back(sample.totalMs);
     }
     
-    SDL_Texture* p2LabelTexture = SDL_CreateTextureFromSurface(renderer, p2LabelSurface);
-    SDL_Rect p2LabelRect = {
-        p2Header.x + 10,
-        p2Header.y + (p2Header.h - p2LabelSurface->h) / 2,
-        p2LabelSurface->w,
-        p2LabelSurface->h
-    };
-    SDL_RenderCopy(renderer, p2LabelTexture, NULL, &p2LabelRect);
-    SDL_FreeSurface(p2LabelSurface);
-    SDL_DestroyTexture(p2LabelTexture);
-    
-    // Player 2 score
-    std::string p2ScoreStr = "Score: " + std::to_string(scoreP2);
-    SDL_Surface* p2ScoreSurface = TTF_RenderText_Blended(menuFont, p2ScoreStr.c_str(), textColor);
-    if (p2ScoreSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    std::ostringstream report;
+    report << "Input latency (ms, p50/p99/max) over " << latencySamples.size() << " moves:";
+    for (int stage = 0; stage < 6; stage++) {
+        char line[96];
+        snprintf(line, sizeof(line), " %s %.2f/%.2f/%.2f", stageNames[stage],
+                 getPercentile(stages[stage], 50), getPercentile(stages[stage], 99), getPercentile(stages[stage], 100));
+        report << line;
     }
     
-    SDL_Texture* p2ScoreTexture = SDL_CreateTextureFromSurface(renderer, p2ScoreSurface);
-    SDL_Rect p2ScoreRect = {
-        p2Header.x + p2Header.w - p2ScoreSurface->w - 10,
-        p2Header.y + (p2Header.h - p2ScoreSurface->h) / 2,
-        p2ScoreSurface->w,
-        p2ScoreSurface->h
-    };
-    SDL_RenderCopy(renderer, p2ScoreTexture, NULL, &p2ScoreRect);
-    SDL_FreeSurface(p2ScoreSurface);
-    SDL_DestroyTexture(p2ScoreTexture);
+    std::cout << report.str() << std::endl;
     
-    // Update screen
-    SDL_RenderPresent(renderer);
+    std::ofstream logFile(LATENCY_LOG_PATH, std::ios::app);
+    if (logFile.is_open()) {
+        char dateText[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(dateText, sizeof(dateText), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+        logFile << dateText << " " << report.str() << "\n";
+    }
 }
 
-void renderGameOver() {
-    // Create semi-transparent overlay
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
-    SDL_Rect overlay = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
-    SDL_RenderFillRect(renderer, &overlay);
+// Store the finished frame in the profiler history and start counting the next one
+void recordFrameStats(double frameMs) {
+    frameTimeHistory[frameTimeNext] = static_cast<float>(frameMs);
+    frameTimeNext = (frameTimeNext + 1) % PROFILER_HISTORY_SIZE;
+    frameTimeCount = std::min(frameTimeCount + 1, PROFILER_HISTORY_SIZE);
     
-    // Render message
-    std::string message = won ? "You Win!" : "Game Over!";
-    SDL_Color whiteColor;
-    whiteColor.r = 255;
-    whiteColor.g = 255;
-    whiteColor.b = 255;
-    whiteColor.a = 255;
+    lastFrameStats = currentFrameStats;
+}
+
+// Draw the profiler panel: frame time histogram, p50/p99/max, per-phase split and
+// renderer work counters of the previous frame. Times are shown in microseconds.
+void renderProfilerOverlay() {
+    const int panelWidth = 380;
+    const int panelHeight = 200;
+    const int histogramHeight = 60;
+    const int barWidth = 2;
+    SDL_Rect panel = {BOARD_MARGIN, SCREEN_HEIGHT - panelHeight - BOARD_MARGIN, panelWidth, panelHeight};
+    
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 180);
+    renderFillRect(renderer, &panel);
+    
+    // Frame time histogram, newest frame on the right, 2 px per ms
+    int histogramX = panel.x + 10;
+    int histogramBottom = panel.y + 10 + histogramHeight;
+    int bars = std::min(frameTimeCount, (panelWidth - 20) / barWidth);
+    for (int b = 0; b < bars; b++) {
+        int index = (frameTimeNext - bars + b + PROFILER_HISTORY_SIZE) % PROFILER_HISTORY_SIZE;
+        float ms = frameTimeHistory[index];
+        int barHeight = std::max(1, std::min(histogramHeight, static_cast<int>(ms * 2.0f)));
+        
+        if (ms > FRAME_BUDGET_MS) {
+            SDL_SetRenderDrawColor(renderer, 230, 80, 60, 255);
+        } else {
+            SDL_SetRenderDrawColor(renderer, 110, 200, 90, 255);
+        }
+        SDL_Rect bar = {histogramX + b * barWidth, histogramBottom - barHeight, barWidth, barHeight};
+        renderFillRect(renderer, &bar);
+    }
     
-    SDL_Surface* messageSurface = TTF_RenderText_Blended(largeFont, message.c_str(), whiteColor);
-    if (messageSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    // Frame budget line
+    SDL_SetRenderDrawColor(renderer, 240, 200, 60, 255);
+    SDL_Rect budgetLine = {histogramX, histogramBottom - static_cast<int>(FRAME_BUDGET_MS * 2.0f), panelWidth - 20, 1};
+    renderFillRect(renderer, &budgetLine);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+    
+    if (profilerFont == nullptr || frameTimeCount == 0) return;
+    
+    // Percentiles over the frames in the history
+    std::vector<float> sortedTimes(frameTimeHistory, frameTimeHistory + frameTimeCount);
+    std::sort(sortedTimes.begin(), sortedTimes.end());
+    int p50 = static_cast<int>(sortedTimes[(frameTimeCount - 1) * 50 / 100] * 1000.0f);
+    int p99 = static_cast<int>(sortedTimes[(frameTimeCount - 1) * 99 / 100] * 1000.0f);
+    int maxTime = static_cast<int>(sortedTimes.back() * 1000.0f);
+    
+    SDL_Color white = {255, 255, 255, 255};
+    const int lineHeight = 18;
+    int leftX = panel.x + 10;
+    int rightX = panel.x + 200;
+    int textY = histogramBottom + 10;
+    
+    renderPrefixedNumber(profilerFont, "frame p50 (us): ", p50, leftX, textY, white);
+    renderPrefixedNumber(profilerFont, "frame p99 (us): ", p99, leftX, textY + lineHeight, white);
+    renderPrefixedNumber(profilerFont, "frame max (us): ", maxTime, leftX, textY + lineHeight * 2, white);
+    renderPrefixedNumber(profilerFont, "draw calls: ", lastFrameStats.drawCalls, leftX, textY + lineHeight * 3, white);
+    renderPrefixedNumber(profilerFont, "textures created: ", lastFrameStats.textureCreations, leftX, textY + lineHeight * 4, white);
+    renderPrefixedNumber(profilerFont, "TTF renders: ", lastFrameStats.ttfRenders, leftX, textY + lineHeight * 5, white);
+    
+    const char* phaseNames[PHASE_COUNT] = {
+        "events (us): ", "snapshot (us): ", "board texture (us): ", "render (us): ", "present (us): "
+    };
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        int phaseUs = std::max(0, static_cast<int>(lastFrameStats.phaseMs[phase] * 1000.0));
+        renderPrefixedNumber(profilerFont, phaseNames[phase], phaseUs, rightX, textY + lineHeight * phase, white);
+    }
+}
+
+void render() {
+    const GameSnapshot& view = snapshots.readBuffer();
+    switch (view.currentState) {
+        case MENU:
+            renderMenu();
+            break;
+        case PLAYING:
+            renderGameBoard();
+            break;
+        case MULTIPLAYER:
+            renderMultiplayerGameBoard();
+            break;
+        case HOW_TO_PLAY:
+            renderHowToPlay();
+            break;
+        case GAME_OVER:
+            renderGameOver();
+            break;
+        case MULTIPLAYER_GAME_OVER:
+            renderMultiplayerGameOver();
+            break;
+    }
+}
+
+// Render one headless frame: advance animations by the fixed step, draw and hash the surface.
+// Headless runs stay on one thread so that frames are reproducible.
+// The frame time is measured from frameStart so that input handling is included.
+void renderHeadlessFrame(HeadlessRun& headlessRun, Uint64 frameStart) {
+    if (isAnimating()) {
+        updateAnimations();
     }
+    flushSounds();
+    publishSnapshot();
+    snapshots.update();
+    render();
     
-    SDL_Texture* messageTexture = SDL_CreateTextureFromSurface(renderer, messageSurface);
-    
-    SDL_Rect messageRect = {
-        (SCREEN_WIDTH - messageSurface->w) / 2,
-        200,
-        messageSurface->w,
-        messageSurface->h
-    };
-    
-    SDL_RenderCopy(renderer, messageTexture, NULL, &messageRect);
-    SDL_FreeSurface(messageSurface);
-    SDL_DestroyTexture(messageTexture);
+    headlessRun.frameMs.push_back(static_cast<float>((SDL_GetPerformanceCounter() - frameStart) * 1000.0 / SDL_GetPerformanceFrequency()));
+    headlessRun.drawCalls.push_back(currentFrameStats.drawCalls);
+    currentFrameStats = FrameStats();
     
-    // Render final score
-    std::string scoreStr = "Score: " + std::to_string(score);
-    SDL_Surface* scoreSurface = TTF_RenderText_Blended(titleFont, scoreStr.c_str(), whiteColor);
-    if (scoreSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    if (headlessRun.hashFrames) {
+        headlessRun.frameHashes.push_back(hashSurfacePixels(headlessSurface));
     }
-    
-    SDL_Texture* scoreTexture = SDL_CreateTextureFromSurface(renderer, scoreSurface);
-    
-    SDL_Rect scoreRect = {
-        (SCREEN_WIDTH - scoreSurface->w) / 2,
-        280,
-        scoreSurface->w,
-        scoreSurface->h
-    };
-    
-    SDL_RenderCopy(renderer, scoreTexture, NULL, &scoreRect);
-    SDL_FreeSurface(scoreSurface);
-    SDL_DestroyTexture(scoreTexture);
-    
-    // Render buttons
-    for (size_t i = 0; i < gameOverButtons.size(); i++) {
-        renderButton(gameOverButtons[i], menuFont);
+}
+
+void renderHeadlessFrame(HeadlessRun& headlessRun) {
+    currentFrameStats = FrameStats();
+    renderHeadlessFrame(headlessRun, SDL_GetPerformanceCounter());
+}
+
+// Feed one input event through the normal handlers, then render until its animation settles
+void playHeadlessInput(SDL_Event& e, HeadlessRun& headlessRun) {
+    currentFrameStats = FrameStats();
+    Uint64 frameStart = SDL_GetPerformanceCounter();
+    handleEvent(e);
+    processQueuedKeys();
+    renderHeadlessFrame(headlessRun, frameStart);
+    
+    for (int i = 0; isAnimating() && i < HEADLESS_MAX_ANIMATION_FRAMES; i++) {
+        renderHeadlessFrame(headlessRun);
     }
-    
-    // Update screen
-    SDL_RenderPresent(renderer);
 }
 
-void renderMultiplayerGameOver() {
-    // Create semi-transparent overlay
-    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
-    SDL_Rect overlay = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
-    SDL_RenderFillRect(renderer, &overlay);
-    
-    // Determine winner
-    std::string message;
-    if (won) {
-        message = "Player 1 Wins!";
-    } else if (wonP2) {
-        message = "Player 2 Wins!";
-    } else if (score > scoreP2) {
-        message = "Player 1 Wins!";
-    } else if (scoreP2 > score) {
-        message = "Player 2 Wins!";
-    } else {
-        message = "It's a Tie!";
+// Print frame time percentiles, frames over budget and draw calls of a headless run
+void printFrameReport(const char* name, const HeadlessRun& headlessRun) {
+    if (headlessRun.frameMs.empty()) return;
+    
+    std::vector<float> sortedTimes = headlessRun.frameMs;
+    std::sort(sortedTimes.begin(), sortedTimes.end());
+    size_t count = sortedTimes.size();
+    
+    int overBudget = 0;
+    double totalMs = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        if (sortedTimes[i] > FRAME_BUDGET_MS) overBudget++;
+        totalMs += sortedTimes[i];
     }
     
-    SDL_Color whiteColor;
-    whiteColor.r = 255;
-    whiteColor.g = 255;
-    whiteColor.b = 255;
-    whiteColor.a = 255;
-    
-    SDL_Surface* messageSurface = TTF_RenderText_Blended(largeFont, message.c_str(), whiteColor);
-    if (messageSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    long totalDrawCalls = 0;
+    int maxDrawCalls = 0;
+    for (size_t i = 0; i < headlessRun.drawCalls.size(); i++) {
+        totalDrawCalls += headlessRun.drawCalls[i];
+        maxDrawCalls = std::max(maxDrawCalls, headlessRun.drawCalls[i]);
     }
     
-    SDL_Texture* messageTexture = SDL_CreateTextureFromSurface(renderer, messageSurface);
-    
-    SDL_Rect messageRect = {
-        (SCREEN_WIDTH - messageSurface->w) / 2,
-        180,
-        messageSurface->w,
-        messageSurface->h
-    };
-    
-    SDL_RenderCopy(renderer, messageTexture, NULL, &messageRect);
-    SDL_FreeSurface(messageSurface);
-    SDL_DestroyTexture(messageTexture);
-    
-    // Render player 1 score
-    std::string p1ScoreStr = "Player 1 Score: " + std::to_string(score);
-    SDL_Surface* p1ScoreSurface = TTF_RenderText_Blended(titleFont, p1ScoreStr.c_str(), whiteColor);
-    if (p1ScoreSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    std::cout << name << ": " << count << " frames"
+              << ", mean " << static_cast<int>(totalMs * 1000.0 / count) << " us"
+              << ", p50 " << static_cast<int>(sortedTimes[(count - 1) * 50 / 100] * 1000.0f) << " us"
+              << ", p99 " << static_cast<int>(sortedTimes[(count - 1) * 99 / 100] * 1000.0f) << " us"
+              << ", max " << static_cast<int>(sortedTimes.back() * 1000.0f) << " us"
+              << ", over budget " << overBudget
+              << ", draw calls/frame " << totalDrawCalls / static_cast<long>(count) << " (max " << maxDrawCalls << ")"
+              << std::endl;
+}
+
+// Replay an input script without a display and hash every frame.
+// Script tokens (whitespace separated, '#' starts a comment):
+//   single / multi          start a new single player / multiplayer game
+//   players N               player count of the following multi games (default 2)
+//   left right up down      arrow keys (player 2 in multiplayer)
+//   w a s d                 WASD keys (player 1 in multiplayer)
+//   i j k l                 IJKL keys (player 3 in multiplayer)
+//   r / escape              restart / back to menu
+//   click X Y               left mouse click at X, Y
+//   frames N                render N frames without input
+// After each key the frames of its animation are rendered until it settles.
+// Hashes are written one per line to hashesPath; with goldenPath they are compared
+// against a previous run and any difference makes the run fail.
+int runHeadlessRender(const std::string& script, const std::string& hashesPath, const std::string& goldenPath, unsigned int seed) {
+    rng.seed(seed);
+    
+    HeadlessRun headlessRun;
+    headlessRun.hashFrames = true;
+    std::vector<Uint64>& frameHashes = headlessRun.frameHashes;
+    
+    std::istringstream tokens(script);
+    std::string token;
+    while (tokens >> token) {
+        if (token[0] == '#') {
+            std::string comment;
+            std::getline(tokens, comment);
+            continue;
+        }
+        
+        if (token == "players") {
+            int count = DEFAULT_PLAYER_COUNT;
+            tokens >> count;
+            setSelectedPlayerCount(count);
+            continue;
+        }
+        
+        if (token == "single" || token == "multi") {
+            currentState = (token == "multi") ? MULTIPLAYER : PLAYING;
+            playerCount = selectedPlayerCount;
+            restart();
+            renderHeadlessFrame(headlessRun);
+            continue;
+        }
+        
+        if (token == "frames") {
+            int count = 0;
+            tokens >> count;
+            for (int i = 0; i < count; i++) {
+                renderHeadlessFrame(headlessRun);
+            }
+            continue;
+        }
+        
+        SDL_Event e = {};
+        if (token == "click") {
+            e.type = SDL_MOUSEBUTTONDOWN;
+            e.button.button = SDL_BUTTON_LEFT;
+            tokens >> e.button.x >> e.button.y;
+        } else {
+            SDL_Keycode key = SDLK_UNKNOWN;
+            if (token == "left") key = SDLK_LEFT;
+            else if (token == "right") key = SDLK_RIGHT;
+            else if (token == "up") key = SDLK_UP;
+            else if (token == "down") key = SDLK_DOWN;
+            else if (token == "w") key = SDLK_w;
+            else if (token == "a") key = SDLK_a;
+            else if (token == "s") key = SDLK_s;
+            else if (token == "d") key = SDLK_d;
+            else if (token == "i") key = SDLK_i;
+            else if (token == "j") key = SDLK_j;
+            else if (token == "k") key = SDLK_k;
+            else if (token == "l") key = SDLK_l;
+            else if (token == "r") key = SDLK_r;
+            else if (token == "escape") key = SDLK_ESCAPE;
+            
+            if (key == SDLK_UNKNOWN) {
+                std::cerr << "Unknown headless script token: " << token << std::endl;
+                return 2;
+            }
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = key;
+        }
+        
+        playHeadlessInput(e, headlessRun);
     }
     
-    SDL_Texture* p1ScoreTexture = SDL_CreateTextureFromSurface(renderer, p1ScoreSurface);
-    
-    SDL_Rect p1ScoreRect = {
-        (SCREEN_WIDTH - p1ScoreSurface->w) / 2,
-        260,
-        p1ScoreSurface->w,
-        p1ScoreSurface->h
-    };
-    
-    SDL_RenderCopy(renderer, p1ScoreTexture, NULL, &p1ScoreRect);
-    SDL_FreeSurface(p1ScoreSurface);
-    SDL_DestroyTexture(p1ScoreTexture);
-    
-    // Render player 2 score
-    std::string p2ScoreStr = "Player 2 Score: " + std::to_string(scoreP2);
-    SDL_Surface* p2ScoreSurface = TTF_RenderText_Blended(titleFont, p2ScoreStr.c_str(), whiteColor);
-    if (p2ScoreSurface == nullptr) {
-        // Handle error
-        SDL_RenderPresent(renderer);
-        return;
+    // Combined hash of the whole run, handy for a quick comparison
+    Uint64 runHash = 14695981039346656037ULL;
+    for (size_t i = 0; i < frameHashes.size(); i++) {
+        runHash = (runHash ^ frameHashes[i]) * 1099511628211ULL;
     }
     
-    SDL_Texture* p2ScoreTexture = SDL_CreateTextureFromSurface(renderer, p2ScoreSurface);
-    
-    SDL_Rect p2ScoreRect = {
-        (SCREEN_WIDTH - p2ScoreSurface->w) / 2,
-        320,
-        p2ScoreSurface->w,
-        p2ScoreSurface->h
-    };
-    
-    SDL_RenderCopy(renderer, p2ScoreTexture, NULL, &p2ScoreRect);
-    SDL_FreeSurface(p2ScoreSurface);
-    SDL_DestroyTexture(p2ScoreTexture);
+    char hashText[17];
+    snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(runHash));
+    printFrameReport("Headless render", headlessRun);
+    std::cout << "Run hash " << hashText << std::endl;
     
-    // Render buttons
-    for (size_t i = 0; i < multiplayerGameOverButtons.size(); i++) {
-        renderButton(multiplayerGameOverButtons[i], menuFont);
+    if (!hashesPath.empty()) {
+        std::ofstream hashesFile(hashesPath);
+        if (!hashesFile.is_open()) {
+            std::cerr << "Could not write frame hashes to " << hashesPath << std::endl;
+            return 2;
+        }
+        for (size_t i = 0; i < frameHashes.size(); i++) {
+            snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(frameHashes[i]));
+            hashesFile << hashText << "\n";
+        }
     }
     
-    // Update screen
-    SDL_RenderPresent(renderer);
-}
-
-void updateButtonHoverStates() {
-    // Update menu buttons
-    if (currentState == MENU) {
-        for (size_t i = 0; i < menuButtons.size(); i++) {
-            menuButtons[i].isHovered = isPointInRect(mouseX, mouseY, menuButtons[i].rect);
+    if (!goldenPath.empty()) {
+        std::ifstream goldenFile(goldenPath);
+        if (!goldenFile.is_open()) {
+            std::cerr << "Could not read golden frame hashes from " << goldenPath << std::endl;
+            return 2;
         }
-    }
-    // Update how to play buttons
-    else if (currentState == HOW_TO_PLAY) {
-        for (size_t i = 0; i < howToPlayButtons.size(); i++) {
-            howToPlayButtons[i].isHovered = isPointInRect(mouseX, mouseY, howToPlayButtons[i].rect);
+        
+        std::vector<std::string> golden;
+        std::string line;
+        while (std::getline(goldenFile, line)) {
+            if (!line.empty()) golden.push_back(line);
         }
-    }
-    // Update game over buttons
-    else if (currentState == GAME_OVER) {
-        for (size_t i = 0; i < gameOverButtons.size(); i++) {
-            gameOverButtons[i].isHovered = isPointInRect(mouseX, mouseY, gameOverButtons[i].rect);
+        
+        size_t mismatches = 0;
+        for (size_t i = 0; i < frameHashes.size(); i++) {
+            snprintf(hashText, sizeof(hashText), "%016llx", static_cast<unsigned long long>(frameHashes[i]));
+            if (i >= golden.size() || golden[i] != hashText) {
+                if (mismatches == 0) {
+                    std::cerr << "First differing frame: " << i << std::endl;
+                }
+                mismatches++;
+            }
         }
-    }
-    // Update multiplayer game over buttons
-    else if (currentState == MULTIPLAYER_GAME_OVER) {
-        for (size_t i = 0; i < multiplayerGameOverButtons.size(); i++) {
-            multiplayerGameOverButtons[i].isHovered = isPointInRect(mouseX, mouseY, multiplayerGameOverButtons[i].rect);
+        if (golden.size() != frameHashes.size()) {
+            std::cerr << "Frame count differs: " << frameHashes.size() << " rendered, " 
+                      << golden.size() << " in " << goldenPath << std::endl;
+            return 1;
+        }
+        if (mismatches > 0) {
+            std::cerr << mismatches << " frames differ from " << goldenPath << std::endl;
+            return 1;
         }
+        std::cout << "All frames match " << goldenPath << std::endl;
     }
+    
+    return 0;
 }
 
-void restart() {
-    // Reset boards
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            board[i][j] = 0;
-            boardP2[i][j] = 0;
+// Render benchmark: replay a long seeded game on the single player and the multiplayer
+// screen through handleEvent -> updateAnimations -> render at a fixed animation step and
+// report frame times, frames over the 60 FPS budget, draw calls and peak RSS.
+// Finished games are restarted so every move produces an animation.
+int runRenderBenchmark(int moves, unsigned int seed) {
+    const SDL_Keycode singleKeys[4] = {SDLK_LEFT, SDLK_UP, SDLK_RIGHT, SDLK_DOWN};
+    
+    // Every player's moves, interleaved by direction
+    std::vector<SDL_Keycode> multiplayerKeys;
+    for (int direction = 0; direction < 4; direction++) {
+        for (int p = 0; p < selectedPlayerCount; p++) {
+            const PlayerControls& controls = PLAYER_CONTROLS[p];
+            const SDL_Keycode moves[4] = {controls.left, controls.up, controls.right, controls.down};
+            multiplayerKeys.push_back(moves[direction]);
         }
     }
     
-    // Reset game state
-    score = 0;
-    scoreP2 = 0;
-    gameOver = false;
-    gameOverP2 = false;
-    won = false;
-    wonP2 = false;
-    currentPlayer = PLAYER_ONE;
-    
-    // Clear animations
-    animations.clear();
-    animationsP2.clear();
-    mergedTiles.clear();
-    mergedTilesP2.clear();
-    newTiles.clear();
-    newTilesP2.clear();
-    animating = false;
-    
-    // Mark the board texture as needing update
-    boardTextureNeedsUpdate = true;
-    
-    // Add initial tiles to both boards in multiplayer mode
-    if (currentState == MULTIPLAYER || currentState == MULTIPLAYER_GAME_OVER) {
-        // Thêm trực tiếp vào bảng thay vì qua animation cho player 1
-        std::vector<std::pair<int, int>> emptyP1Cells;
-        
-        // Tìm tất cả các ô trống cho player 1
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                emptyP1Cells.push_back(std::make_pair(i, j));
-            }
-        }
-        
-        // Chọn 2 ô ngẫu nhiên cho player 1
-        std::shuffle(emptyP1Cells.begin(), emptyP1Cells.end(), rng);
+    for (int mode = 0; mode < 2; mode++) {
+        bool multiplayer = (mode == 1);
+        rng.seed(seed);
         
-        // Thêm ô đầu tiên cho player 1 (90% là 2, 10% là 4)
-        std::uniform_int_distribution<int> valueDist(0, 9);
-        int row1 = emptyP1Cells[0].first;
-        int col1 = emptyP1Cells[0].second;
-        board[row1][col1] = (valueDist(rng) < 9) ? 2 : 4;
+        // Separate generator for the moves so tile spawns do not change the move sequence
+        std::mt19937 moveRng(seed);
+        std::uniform_int_distribution<int> keyDist(0, multiplayer ? static_cast<int>(multiplayerKeys.size()) - 1 : 3);
         
-        // Thêm ô thứ hai cho player 1 (90% là 2, 10% là 4)
-        int row2 = emptyP1Cells[1].first;
-        int col2 = emptyP1Cells[1].second;
-        board[row2][col2] = (valueDist(rng) < 9) ? 2 : 4;
+        HeadlessRun headlessRun;
+        headlessRun.hashFrames = false;
         
-        // Thêm trực tiếp vào bảng thay vì qua animation cho player 2
-        std::vector<std::pair<int, int>> emptyP2Cells;
+        currentState = multiplayer ? MULTIPLAYER : PLAYING;
+        playerCount = selectedPlayerCount;
+        restart();
         
-        // Tìm tất cả các ô trống cho player 2
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                emptyP2Cells.push_back(std::make_pair(i, j));
+        for (int move = 0; move < moves; move++) {
+            if (currentState == GAME_OVER || currentState == MULTIPLAYER_GAME_OVER) {
+                currentState = multiplayer ? MULTIPLAYER : PLAYING;
+                restart();
             }
+            
+            SDL_Event e = {};
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = multiplayer ? multiplayerKeys[keyDist(moveRng)] : singleKeys[keyDist(moveRng)];
+            playHeadlessInput(e, headlessRun);
         }
         
-        // Chọn 2 ô ngẫu nhiên cho player 2
-        std::shuffle(emptyP2Cells.begin(), emptyP2Cells.end(), rng);
-        
-        // Thêm ô đầu tiên cho player 2 (90% là 2, 10% là 4)
-        int row1P2 = emptyP2Cells[0].first;
-        int col1P2 = emptyP2Cells[0].second;
-        boardP2[row1P2][col1P2] = (valueDist(rng) < 9) ? 2 : 4;
-        
-        // Thêm ô thứ hai cho player 2 (90% là 2, 10% là 4)
-        int row2P2 = emptyP2Cells[1].first;
-        int col2P2 = emptyP2Cells[1].second;
-        boardP2[row2P2][col2P2] = (valueDist(rng) < 9) ? 2 : 4;
+        printFrameReport(multiplayer ? "Multiplayer" : "Single player", headlessRun);
+    }
+    
+    std::cout << "Peak RSS: " << getPeakRssKb() << " KB" << std::endl;
+    return 0;
+}
+
+// --check-rules: plays every direction on boardCount random boards with the move functions
+// above, with the packed rules of the game server and with the multi-board move kernel of
+// the batch environment, then spawns a tile from the same RNG state; canMove is checked
+// against canMovePackedBoard. Boards at the packed tile limit are skipped: there the game
+// merges two 32768 tiles and the packed rules end. Prints the boards that differ; returns 1
+// if any does.
+int runRuleCheck(int boardCount, unsigned int seed) {
+    headless = true; // No save files, no sounds
+    currentState = PLAYING;
+    currentPlayer = 0;
+    PlayerState& player = players[0];
+    TileRng boardRng(seed);
+    int mismatches = 0;
+    int skipped = 0;
+    
+    for (int b = 0; b < boardCount; b++) {
+        Uint64 board = makeRuleCheckBoard(boardRng);
+        if (hasPackedTileLimit(board)) {
+            skipped++;
+            continue;
+        }
+        unpackBoard(board, player.board);
+        bool movable = canMove(player.board);
+        if (movable != canMovePackedBoard(board) && mismatches++ < 10) {
+            char line[96];
+            snprintf(line, sizeof(line), "Mismatch: board %016llx, canMove %d, packed %d",
+                     static_cast<unsigned long long>(board), movable ? 1 : 0, movable ? 0 : 1);
+            std::cout << line << std::endl;
+        }
         
-        currentState = MULTIPLAYER;
-    } else {
-        // Single player mode - thêm 2 ô ngẫu nhiên
-        // Thêm trực tiếp vào bảng thay vì qua animation
-        std::vector<std::pair<int, int>> emptyCells;
+        const Uint64 kernelBoards[4] = {board, board, board, board};
+        const Uint8 kernelDirections[4] = {MOVE_LEFT, MOVE_RIGHT, MOVE_UP, MOVE_DOWN};
+        Uint64 kernelMoved[4];
+        Uint32 kernelScores[4];
+        Uint32 kernelChanged = movePackedBoards(kernelBoards, kernelDirections, 4, kernelMoved, kernelScores);
         
-        // Tìm tất cả các ô trống
-        for (int i = 0; i < BOARD_SIZE; i++) {
-            for (int j = 0; j < BOARD_SIZE; j++) {
-                emptyCells.push_back(std::make_pair(i, j));
+        for (int direction = MOVE_LEFT; direction <= MOVE_DOWN; direction++) {
+            unpackBoard(board, player.board);
+            player.score = 0;
+            bool moved = applyMove(direction);
+            Uint64 expected = 0;
+            packBoard(player.board, expected);
+            
+            Uint32 packedScore = 0;
+            Uint64 packed = movePackedBoard(board, direction, packedScore);
+            bool same = (packed == expected) && (packedScore == static_cast<Uint32>(player.score)) &&
+                        ((packed != board) == moved);
+            same = same && (kernelMoved[direction] == expected) && (kernelScores[direction] == packedScore) &&
+                   (((kernelChanged >> direction) & 1) != 0) == moved;
+            
+            Uint64 spawnSeed = boardRng();
+            player.rng.seed(spawnSeed);
+            addRandomTile();
+            Uint64 spawned = 0;
+            packBoard(player.board, spawned);
+            TileRng packedRng(spawnSeed);
+            same = same && (spawnPackedTile(packed, packedRng) == spawned);
+            
+            if (!same && mismatches++ < 10) {
+                char line[160];
+                snprintf(line, sizeof(line), "Mismatch: board %016llx direction %d, game %016llx (%d), packed %016llx (%u)",
+                         static_cast<unsigned long long>(board), direction, static_cast<unsigned long long>(expected),
+                         player.score, static_cast<unsigned long long>(packed), packedScore);
+                std::cout << line << std::endl;
             }
         }
-        
-        // Chọn 2 ô ngẫu nhiên
-        std::shuffle(emptyCells.begin(), emptyCells.end(), rng);
-        
-        // Thêm ô đầu tiên (90% là 2, 10% là 4)
-        std::uniform_int_distribution<int> valueDist(0, 9);
-        int row1 = emptyCells[0].first;
-        int col1 = emptyCells[0].second;
-        board[row1][col1] = (valueDist(rng) < 9) ? 2 : 4;
-        
-        // Thêm ô thứ hai (90% là 2, 10% là 4)
-        int row2 = emptyCells[1].first;
-        int col2 = emptyCells[1].second;
-        board[row2][col2] = (valueDist(rng) < 9) ? 2 : 4;
-        
-        currentState = PLAYING;
     }
     
-    // Cập nhật bảng ngay lập tức
-    boardTextureNeedsUpdate = true;
-    updateBoardTexture();
-    render();
-    
-    // Lưu game sau khi khởi tạo lại
-    saveGame();
-    
-    // Play button sound
-    playSound(buttonSound);
+    std::cout << "Rule check: " << boardCount - skipped << " boards, 4 directions each, " << mismatches << " mismatches ("
+              << skipped << " boards at the tile limit skipped, move kernel " << getPackedMoveKernel().name << ")" << std::endl;
+    return mismatches == 0 ? 0 : 1;
 }
 
-void updateAnimations() {
-    // Calculate delta time
-    auto currentTime = std::chrono::steady_clock::now();
-    float dt = std::chrono::duration<float>(currentTime - lastFrameTime).count();
-    
-    // Limit delta time to prevent large jumps that cause flickering
-    dt = std::min(dt, 0.033f); // Cap at ~30 FPS equivalent
+// Start a networked game: --host waits for the opponent on a port, --join connects to one.
+// Both sides show the two board multiplayer screen with their own board on the left.
+bool startNetwork(bool hostGame, const std::string& host, int port) {
+    if (hostGame) {
+        network.listenSocket = openListenSocket(port);
+        if (network.listenSocket < 0) {
+            std::cerr << "Could not listen on port " << port << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::cout << "Waiting for an opponent on port " << port << std::endl;
+    } else {
+        network.socket = connectToHost(host, port);
+        if (network.socket < 0) {
+            std::cerr << "Could not connect to " << host << ":" << port << std::endl;
+            return false;
+        }
+        configurePeerSocket(network.socket);
+    }
     
-    lastFrameTime = currentTime;
+    network.enabled = true;
+    network.port = port;
+    network.lastPingTicks = SDL_GetTicks();
+    playerCount = 2;
+    currentState = MULTIPLAYER;
+    restart(); // Sends the new board once connected
     
-    // Update total animation time
-    deltaTime += dt;
+    publishSnapshot();
+    snapshots.update();
+    return true;
+}
+
+// Leave the networked game (back to the menu or on exit)
+void closeNetwork() {
+    if (network.socket >= 0) disconnectPeer();
+    if (network.listenSocket >= 0) close(network.listenSocket);
+    network.listenSocket = -1;
+    network.enabled = false;
+}
+
+// The opponent left or the connection failed; a host keeps listening for a new opponent
+void disconnectPeer() {
+    close(network.socket);
+    network.socket = -1;
+    network.receiveBuffer.clear();
+    network.sendBuffer.clear();
+    network.rttMs = 0.0f;
+    std::cout << "Opponent disconnected" << std::endl;
+}
+
+// Send as much of the send buffer as the socket takes without blocking
+void flushNetwork() {
+    while (network.socket >= 0 && !network.sendBuffer.empty()) {
+        ssize_t sent = send(network.socket, network.sendBuffer.data(), network.sendBuffer.size(), NETWORK_SEND_FLAGS);
+        if (sent > 0) {
+            network.sendBuffer.erase(network.sendBuffer.begin(), network.sendBuffer.begin() + sent);
+        } else if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // The rest goes out on a later update, unless the peer has stopped reading
+            if (network.sendBuffer.size() > NETWORK_MAX_SEND_BUFFER) {
+                disconnectPeer();
+            }
+            return;
+        } else {
+            disconnectPeer();
+        }
+    }
+}
+
+// Tell the opponent about a new local board
+void sendBoard() {
+    if (!network.enabled || network.socket < 0) return;
+    
+    Uint64 packed = 0;
+    if (!packBoard(players[0].board, packed)) return;
+    network.sendBuffer.push_back(NET_BOARD);
+    writeLittleEndian(network.sendBuffer, packed, 8);
+    writeLittleEndian(network.sendBuffer, static_cast<Uint32>(players[0].score), 4);
+    flushNetwork();
+}
+
+// A local move: two bytes, sent right away
+void sendMove(int direction, int spawnCell) {
+    if (network.socket < 0) return;
+    
+    Uint8 spawn = 0xFF;
+    if (spawnCell >= 0) {
+        int value = players[0].board[spawnCell / BOARD_SIZE][spawnCell % BOARD_SIZE];
+        spawn = static_cast<Uint8>((spawnCell << 1) | (value == 4 ? 1 : 0));
+    }
+    network.sendBuffer.push_back(NET_MOVE);
+    network.sendBuffer.push_back(static_cast<Uint8>(direction));
+    network.sendBuffer.push_back(spawn);
+    flushNetwork();
+}
+
+// Accept the opponent, handle the messages that arrived, probe the round trip and send
+// what is pending. Returns true if anything the renderer shows changed.
+bool updateNetwork() {
+    bool changed = false;
+    
+    if (network.socket < 0 && network.listenSocket >= 0) {
+        int peer = accept(network.listenSocket, nullptr, nullptr);
+        if (peer >= 0) {
+            configurePeerSocket(peer);
+            network.socket = peer;
+            network.lastPingTicks = SDL_GetTicks();
+            std::cout << "Opponent connected" << std::endl;
+            sendBoard();
+            changed = true;
+        }
+    }
+    if (network.socket < 0) return changed;
+    
+    // Read everything the socket has
+    Uint8 chunk[512];
+    while (true) {
+        ssize_t received = recv(network.socket, chunk, sizeof(chunk), 0);
+        if (received > 0) {
+            network.receiveBuffer.insert(network.receiveBuffer.end(), chunk, chunk + received);
+        } else if (received < 0 && errno == EINTR) {
+            continue;
+        } else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            disconnectPeer();
+            return true;
+        }
+    }
     
-    // Update animation progress
-    std::vector<TileAnimation>& currentAnimations = (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) ? animationsP2 : animations;
+    // Handle the complete messages, keep a partial one for the next update
+    Uint64 receivedCounter = SDL_GetPerformanceCounter();
+    size_t offset = 0;
+    while (offset < network.receiveBuffer.size()) {
+        Uint8 type = network.receiveBuffer[offset];
+        int bodySize = getNetworkBodySize(type);
+        if (bodySize < 0) {
+            std::cerr << "Invalid network message " << static_cast<int>(type) << std::endl;
+            disconnectPeer();
+            return true;
+        }
+        if (network.receiveBuffer.size() - offset < static_cast<size_t>(1 + bodySize)) break;
+        
+        handleNetworkMessage(type, &network.receiveBuffer[offset + 1], receivedCounter);
+        offset += 1 + bodySize;
+        changed = true;
+    }
+    network.receiveBuffer.erase(network.receiveBuffer.begin(), network.receiveBuffer.begin() + offset);
     
-    for (size_t i = 0; i < currentAnimations.size(); i++) {
-        currentAnimations[i].progress += dt;
+    if (SDL_GetTicks() - network.lastPingTicks >= NETWORK_PING_INTERVAL_MS) {
+        network.lastPingTicks = SDL_GetTicks();
+        network.sendBuffer.push_back(NET_PING);
+        writeLittleEndian(network.sendBuffer, SDL_GetPerformanceCounter(), 8);
     }
     
-    // Check if animations are complete
-    bool allComplete = true;
-    float totalAnimationTime = ANIMATION_DURATION + NEW_TILE_DELAY + NEW_TILE_ANIMATION_DURATION;
+    flushNetwork();
+    return changed;
+}
+
+void handleNetworkMessage(Uint8 type, const Uint8* body, Uint64 receivedCounter) {
+    PlayerState& remote = players[1];
+    
+    if (type == NET_BOARD) {
+        unpackBoard(readLittleEndian(body, 8), remote.board);
+        remote.score = static_cast<int>(readLittleEndian(body + 8, 4));
+        remote.gameOver = false;
+        remote.won = false;
+        remote.animationTimeline.active = false;
+        clearAnimationPool(remote.animationPool);
+        clearHistory(remote.moveHistory);
+    } else if (type == NET_MOVE) {
+        applyRemoteMove(body[0], body[1], receivedCounter);
+    } else if (type == NET_PING) {
+        network.sendBuffer.push_back(NET_PONG);
+        network.sendBuffer.insert(network.sendBuffer.end(), body, body + 8);
+    } else if (type == NET_PONG) {
+        float rttMs = static_cast<float>(getCounterMs(readLittleEndian(body, 8), receivedCounter));
+        network.rttMs = (network.rttMs == 0.0f) ? rttMs : lerp(network.rttMs, rttMs, 0.2f);
+    }
+}
+
+// Replay an opponent's move on the mirror board: the same move logic runs, then the tile
+// the opponent spawned is placed instead of a random one
+void applyRemoteMove(int direction, Uint8 spawn, Uint64 receivedCounter) {
+    PlayerState& remote = players[1];
+    if (remote.animationTimeline.active) {
+        finishAnimation(1);
+    }
     
-    if (deltaTime < totalAnimationTime) {
-        allComplete = false;
+    currentPlayer = 1;
+    if (!applyMove(direction)) {
+        currentPlayer = 0;
+        return;
+    }
+    resetAnimationTimeline(remote.animationTimeline);
+    
+    int cell = spawn >> 1;
+    if (spawn != 0xFF && cell < BOARD_SIZE * BOARD_SIZE) {
+        int row = cell / BOARD_SIZE;
+        int col = cell % BOARD_SIZE;
+        remote.board[row][col] = (spawn & 1) ? 4 : 2;
+        remote.animationPool.newCells |= getCellBit(row, col);
+        playSound(SOUND_EFFECT_MERGE_NEW);
     }
     
-    if (allComplete) {
-        // Reset animation state
-        animating = false;
-        deltaTime = 0.0f;
-        
-        // Clear animation data
-        if (currentState == MULTIPLAYER && currentPlayer == PLAYER_TWO) {
-            animationsP2.clear();
-            mergedTilesP2.clear();
-            newTilesP2.clear();
-        } else {
-            animations.clear();
-            mergedTiles.clear();
-            newTiles.clear();
-        }
-        
-        // Mark the board texture as needing update
-        boardTextureNeedsUpdate = true;
-        
-        // Force a final render to ensure the board is in its final state
-        render();
-        
-        // Check game state after animations complete
+    if (currentState == MULTIPLAYER) {
         checkWin();
         checkGameOver();
     }
+    currentPlayer = 0;
+    
+    moveSequence++;
+    RemoteMove move;
+    move.moveSequence = moveSequence;
+    move.receivedCounter = receivedCounter;
+    move.rttMs = network.rttMs;
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    remoteMovesAwaitingFrame.push_back(move);
 }
 
-void handleMenuInput(SDL_Event& e) {
-    if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
-        updateButtonHoverStates();
+// Start bot control: stdin/stdout, or a Unix socket at socketPath. With the window the
+// logic thread polls the agent (updateBot); without it runBot() serves the agent directly.
+bool startBot(const std::string& socketPath, bool binary, bool polled) {
+    bot.binary = binary;
+    bot.socketPath = socketPath;
+    if (socketPath.empty()) {
+        bot.inputFd = STDIN_FILENO;
+        bot.outputFd = STDOUT_FILENO;
+    } else {
+        bot.listenSocket = openBotSocket(socketPath);
+        if (bot.listenSocket < 0) {
+            std::cerr << "Could not open the bot socket " << socketPath << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        std::cout << "Waiting for a bot on " << socketPath << std::endl;
     }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
-            
-            // Check which button was clicked
-            for (size_t i = 0; i < menuButtons.size(); i++) {
-                if (isPointInRect(mouseX, mouseY, menuButtons[i].rect)) {
-                    // Play button sound
-                    playSound(buttonSound);
-                    
-                    // Handle button click
-                    switch (i) {
-                        case 0: // Singleplayer
-                            // Tải game chế độ đơn nếu có
-                            if (loadGame(false)) {
-                                currentState = PLAYING;
-                            } else {
-                                // Không có game đã lưu, khởi tạo mới
-                                currentState = PLAYING;
-                                restart();
-                            }
-                            break;
-                        case 1: // Multiplayer
-                            // Tải game chế độ đa người nếu có
-                            if (loadGame(true)) {
-                                currentState = MULTIPLAYER;
-                            } else {
-                                // Không có game đã lưu, khởi tạo mới
-                                currentState = MULTIPLAYER;
-                                restart();
-                            }
-                            break;
-                        case 2: // How to Play
-                            currentState = HOW_TO_PLAY;
-                            break;
-                        case 3: // Exit
-                            gameOver = true; // This will cause the application to exit
-                            break;
-                    }
-                }
-            }
+    if (polled) {
+        if (bot.listenSocket >= 0) fcntl(bot.listenSocket, F_SETFL, fcntl(bot.listenSocket, F_GETFL, 0) | O_NONBLOCK);
+        if (bot.inputFd >= 0) {
+            // The flags belong to the open files, which the shell shares; both are read before
+            // either changes, as stdin and stdout may be the same terminal
+            bot.stdinFlags = fcntl(STDIN_FILENO, F_GETFL, 0);
+            bot.stdoutFlags = fcntl(STDOUT_FILENO, F_GETFL, 0);
+            fcntl(STDIN_FILENO, F_SETFL, bot.stdinFlags | O_NONBLOCK);
+            fcntl(STDOUT_FILENO, F_SETFL, bot.stdoutFlags | O_NONBLOCK);
         }
     }
+    
+    bot.enabled = true;
+    currentState = PLAYING;
+    restart();
+    return true;
+}
+
+void closeBot() {
+    if (bot.listenSocket >= 0) {
+        disconnectBot();
+        close(bot.listenSocket);
+        unlink(bot.socketPath.c_str());
+    }
+    if (bot.stdoutFlags >= 0) {
+        fcntl(STDOUT_FILENO, F_SETFL, bot.stdoutFlags);
+        bot.stdoutFlags = -1;
+    }
+    if (bot.stdinFlags >= 0) {
+        fcntl(STDIN_FILENO, F_SETFL, bot.stdinFlags);
+        bot.stdinFlags = -1;
+    }
+    bot.listenSocket = -1;
+    bot.enabled = false;
 }
 
-void handleHowToPlayInput(SDL_Event& e) {
-    if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
-        updateButtonHoverStates();
+// The agent left; a Unix socket waits for the next one, stdin is done
+void disconnectBot() {
+    if (bot.listenSocket >= 0 && bot.inputFd >= 0) close(bot.inputFd);
+    bot.inputFd = -1;
+    bot.outputFd = -1;
+    bot.input.clear();
+    bot.output.clear();
+}
+
+void acceptBot() {
+    int agent = accept(bot.listenSocket, nullptr, nullptr);
+    if (agent < 0) return;
+    
+    if (fcntl(bot.listenSocket, F_GETFL, 0) & O_NONBLOCK) {
+        fcntl(agent, F_SETFL, fcntl(agent, F_GETFL, 0) | O_NONBLOCK);
     }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
-            
-            // Check if back button was clicked
-            if (isPointInRect(mouseX, mouseY, howToPlayButtons[0].rect)) {
-                playSound(buttonSound);
-                currentState = MENU;
-            }
-        }
+    bot.inputFd = agent;
+    bot.outputFd = agent;
+}
+
+// Read what the agent sent: 1 if bytes arrived, 0 if none are waiting, -1 if it disconnected
+int receiveBotInput() {
+    Uint8 chunk[4096];
+    ssize_t received = read(bot.inputFd, chunk, sizeof(chunk));
+    if (received > 0) {
+        bot.input.insert(bot.input.end(), chunk, chunk + received);
+        return 1;
     }
-    else if (e.type == SDL_KEYDOWN) {
-        if (e.key.keysym.sym == SDLK_ESCAPE) {
-            playSound(buttonSound);
-            currentState = MENU;
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    return -1;
+}
+
+// Write the pending answers; a non-blocking agent socket may take only part of them
+void flushBotOutput() {
+    size_t written = 0;
+    while (written < bot.output.size()) {
+        ssize_t result = write(bot.outputFd, bot.output.data() + written, bot.output.size() - written);
+        if (result > 0) {
+            written += result;
+        } else if (result < 0 && errno == EINTR) {
+            continue;
+        } else {
+            break;
         }
     }
+    bot.output.erase(bot.output.begin(), bot.output.begin() + written);
 }
 
-void handleGameOverInput(SDL_Event& e) {
-    if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
-        updateButtonHoverStates();
+// One move of the agent: a key press of the single player game without saveGame(), the
+// input latency tracking or the win screen (bots play on past 2048). A running animation
+// is cut, so a batch only shows its last move.
+bool applyBotMove(int direction) {
+    PlayerState& player = players[0];
+    if (player.animationTimeline.active) {
+        player.animationTimeline.active = false;
+        clearAnimationPool(player.animationPool);
     }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
-            
-            // Check which button was clicked
-            for (size_t i = 0; i < gameOverButtons.size(); i++) {
-                if (isPointInRect(mouseX, mouseY, gameOverButtons[i].rect)) {
-                    playSound(buttonSound);
-                    
-                    // Handle button click
-                    switch (i) {
-                        case 0: // Play Again
-                            restart();
-                            break;
-                        case 1: // Main Menu
-                            currentState = MENU;
-                            break;
-                    }
-                }
-            }
-        }
+    
+    currentPlayer = 0;
+    if (direction < MOVE_LEFT || direction > MOVE_DOWN || !applyMove(direction)) return false;
+    
+    resetAnimationTimeline(player.animationTimeline);
+    addRandomTile();
+    recordHistory(0);
+    checkGameOver();
+    moveSequence++;
+    return true;
+}
+
+void startBotGame(bool seeded, Uint64 seed) {
+    if (seeded) rng.seed(seed);
+    currentState = PLAYING;
+    restart();
+}
+
+void queueBotAnswer(int moved, bool refused = false) {
+    if (refused && !bot.binary) {
+        const char answer[] = "ERR not playing\n";
+        bot.output.insert(bot.output.end(), answer, answer + sizeof(answer) - 1);
+        return;
     }
-    else if (e.type == SDL_KEYDOWN) {
-        if (e.key.keysym.sym == SDLK_r) {
-            playSound(buttonSound);
-            restart();
-        }
-        else if (e.key.keysym.sym == SDLK_ESCAPE) {
-            playSound(buttonSound);
-            currentState = MENU;
-        }
+    
+    Uint64 board = 0;
+    packBoard(players[0].board, board);
+    bool over = !canMove(players[0].board);
+    
+    if (bot.binary) {
+        writeLittleEndian(bot.output, board, 8);
+        writeLittleEndian(bot.output, static_cast<Uint32>(players[0].score), 4);
+        writeLittleEndian(bot.output, static_cast<Uint16>(std::min(moved, 0xFFFF)), 2);
+        bot.output.push_back(over ? 1 : 0);
+        bot.output.push_back(refused ? 1 : 0);
+        return;
     }
+    
+    char answer[64];
+    int length = snprintf(answer, sizeof(answer), "OK %016llx %d %d %d\n", 
+                          static_cast<unsigned long long>(board), players[0].score, moved, over ? 1 : 0);
+    bot.output.insert(bot.output.end(), answer, answer + length);
 }
 
-void handleMultiplayerGameOverInput(SDL_Event& e) {
-    if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
-        updateButtonHoverStates();
-    }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
+// Run every complete command in the input buffer. Returns false when the agent ended the session.
+bool processBotInput() {
+    // The agent plays the single player game; the screen the user chose in the window is not
+    // taken away from them
+    bool playing = (currentState == PLAYING || currentState == GAME_OVER);
+    
+    size_t offset = 0;
+    bool running = true;
+    while (running && offset < bot.input.size()) {
+        const Uint8* command = &bot.input[offset];
+        size_t available = bot.input.size() - offset;
+        int moved = 0;
+        
+        if (bot.binary) {
+            if (available < 2 || available < 2u + command[1]) break;
+            Uint8 opcode = command[0];
+            int count = command[1];
+            if (opcode == 'Q') {
+                running = false;
+            } else if (!playing) {
+                // Answered as refused below
+            } else if (opcode == 'M') {
+                for (int i = 0; i < count; i++) {
+                    if (applyBotMove(command[2 + i])) moved++;
+                }
+            } else if (opcode == 'N') {
+                startBotGame(count == 8, count == 8 ? readLittleEndian(command + 2, 8) : 0);
+            }
+            offset += 2 + count;
+        } else {
+            const Uint8* lineEnd = static_cast<const Uint8*>(std::memchr(command, '\n', available));
+            if (lineEnd == nullptr) break;
+            offset += (lineEnd - command) + 1;
             
-            // Check which button was clicked
-            for (size_t i = 0; i < multiplayerGameOverButtons.size(); i++) {
-                if (isPointInRect(mouseX, mouseY, multiplayerGameOverButtons[i].rect)) {
-                    playSound(buttonSound);
-                    
-                    // Handle button click
-                    switch (i) {
-                        case 0: // Play Again
-                            restart();
-                            break;
-                        case 1: // Main Menu
-                            currentState = MENU;
-                            break;
-                    }
+            if (command[0] == 'Q') {
+                running = false;
+            } else if (!playing) {
+                // Answered as refused below
+            } else if (command[0] == 'N') {
+                // The input buffer has no terminating NUL: parse a copy of the line
+                std::string seedText(reinterpret_cast<const char*>(command + 1), lineEnd - command - 1);
+                char* seedEnd = nullptr;
+                unsigned long long seed = std::strtoull(seedText.c_str(), &seedEnd, 10);
+                startBotGame(seedEnd != seedText.c_str(), seed);
+            } else {
+                // Moves; 'S' and anything else just answer with the state
+                for (const Uint8* c = command; c < lineEnd; c++) {
+                    int direction = (*c == 'L') ? MOVE_LEFT : (*c == 'R') ? MOVE_RIGHT : 
+                                    (*c == 'U') ? MOVE_UP : (*c == 'D') ? MOVE_DOWN : -1;
+                    if (direction >= 0 && applyBotMove(direction)) moved++;
                 }
             }
         }
+        
+        if (running) queueBotAnswer(moved, !playing);
     }
-    else if (e.type == SDL_KEYDOWN) {
-        if (e.key.keysym.sym == SDLK_r) {
-            playSound(buttonSound);
-            restart();
-        }
-        else if (e.key.keysym.sym == SDLK_ESCAPE) {
-            playSound(buttonSound);
-            currentState = MENU;
+    bot.input.erase(bot.input.begin(), bot.input.begin() + offset);
+    return running;
+}
+
+// Logic thread: accept an agent, run its commands and answer. Returns true if the board changed.
+bool updateBot() {
+    if (bot.inputFd < 0 && bot.listenSocket >= 0) acceptBot();
+    if (bot.inputFd < 0) return false;
+    
+    int status;
+    bool received = false;
+    while ((status = receiveBotInput()) > 0) received = true;
+    
+    bool running = !received || processBotInput();
+    flushBotOutput();
+    // An agent that sends commands but does not read the answers is dropped
+    if (status < 0 || !running || bot.output.size() > BOT_MAX_OUTPUT) disconnectBot();
+    return received;
+}
+
+// --bot --no-window: serve agents until stdin closes (stdin/stdout) or forever (socket).
+// Only the game rules run; SDL is not initialized.
+int runBot(const std::string& socketPath, bool binary) {
+    if (!startBot(socketPath, binary, false)) return 1;
+    
+    while (true) {
+        if (bot.inputFd < 0) {
+            if (bot.listenSocket < 0) break;
+            acceptBot();
+            continue;
         }
+        
+        int status = receiveBotInput();
+        bool running = status <= 0 || processBotInput();
+        flushBotOutput();
+        if (status < 0 || !running || bot.output.size() > BOT_MAX_OUTPUT) disconnectBot();
     }
+    return 0;
 }
 
-void handleGameInput(SDL_Event& e) {
-    if (e.type == SDL_QUIT) {
-        gameOver = true;
+// Copy the state the renderer needs into the next snapshot and hand it to the render thread
+void publishSnapshot() {
+    GameSnapshot& snapshot = snapshots.writeBuffer();
+    snapshot.currentState = currentState;
+    snapshot.playerCount = playerCount;
+    for (int p = 0; p < playerCount; p++) {
+        PlayerSnapshot& player = snapshot.players[p];
+        player.board = players[p].board;
+        player.score = players[p].score;
+        player.won = players[p].won;
+        player.animationTimeline = players[p].animationTimeline;
+        player.animationPool = players[p].animationPool;
     }
-    else if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
+    snapshot.bestScore = bestScore;
+    snapshot.gameOver = gameOver;
+    snapshot.menuButtons = menuButtons;
+    snapshot.howToPlayButtons = howToPlayButtons;
+    snapshot.gameOverButtons = gameOverButtons;
+    snapshot.multiplayerGameOverButtons = multiplayerGameOverButtons;
+    snapshot.mouseX = mouseX;
+    snapshot.mouseY = mouseY;
+    snapshot.moveSequence = moveSequence;
+    snapshot.networkEnabled = network.enabled;
+    snapshot.networkConnected = network.socket >= 0;
+    snapshot.networkHost = network.listenSocket >= 0;
+    snapshot.networkPort = network.port;
+    snapshot.networkRttMs = network.rttMs;
+    Uint64 board = 0;
+    snapshot.hintDirection = (hintDirection >= 0 && packBoard(players[0].board, board) && board == hintBoard) ? hintDirection : -1;
+    snapshots.publish();
+}
+
+// Move for board: greedy on the value network when there is one, else a Monte Carlo search
+// within its time budget on all cores but one, which is left to the render thread
+static int chooseAiMove(const NTupleNetwork* network, Uint64 board, Uint64 seed) {
+    if (network != nullptr) {
+        return chooseNTupleMove(*network, board);
     }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
+    int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    return chooseMonteCarloMove(board, MONTE_CARLO_DEFAULT_PLAYOUTS, MONTE_CARLO_DEFAULT_BUDGET_MS,
+                                threads, seed).direction;
+}
 
-            // Check if "Back" button was clicked
-            Button backButton;
-            backButton.rect.x = BOARD_MARGIN;
-            backButton.rect.y = BOARD_MARGIN;
-            backButton.rect.w = 100;
-            backButton.rect.h = 40;
+// Search a move for board on a worker; does nothing while another search runs
+void startAiSearch(Uint64 board, bool forHint) {
+    if (aiSearch.valid()) return;
+    const NTupleNetwork* network = valueNetwork.get();
+    Uint64 seed = monteCarloRng();
+    aiSearchBoard = board;
+    aiSearchForHint = forHint;
+    aiSearch = std::async(std::launch::async, [network, board, seed] {
+        return chooseAiMove(network, board, seed);
+    });
+}
 
-            if (isPointInRect(mouseX, mouseY, backButton.rect)) {
-                playSound(buttonSound);
-                saveGame(); // Lưu game khi quay lại menu
-                currentState = MENU;
-            }
+// Use the weights written by --train-ntuple for the AI and hints; false if they cannot be read
+bool loadValueNetwork(const std::string& path) {
+    std::unique_ptr<NTupleNetwork> network(new NTupleNetwork());
+    if (!loadNTupleNetwork(*network, path)) return false;
+    valueNetwork = std::move(network);
+    return true;
+}
 
-            // Check if "New Game" button was clicked
-            Button newGameButton;
-            newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
-            newGameButton.rect.y = BOARD_MARGIN;
-            newGameButton.rect.w = 120;
-            newGameButton.rect.h = 40;
+// Suggest a move for the single player board; shown when the search is done, until the board changes
+void showHint() {
+    Uint64 board = 0;
+    if (!packBoard(players[0].board, board)) return;
+    startAiSearch(board, true);
+}
 
-            if (isPointInRect(mouseX, mouseY, newGameButton.rect)) {
-                playSound(buttonSound);
-                // Đảm bảo chúng ta ở chế độ chơi đơn
-                currentState = PLAYING;
-                restart();
-            }
+// Logic thread: use the move of a finished AI search, and start the next autoplay search once
+// the last move's animation is over. A move found for a board that has changed meanwhile (a
+// key, undo, a new game) is dropped. Autoplay stops when the game is left or ends, or at the
+// packed tile limit. Returns true if the board or the hint changed.
+bool updateAiSearch() {
+    if (aiAutoplay && currentState != PLAYING) {
+        aiAutoplay = false;
+    }
+    
+    Uint64 board = 0;
+    if (aiSearch.valid()) {
+        if (aiSearch.wait_for(std::chrono::seconds(0)) != std::future_status::ready) return false;
+        int direction = aiSearch.get();
+        if (currentState != PLAYING || !packBoard(players[0].board, board) || board != aiSearchBoard) return false;
+        if (aiSearchForHint) {
+            hintBoard = board;
+            hintDirection = direction;
+            return true;
         }
+        return aiAutoplay && applyAiMove(direction);
     }
-    else if (e.type == SDL_KEYDOWN && !animating) {
-        bool moved = false;
+    
+    if (!aiAutoplay || players[0].animationTimeline.active) return false;
+    if (!packBoard(players[0].board, board) || hasPackedTileLimit(board)) {
+        // A tile above 32768, or two 32768 tiles that can merge, do not fit the packed board
+        // the AI plays on
+        aiAutoplay = false;
+        return false;
+    }
+    startAiSearch(board, false);
+    return false;
+}
+
+// Play an autoplay move like a key press in single player
+bool applyAiMove(int direction) {
+    PlayerState& player = players[0];
+    currentPlayer = 0;
+    if (direction < 0 || !applyMove(direction)) {
+        aiAutoplay = false;
+        return false;
+    }
+    
+    resetAnimationTimeline(player.animationTimeline);
+    addRandomTile();
+    recordHistory(0);
+    saveGame();
+    checkWin();
+    checkGameOver();
+    recordMoveApplied();
+    return true;
+}
+
+// Logic thread: apply input, advance animations and autosave, then publish a snapshot
+// whenever something changed. A slow frame or a slow save only delays its own thread.
+void logicLoop() {
+    while (logicRunning.load(std::memory_order_acquire)) {
+        bool changed = false;
         
-        switch (e.key.keysym.sym) {
-            case SDLK_LEFT:
-            case SDLK_a:
-                moved = moveLeft();
-                break;
-            case SDLK_RIGHT:
-            case SDLK_d:
-                moved = moveRight();
-                break;
-            case SDLK_UP:
-            case SDLK_w:
-                moved = moveUp();
-                break;
-            case SDLK_DOWN:
-            case SDLK_s:
-                moved = moveDown();
-                break;
-            case SDLK_r:
-                playSound(buttonSound);
-                restart();
-                break;
-            case SDLK_ESCAPE:
-                playSound(buttonSound);
-                saveGame(); // Lưu game khi quay lại menu
-                currentState = MENU;
-                break;
+        SDL_Event e;
+        while (inputEvents.pop(e)) {
+            handleEvent(e);
+            changed = true;
+        }
+        if (changed) {
+            processQueuedKeys();
         }
         
-        if (moved) {
-            // Start animation timer
-            deltaTime = 0.0f;
-            lastFrameTime = std::chrono::steady_clock::now();
+        // Networked game: leaving to the menu ends it, otherwise apply the opponent's moves
+        if (network.enabled && currentState == MENU) {
+            closeNetwork();
+            changed = true;
+        } else if (network.enabled && updateNetwork()) {
+            changed = true;
+        }
+        
+        // Bot agent commands
+        if (bot.enabled && updateBot()) {
+            changed = true;
+        }
+        
+        if (updateAiSearch()) {
+            changed = true;
+        }
+        
+        // Update animations if needed
+        if (isAnimating()) {
+            updateAnimations();
+            changed = true;
+        }
+        
+        // Kiểm tra xem có cần lưu game tự động không
+        if (SDL_GetTicks() - lastAutoSaveTime > AUTO_SAVE_INTERVAL && 
+            (currentState == PLAYING || currentState == MULTIPLAYER)) {
+            saveGame(true);
+            lastAutoSaveTime = SDL_GetTicks();
+        }
+        
+        flushSounds();
+        
+        if (changed) {
+            publishSnapshot();
+        }
+        
+        SDL_Delay(LOGIC_TICK_MS);
+    }
+}
+
+// Stop and join the logic thread; the game state belongs to the calling thread afterwards
+void stopLogicThread() {
+    if (logicThread.joinable()) {
+        logicRunning.store(false, std::memory_order_release);
+        logicThread.join();
+    }
+}
+
+// Render thread: poll events and forward them to the logic thread, then draw the latest snapshot
+void run() {
+    // Main game loop
+    bool quitApplication = false;
+    Uint32 frameStart;
+    
+    // Pace frames to the display refresh rate (vsync normally does this already)
+    SDL_DisplayMode displayMode;
+    int refreshRate = DEFAULT_REFRESH_RATE;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &displayMode) == 0 && displayMode.refresh_rate > 0) {
+        refreshRate = displayMode.refresh_rate;
+    }
+    const int frameDelay = 1000 / refreshRate;
+    
+    logicRunning.store(true, std::memory_order_release);
+    logicThread = std::thread(&Game2048::logicLoop, this);
+    
+    while (!quitApplication) {
+        frameStart = SDL_GetTicks();
+        bool profiledFrame = profilerEnabled;
+        Uint64 frameCounterStart = profiledFrame ? SDL_GetPerformanceCounter() : 0;
+        
+        {
+            ScopedPhaseTimer eventsTimer(PHASE_EVENTS);
             
-            // Add a new tile after animation completes
-            addRandomTile();
-            checkWin();
-            checkGameOver();
+            // Process all pending events
+            SDL_Event e;
+            while (SDL_PollEvent(&e) != 0) {
+                if (e.type == SDL_QUIT) {
+                    quitApplication = true;
+                    break;
+                }
+                
+                // Render target contents can be lost, so redraw the cached boards in full.
+                // A device reset loses every texture, including the cached text.
+                if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET) {
+                    if (e.type == SDL_RENDER_DEVICE_RESET) {
+                        clearLabelCache();
+                    }
+                    invalidateBoardTextures();
+                    continue;
+                }
+                
+                // F3 toggles the profiler overlay in every screen
+                if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F3) {
+                    profilerEnabled = !profilerEnabled;
+                    renderStatsEnabled = profilerEnabled || headless;
+                    currentFrameStats = FrameStats();
+                    frameTimeCount = 0;
+                    frameTimeNext = 0;
+                    continue;
+                }
+                
+                // Everything else is game input; if the logic thread has fallen this far
+                // behind the event is dropped rather than stalling the frame
+                inputEvents.push(e);
+            }
+        }
+        
+        // Pick up the newest snapshot; the same one is drawn again if the logic thread has not published
+        {
+            ScopedPhaseTimer snapshotTimer(PHASE_SNAPSHOT);
+            snapshots.update();
+        }
+        const GameSnapshot& view = snapshots.readBuffer();
+        
+        // Check if we should exit the application
+        if (view.gameOver && view.currentState == MENU) {
+            quitApplication = true;
+        }
+        
+        // Render the current state
+        {
+            ScopedPhaseTimer renderTimer(PHASE_RENDER);
+            render();
+        }
+        
+        // Record the frame for the profiler overlay; counters restart every frame
+        if (profiledFrame && profilerEnabled) {
+            recordFrameStats((SDL_GetPerformanceCounter() - frameCounterStart) * 1000.0 / SDL_GetPerformanceFrequency());
+        }
+        currentFrameStats = FrameStats();
+        
+        if (startupProfileEnabled && !startupProfilePrinted && soundsReady.load(std::memory_order_acquire)) {
+            printStartupProfile();
+        }
+        
+        // Cap frame rate at the display refresh rate
+        int frameTime = SDL_GetTicks() - frameStart;
+        if (frameDelay > frameTime) {
+            SDL_Delay(frameDelay - frameTime);
         }
     }
+    
+    stopLogicThread();
+    saveGame(true); // Lưu game khi thoát
+    reportInputLatency();
 }
+};
 
-void handleMultiplayerInput(SDL_Event& e) {
-    if (e.type == SDL_QUIT) {
-        gameOver = true;
-    }
-    else if (e.type == SDL_MOUSEMOTION) {
-        mouseX = e.motion.x;
-        mouseY = e.motion.y;
-    }
-    else if (e.type == SDL_MOUSEBUTTONDOWN) {
-        if (e.button.button == SDL_BUTTON_LEFT) {
-            mouseX = e.button.x;
-            mouseY = e.button.y;
-
-            // Check if "Back" button was clicked
-            Button backButton;
-            backButton.rect.x = BOARD_MARGIN;
-            backButton.rect.y = BOARD_MARGIN;
-            backButton.rect.w = 100;
-            backButton.rect.h = 40;
+#ifdef __linux__
+// --server: hosts many games for clients speaking a line protocol, on one epoll loop (one
+// core). Boards are kept packed in a session table; a session belongs to the connection
+// that created it and ends with it. Requests, one per line:
+//   NEW                 -> OK <id> <board> <score>
+//   MOVE <id> <L|R|U|D> -> OK <board> <score> <moved 0/1> <over 0/1/2>
+//   GET <id>            -> OK <board> <score> <over 0/1/2>
+//   END <id>            -> OK
+//   STATS               -> OK <sessions> <moves> <server CPU time in us>
+// Boards are the packed HistoryEntry layout in hex. Errors answer "ERR <reason>". Over is
+// getPackedGameOver: 2 at the tile limit, where the game would merge two 32768 tiles that
+// the packed board cannot hold, so MOVE answers "ERR tile limit".
+struct ServerSession {
+Uint64 board;
+Uint64 rngState;
+Uint32 score;
+int ownerFd; // -1 for a free slot
+};
 
-            if (isPointInRect(mouseX, mouseY, backButton.rect)) {
-                playSound(buttonSound);
-                saveGame(); // Lưu game khi quay lại menu
-                currentState = MENU;
-            }
+struct ServerConnection {
+bool open;
+std::string input;  // Bytes of an incomplete request line
+std::string output; // Responses the socket did not take yet
+bool waitingToWrite; // EPOLLOUT is watched while output is left over
+bool inputClosed;    // The client shut down its side; the socket closes once output is sent
+std::vector<Uint32> sessionIds;
+};
 
-            // Check if "New Game" button was clicked
-            Button newGameButton;
-            newGameButton.rect.x = BOARD_MARGIN + backButton.rect.w + 10;
-            newGameButton.rect.y = BOARD_MARGIN;
-            newGameButton.rect.w = 120;
-            newGameButton.rect.h = 40;
+// Process CPU time (user + system) in microseconds
+Uint64 getProcessCpuMicroseconds() {
+rusage usage;
+getrusage(RUSAGE_SELF, &usage);
+return static_cast<Uint64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + 
+       usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
 
-            if (isPointInRect(mouseX, mouseY, newGameButton.rect)) {
-                playSound(buttonSound);
-                restart();
-            }
+class GameServer {
+public:
+    GameServer() : epollFd(-1), listenFd(-1), totalMoves(0), activeSessions(0), rng(std::random_device()()) {}
+    
+    ~GameServer() {
+        for (size_t fd = 0; fd < connections.size(); fd++) {
+            if (connections[fd].open) close(static_cast<int>(fd));
         }
+        if (listenFd >= 0) close(listenFd);
+        if (epollFd >= 0) close(epollFd);
     }
-    else if (e.type == SDL_KEYDOWN && !animating) {
-        bool movedP1 = false;
-        bool movedP2 = false;
+    
+    int run(int port) {
+        listenFd = openListenSocket(port);
+        epollFd = epoll_create1(0);
+        if (listenFd < 0 || epollFd < 0) {
+            std::cerr << "Could not start the server on port " << port << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        std::cout << "Game server listening on port " << port << std::endl;
         
-        // Handle Player 1 controls (WASD)
-        switch (e.key.keysym.sym) {
-            case SDLK_a: // Left
-                currentPlayer = PLAYER_ONE;
-                movedP1 = moveLeft();
-                break;
-            case SDLK_d: // Right
-                currentPlayer = PLAYER_ONE;
-                movedP1 = moveRight();
-                break;
-            case SDLK_w: // Up
-                currentPlayer = PLAYER_ONE;
-                movedP1 = moveUp();
+        epoll_event events[SERVER_EPOLL_EVENTS];
+        auto lastReport = std::chrono::steady_clock::now();
+        Uint64 reportMoves = 0;
+        Uint64 reportCpu = getProcessCpuMicroseconds();
+        
+        while (true) {
+            int count = epoll_wait(epollFd, events, SERVER_EPOLL_EVENTS, SERVER_REPORT_INTERVAL_MS);
+            if (count < 0 && errno != EINTR) {
+                std::cerr << "epoll_wait failed: " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+            
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptConnections();
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    readRequests(fd);
+                }
+                if (isOpen(fd) && (events[i].events & EPOLLOUT)) {
+                    flushResponses(fd);
+                }
+            }
+            
+            // Load report: sessions per core is the number of sessions one fully busy core
+            // would host at the current per-session move rate
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - lastReport).count();
+            if (seconds * 1000.0 >= SERVER_REPORT_INTERVAL_MS) {
+                Uint64 cpu = getProcessCpuMicroseconds();
+                double cpuShare = (cpu - reportCpu) / (seconds * 1000000.0);
+                double movesPerSecond = (totalMoves - reportMoves) / seconds;
+                char line[160];
+                snprintf(line, sizeof(line), "Server: %d sessions, %.0f moves/s, CPU %.1f%%, %.0f sessions per core",
+                         activeSessions, movesPerSecond, cpuShare * 100.0, 
+                         cpuShare > 0.0 ? activeSessions / cpuShare : 0.0);
+                std::cout << line << std::endl;
+                lastReport = now;
+                reportMoves = totalMoves;
+                reportCpu = cpu;
+            }
+        }
+    }
+    
+private:
+    void watch(int fd, Uint32 events, int operation) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, operation, fd, &event);
+    }
+    
+    bool isOpen(int fd) const {
+        return fd >= 0 && static_cast<size_t>(fd) < connections.size() && connections[fd].open;
+    }
+    
+    void acceptConnections() {
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) return;
+            
+            configurePeerSocket(fd);
+            if (static_cast<size_t>(fd) >= connections.size()) connections.resize(fd + 1);
+            ServerConnection& connection = connections[fd];
+            connection.open = true;
+            connection.input.clear();
+            connection.output.clear();
+            connection.sessionIds.clear();
+            connection.waitingToWrite = false;
+            connection.inputClosed = false;
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+    
+    void closeConnection(int fd) {
+        ServerConnection& connection = connections[fd];
+        for (size_t i = 0; i < connection.sessionIds.size(); i++) {
+            endSession(connection.sessionIds[i]);
+        }
+        connection.sessionIds.clear();
+        connection.open = false;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+    }
+    
+    // Read what arrived and answer every complete line, in order
+    void readRequests(int fd) {
+        ServerConnection& connection = connections[fd];
+        char chunk[4096];
+        bool peerClosed = false;
+        while (true) {
+            ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+            if (received > 0) {
+                connection.input.append(chunk, received);
+            } else if (received < 0 && errno == EINTR) {
+                continue;
+            } else if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
                 break;
-            case SDLK_s: // Down
-                currentPlayer = PLAYER_ONE;
-                movedP1 = moveDown();
+            } else if (received == 0) {
+                // The client may shut down its side right after its last requests: answer them first
+                peerClosed = true;
                 break;
+            } else {
+                closeConnection(fd);
+                return;
+            }
         }
         
-        // Handle Player 2 controls (Arrow keys)
-        switch (e.key.keysym.sym) {
-            case SDLK_LEFT:
-                currentPlayer = PLAYER_TWO;
-                movedP2 = moveLeft();
-                break;
-            case SDLK_RIGHT:
-                currentPlayer = PLAYER_TWO;
-                movedP2 = moveRight();
-                break;
-            case SDLK_UP:
-                currentPlayer = PLAYER_TWO;
-                movedP2 = moveUp();
-                break;
-            case SDLK_DOWN:
-                currentPlayer = PLAYER_TWO;
-                movedP2 = moveDown();
-                break;
-            case SDLK_r:
-                playSound(buttonSound);
-                restart();
-                break;
-            case SDLK_ESCAPE:
-                playSound(buttonSound);
-                saveGame(); // Lưu game khi quay lại menu
-                currentState = MENU;
+        size_t lineStart = 0;
+        size_t lineEnd;
+        while ((lineEnd = connection.input.find('\n', lineStart)) != std::string::npos) {
+            handleRequest(fd, connection.input.c_str() + lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+        }
+        connection.input.erase(0, lineStart);
+        
+        if (connection.input.size() > SERVER_MAX_LINE) {
+            closeConnection(fd);
+            return;
+        }
+        flushResponses(fd);
+        if (!isOpen(fd)) return;
+        
+        // A client that sends requests but does not read the answers is dropped
+        if (connection.output.size() > SERVER_MAX_OUTPUT) {
+            closeConnection(fd);
+        } else if (peerClosed && !connection.inputClosed) {
+            connection.inputClosed = true;
+            if (connection.output.empty()) {
+                closeConnection(fd);
+            } else {
+                watch(fd, EPOLLOUT, EPOLL_CTL_MOD);
+            }
+        }
+    }
+    
+    // Send the pending responses; wait for EPOLLOUT while the socket is full
+    void flushResponses(int fd) {
+        ServerConnection& connection = connections[fd];
+        size_t sentTotal = 0;
+        while (sentTotal < connection.output.size()) {
+            ssize_t sent = send(fd, connection.output.data() + sentTotal, connection.output.size() - sentTotal, NETWORK_SEND_FLAGS);
+            if (sent > 0) {
+                sentTotal += sent;
+            } else if (sent < 0 && errno == EINTR) {
+                continue;
+            } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
                 break;
+            } else {
+                closeConnection(fd);
+                return;
+            }
+        }
+        connection.output.erase(0, sentTotal);
+        if (connection.inputClosed && connection.output.empty()) {
+            closeConnection(fd);
+            return;
         }
         
-        // Process Player 1's move
-        if (movedP1) {
-            // Start animation timer
-            deltaTime = 0.0f;
-            lastFrameTime = std::chrono::steady_clock::now();
-            
-            addRandomTile();
-            checkWin();
-            checkGameOver();
+        bool needsWrite = !connection.output.empty();
+        if (needsWrite != connection.waitingToWrite) {
+            watch(fd, needsWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN, EPOLL_CTL_MOD);
+            connection.waitingToWrite = needsWrite;
         }
+    }
+    
+    void handleRequest(int fd, const char* line, size_t length) {
+        ServerConnection& connection = connections[fd];
+        std::string request(line, length);
+        if (!request.empty() && request.back() == '\r') request.pop_back();
         
-        // Process Player 2's move
-        if (movedP2) {
-            // Start animation timer
-            deltaTime = 0.0f;
-            lastFrameTime = std::chrono::steady_clock::now();
-            
-            addRandomTile();
-            checkWin();
-            checkGameOver();
+        char command[8] = {};
+        unsigned int id = 0;
+        char direction = 0;
+        int fields = sscanf(request.c_str(), "%7s %u %c", command, &id, &direction);
+        char response[96];
+        
+        if (fields >= 1 && std::strcmp(command, "NEW") == 0) {
+            Uint32 newId = startSession(fd);
+            const ServerSession& session = sessions[newId];
+            snprintf(response, sizeof(response), "OK %u %016llx %u\n", newId, 
+                     static_cast<unsigned long long>(session.board), session.score);
+        } else if (fields >= 1 && std::strcmp(command, "STATS") == 0) {
+            snprintf(response, sizeof(response), "OK %d %llu %llu\n", activeSessions, 
+                     static_cast<unsigned long long>(totalMoves), static_cast<unsigned long long>(getProcessCpuMicroseconds()));
+        } else if (fields >= 2 && (id >= sessions.size() || sessions[id].ownerFd != fd)) {
+            snprintf(response, sizeof(response), "ERR unknown session\n");
+        } else if (fields == 3 && std::strcmp(command, "MOVE") == 0) {
+            int moveDirection = getServerMoveDirection(direction);
+            if (moveDirection < 0) {
+                snprintf(response, sizeof(response), "ERR bad direction\n");
+            } else if (hasPackedTileLimit(sessions[id].board)) {
+                snprintf(response, sizeof(response), "ERR tile limit\n");
+            } else {
+                ServerSession& session = sessions[id];
+                Uint64 moved = movePackedBoard(session.board, moveDirection, session.score);
+                bool changed = (moved != session.board);
+                if (changed) {
+                    TileRng sessionRng(session.rngState);
+                    session.board = spawnPackedTile(moved, sessionRng);
+                    session.rngState = sessionRng.state;
+                    totalMoves++;
+                }
+                snprintf(response, sizeof(response), "OK %016llx %u %d %d\n", static_cast<unsigned long long>(session.board), 
+                         session.score, changed ? 1 : 0, getPackedGameOver(session.board));
+            }
+        } else if (fields == 2 && std::strcmp(command, "GET") == 0) {
+            const ServerSession& session = sessions[id];
+            snprintf(response, sizeof(response), "OK %016llx %u %d\n", static_cast<unsigned long long>(session.board), 
+                     session.score, getPackedGameOver(session.board));
+        } else if (fields == 2 && std::strcmp(command, "END") == 0) {
+            endSession(id);
+            std::vector<Uint32>& ids = connection.sessionIds;
+            ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+            snprintf(response, sizeof(response), "OK\n");
+        } else {
+            snprintf(response, sizeof(response), "ERR bad request\n");
+        }
+        
+        connection.output += response;
+    }
+    
+    int getServerMoveDirection(char letter) const {
+        switch (letter) {
+            case 'L': return MOVE_LEFT;
+            case 'R': return MOVE_RIGHT;
+            case 'U': return MOVE_UP;
+            case 'D': return MOVE_DOWN;
+        }
+        return -1;
+    }
+    
+    // New game with two tiles, like restart(); freed slots are reused first
+    Uint32 startSession(int fd) {
+        Uint32 id;
+        if (!freeSessions.empty()) {
+            id = freeSessions.back();
+            freeSessions.pop_back();
+        } else {
+            id = static_cast<Uint32>(sessions.size());
+            sessions.push_back(ServerSession());
         }
+        
+        ServerSession& session = sessions[id];
+        TileRng sessionRng(rng());
+        session.board = spawnPackedTile(spawnPackedTile(0, sessionRng), sessionRng);
+        session.rngState = sessionRng.state;
+        session.score = 0;
+        session.ownerFd = fd;
+        connections[fd].sessionIds.push_back(id);
+        activeSessions++;
+        return id;
     }
+    
+    void endSession(Uint32 id) {
+        if (sessions[id].ownerFd < 0) return;
+        sessions[id].ownerFd = -1;
+        freeSessions.push_back(id);
+        activeSessions--;
+    }
+    
+    int epollFd;
+    int listenFd;
+    std::vector<ServerConnection> connections; // Indexed by socket
+    std::vector<ServerSession> sessions;       // Indexed by session id
+    std::vector<Uint32> freeSessions;
+    Uint64 totalMoves;
+    int activeSessions;
+    TileRng rng; // Seeds of new sessions
+};
+
+enum LoadTestRequestKind {
+LOAD_TEST_NEW,
+LOAD_TEST_MOVE,
+LOAD_TEST_END
+};
+
+// A load test request in flight; the server answers them in order
+struct LoadTestRequest {
+LoadTestRequestKind kind;
+int slot; // Index into the connection's sessionIds
+std::chrono::steady_clock::time_point sentTime;
+};
+
+// One load test connection: its sessions and the requests in flight
+struct LoadTestConnection {
+int fd;
+std::vector<Uint32> sessionIds;
+std::deque<LoadTestRequest> pending;
+std::string input;
+std::string output;
+int movesLeft; // Moves that changed a board still to play; a move that changes nothing does not count
+};
+
+void queueLoadTestRequest(LoadTestConnection& connection, LoadTestRequestKind kind, int slot) {
+char request[32];
+if (kind == LOAD_TEST_NEW) {
+    snprintf(request, sizeof(request), "NEW\n");
+} else if (kind == LOAD_TEST_END) {
+    snprintf(request, sizeof(request), "END %u\n", connection.sessionIds[slot]);
+} else {
+    static const char directionLetters[4] = {'L', 'R', 'U', 'D'};
+    static TileRng moveRng(HEADLESS_DEFAULT_SEED);
+    snprintf(request, sizeof(request), "MOVE %u %c\n", connection.sessionIds[slot], directionLetters[moveRng() % 4]);
 }
+connection.output += request;
 
-void render() {
-    switch (currentState) {
-        case MENU:
-            renderMenu();
-            break;
-        case PLAYING:
-            renderGameBoard();
-            break;
-        case MULTIPLAYER:
-            renderMultiplayerGameBoard();
-            break;
-        case HOW_TO_PLAY:
-            renderHowToPlay();
-            break;
-        case GAME_OVER:
-            renderGameOver();
-            break;
-        case MULTIPLAYER_GAME_OVER:
-            renderMultiplayerGameOver();
-            break;
-    }
+LoadTestRequest inFlight;
+inFlight.kind = kind;
+inFlight.slot = slot;
+inFlight.sentTime = std::chrono::steady_clock::now();
+connection.pending.push_back(inFlight);
 }
 
-void run() {
-    // Main game loop
-    bool quitApplication = false;
-    Uint32 frameStart;
-    const int FPS = 60;
-    const int frameDelay = 1000 / FPS;
+// Blocking STATS request on its own connection: total moves and server CPU time
+bool requestServerStats(const std::string& host, int port, Uint64& moves, Uint64& cpuMicroseconds) {
+int fd = connectToHost(host, port);
+if (fd < 0) return false;
+
+const char request[] = "STATS\n";
+bool ok = send(fd, request, sizeof(request) - 1, NETWORK_SEND_FLAGS) == static_cast<ssize_t>(sizeof(request) - 1);
+std::string response;
+char chunk[128];
+while (ok && response.find('\n') == std::string::npos) {
+    ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+    if (received <= 0) ok = false;
+    else response.append(chunk, received);
+}
+close(fd);
+
+int sessionCount = 0;
+unsigned long long movesValue = 0;
+unsigned long long cpuValue = 0;
+if (!ok || sscanf(response.c_str(), "OK %d %llu %llu", &sessionCount, &movesValue, &cpuValue) != 3) return false;
+moves = movesValue;
+cpuMicroseconds = cpuValue;
+return true;
+}
+
+// --load-test host:port [sessions] [moves]: plays sessions games of moves random moves each
+// on the server, spread over up to LOAD_TEST_MAX_CONNECTIONS connections with one request per
+// session in flight (a finished game is replaced by a new one). Only moves that change the
+// board count, as on the server. Prints moves per second, the round trip percentiles of all
+// MOVE requests and, from the server's STATS, its move count and how many sessions one core
+// holds at this rate.
+int runLoadTest(const std::string& host, int port, int sessionCount, int movesPerSession) {
+sessionCount = std::max(1, sessionCount);
+int connectionCount = std::min(sessionCount, LOAD_TEST_MAX_CONNECTIONS);
+Uint64 startMoves = 0;
+Uint64 startCpu = 0;
+if (!requestServerStats(host, port, startMoves, startCpu)) {
+    std::cerr << "Could not reach the game server at " << host << ":" << port << std::endl;
+    return 1;
+}
+
+int epollFd = epoll_create1(0);
+if (epollFd < 0) {
+    std::cerr << "epoll_create1 failed: " << std::strerror(errno) << std::endl;
+    return 1;
+}
+std::vector<LoadTestConnection> connections(connectionCount);
+for (int c = 0; c < connectionCount; c++) {
+    LoadTestConnection& connection = connections[c];
+    connection.fd = connectToHost(host, port);
+    if (connection.fd < 0) {
+        std::cerr << "Could not open load test connection " << c << std::endl;
+        return 1;
+    }
+    configurePeerSocket(connection.fd);
     
-    while (!quitApplication) {
-        frameStart = SDL_GetTicks();
+    int sessionsHere = sessionCount / connectionCount + (c < sessionCount % connectionCount ? 1 : 0);
+    connection.sessionIds.assign(sessionsHere, 0);
+    connection.movesLeft = sessionsHere * movesPerSession;
+    for (int slot = 0; slot < sessionsHere; slot++) {
+        queueLoadTestRequest(connection, LOAD_TEST_NEW, slot);
+    }
+    
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT;
+    event.data.u32 = static_cast<Uint32>(c);
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, connection.fd, &event);
+}
+
+std::vector<float> latencies;
+latencies.reserve(static_cast<size_t>(sessionCount) * movesPerSession);
+Uint64 boardMoves = 0;
+int finishedConnections = 0;
+auto start = std::chrono::steady_clock::now();
+epoll_event events[SERVER_EPOLL_EVENTS];
+
+while (finishedConnections < connectionCount) {
+    int count = epoll_wait(epollFd, events, SERVER_EPOLL_EVENTS, -1);
+    for (int i = 0; i < count; i++) {
+        LoadTestConnection& connection = connections[events[i].data.u32];
         
-        // Kiểm tra xem có cần lưu game tự động không
-        if (SDL_GetTicks() - lastAutoSaveTime > AUTO_SAVE_INTERVAL && 
-            (currentState == PLAYING || currentState == MULTIPLAYER)) {
-            saveGame();
-            lastAutoSaveTime = SDL_GetTicks();
+        char chunk[4096];
+        ssize_t received;
+        while ((received = recv(connection.fd, chunk, sizeof(chunk), 0)) > 0) {
+            connection.input.append(chunk, received);
+        }
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            std::cerr << "The game server closed a load test connection" << std::endl;
+            return 1;
         }
         
-        // Process all pending events
-        SDL_Event e;
-        while (SDL_PollEvent(&e) != 0) {
-            if (e.type == SDL_QUIT) {
-                saveGame(); // Lưu game khi thoát
-                quitApplication = true;
-                break;
+        // Each response answers the oldest request in flight and is followed by the next
+        // request of the same session
+        size_t lineStart = 0;
+        size_t lineEnd;
+        while ((lineEnd = connection.input.find('\n', lineStart)) != std::string::npos) {
+            const char* response = connection.input.c_str() + lineStart;
+            lineStart = lineEnd + 1;
+            if (connection.pending.empty()) {
+                std::cerr << "Game server sent a response to no request" << std::endl;
+                return 1;
             }
+            LoadTestRequest answered = connection.pending.front();
+            connection.pending.pop_front();
             
-            // Handle input based on current state
-            switch (currentState) {
-                case MENU:
-                    handleMenuInput(e);
-                    break;
-                case PLAYING:
-                    handleGameInput(e);
-                    break;
-                case MULTIPLAYER:
-                    handleMultiplayerInput(e);
-                    break;
-                case HOW_TO_PLAY:
-                    handleHowToPlayInput(e);
-                    break;
-                case GAME_OVER:
-                    handleGameOverInput(e);
-                    break;
-                case MULTIPLAYER_GAME_OVER:
-                    handleMultiplayerGameOverInput(e);
-                    break;
+            if (std::strncmp(response, "OK", 2) != 0) {
+                std::cerr << "Game server error: " << std::string(response, connection.input.c_str() + lineEnd) << std::endl;
+                return 1;
+            }
+            
+            bool gameOver = false;
+            if (answered.kind == LOAD_TEST_NEW) {
+                unsigned int id = 0;
+                if (sscanf(response, "OK %u", &id) != 1) {
+                    std::cerr << "Bad NEW response: " << std::string(response, connection.input.c_str() + lineEnd) << std::endl;
+                    return 1;
+                }
+                connection.sessionIds[answered.slot] = id;
+            } else if (answered.kind == LOAD_TEST_MOVE) {
+                auto now = std::chrono::steady_clock::now();
+                latencies.push_back(std::chrono::duration<float, std::milli>(now - answered.sentTime).count());
+                unsigned long long board = 0;
+                unsigned int score = 0;
+                int moved = 0;
+                int over = 0;
+                if (sscanf(response, "OK %llx %u %d %d", &board, &score, &moved, &over) != 4) {
+                    std::cerr << "Bad MOVE response: " << std::string(response, connection.input.c_str() + lineEnd) << std::endl;
+                    return 1;
+                }
+                gameOver = (over != 0);
+                if (moved == 1) {
+                    connection.movesLeft--;
+                    boardMoves++;
+                }
+            } else {
+                continue; // END: the NEW sent with it carries on
+            }
+            
+            if (connection.movesLeft <= 0) continue;
+            if (gameOver) {
+                queueLoadTestRequest(connection, LOAD_TEST_END, answered.slot);
+                queueLoadTestRequest(connection, LOAD_TEST_NEW, answered.slot);
+            } else {
+                queueLoadTestRequest(connection, LOAD_TEST_MOVE, answered.slot);
             }
         }
+        connection.input.erase(0, lineStart);
         
-        // Update animations if needed
-        if (animating) {
-            updateAnimations();
-        }
-        
-        // Check if we should exit the application
-        if (gameOver && currentState == MENU) {
-            saveGame(); // Lưu game khi thoát
-            quitApplication = true;
-        }
+        ssize_t sent = connection.output.empty() ? 0 : send(connection.fd, connection.output.data(), connection.output.size(), NETWORK_SEND_FLAGS);
+        if (sent > 0) connection.output.erase(0, sent);
         
-        // Render the current state
-        render();
+        // Wait for writability only while requests are left over
+        epoll_event event = {};
+        event.events = connection.output.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT);
+        event.data.u32 = events[i].data.u32;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
         
-        // Cap frame rate for smoother animations
-        int frameTime = SDL_GetTicks() - frameStart;
-        if (frameDelay > frameTime) {
-            SDL_Delay(frameDelay - frameTime);
+        if (connection.movesLeft <= 0 && connection.pending.empty()) {
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, connection.fd, nullptr);
+            close(connection.fd);
+            finishedConnections++;
         }
     }
 }
+close(epollFd);
+
+double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+Uint64 endMoves = 0;
+Uint64 endCpu = 0;
+double serverCpuShare = 0.0;
+bool serverStats = requestServerStats(host, port, endMoves, endCpu);
+if (serverStats) {
+    serverCpuShare = (endCpu - startCpu) / (seconds * 1000000.0);
+}
+
+std::sort(latencies.begin(), latencies.end());
+auto latencyAt = [&latencies](double fraction) {
+    return latencies.empty() ? 0.0f : latencies[static_cast<size_t>((latencies.size() - 1) * fraction)];
 };
 
+char line[256];
+snprintf(line, sizeof(line), "Load test: %d sessions on %d connections, %llu moves (%zu MOVE requests) in %.2f s, %.0f moves/s", 
+         sessionCount, connectionCount, static_cast<unsigned long long>(boardMoves), latencies.size(), seconds, boardMoves / seconds);
+std::cout << line << std::endl;
+snprintf(line, sizeof(line), "Move round trip (ms): p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f",
+         latencyAt(0.5), latencyAt(0.99), latencyAt(0.999), latencyAt(1.0));
+std::cout << line << std::endl;
+if (serverStats) {
+    // The server's own count also includes the moves of any other client it served meanwhile
+    Uint64 serverMoves = endMoves - startMoves;
+    snprintf(line, sizeof(line), "Server counted %llu moves", static_cast<unsigned long long>(serverMoves));
+    std::cout << line << std::endl;
+    if (serverCpuShare > 0.0) {
+        snprintf(line, sizeof(line), "Server CPU %.1f%% of one core: %.0f sessions per core, %.0f moves per core second",
+                 serverCpuShare * 100.0, sessionCount / serverCpuShare, serverMoves / (seconds * serverCpuShare));
+        std::cout << line << std::endl;
+    }
+}
+return 0;
+}
+#endif
+
+// The batch environment library (-DGAME2048_ENV_LIBRARY) exports the C API without the game
+#ifndef GAME2048_ENV_LIBRARY
+// Command line options, printed when an argument cannot be parsed
+void printUsage(const char* program) {
+std::cerr << "Usage: " << program << " [options]\n"
+          << "  --headless-render [script] [--hashes file] [--golden file] [--seed N]\n"
+          << "  --render-benchmark [moves] [--seed N]\n"
+          << "  --check-rules [boards] [--seed N]             packed board rules against the game's moves\n"
+          << "  --startup-profile [--audio-buffer samples]\n"
+          << "  --players N                                   multiplayer boards, 2-8\n"
+          << "  --host [port] | --join host[:port]            networked two player game\n"
+          << "  --server [port] | --load-test host[:port] [sessions] [moves]   headless game server, Linux\n"
+          << "  --bot [unix socket path] [--bot-binary] [--no-window]          external agent plays, stdin/stdout by default\n"
+          << "  --env-benchmark [boards] [steps]              batch environment C API\n"
+          << "  --mc-benchmark [playouts] [threads]           Monte Carlo player throughput\n"
+          << "  --train-ntuple [epochs] [games per epoch] [threads] [--weights file]   value network self-play training\n";
+}
+
 int main(int argc, char* args[]) {
+bool headlessRender = false;
+bool startupProfile = false;
+int audioChunkSize = DEFAULT_AUDIO_CHUNK_SIZE;
+bool renderBenchmark = false;
+int benchmarkMoves = BENCHMARK_DEFAULT_MOVES;
+bool checkRules = false;
+int ruleCheckBoards = RULE_CHECK_DEFAULT_BOARDS;
+int playerCount = DEFAULT_PLAYER_COUNT;
+bool hostGame = false;
+std::string joinHost;
+int networkPort = NETWORK_DEFAULT_PORT;
+bool serverMode = false;
+std::string loadTestHost;
+int serverPort = SERVER_DEFAULT_PORT;
+int loadTestSessions = LOAD_TEST_DEFAULT_SESSIONS;
+int loadTestMoves = LOAD_TEST_DEFAULT_MOVES;
+bool envBenchmark = false;
+int envBoards = ENV_BENCHMARK_DEFAULT_BOARDS;
+int envSteps = ENV_BENCHMARK_DEFAULT_STEPS;
+bool monteCarloBenchmark = false;
+bool trainNTuple = false;
+int trainEpochs = NTUPLE_DEFAULT_EPOCHS;
+int trainEpochGames = NTUPLE_DEFAULT_EPOCH_GAMES;
+std::string weightsPath;
+int monteCarloPlayouts = MONTE_CARLO_DEFAULT_PLAYOUTS;
+int workerThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency())); // --mc-benchmark, --train-ntuple
+bool botMode = false;
+bool botBinary = false;
+bool noWindow = false;
+std::string botSocketPath;
+std::string scriptPath;
+std::string hashesPath;
+std::string goldenPath;
+unsigned int seed = HEADLESS_DEFAULT_SEED;
+// std::stoi throws on numbers that are malformed or out of range
+try {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = args[i];
+        if (arg == "--headless-render") {
+            headlessRender = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') scriptPath = args[++i];
+        } else if (arg == "--render-benchmark") {
+            renderBenchmark = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') benchmarkMoves = std::stoi(args[++i]);
+        } else if (arg == "--check-rules") {
+            checkRules = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') ruleCheckBoards = std::stoi(args[++i]);
+        } else if (arg == "--startup-profile") {
+            startupProfile = true;
+        } else if (arg == "--audio-buffer" && i + 1 < argc) {
+            audioChunkSize = std::stoi(args[++i]);
+        } else if (arg == "--players" && i + 1 < argc) {
+            playerCount = std::stoi(args[++i]);
+        } else if (arg == "--host") {
+            hostGame = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') networkPort = std::stoi(args[++i]);
+        } else if (arg == "--join" && i + 1 < argc) {
+            joinHost = args[++i];
+            size_t colon = joinHost.rfind(':');
+            if (colon != std::string::npos) {
+                networkPort = std::stoi(joinHost.substr(colon + 1));
+                joinHost = joinHost.substr(0, colon);
+            }
+        } else if (arg == "--env-benchmark") {
+            envBenchmark = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') envBoards = std::stoi(args[++i]);
+            if (i + 1 < argc && args[i + 1][0] != '-') envSteps = std::stoi(args[++i]);
+        } else if (arg == "--mc-benchmark") {
+            monteCarloBenchmark = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') monteCarloPlayouts = std::stoi(args[++i]);
+            if (i + 1 < argc && args[i + 1][0] != '-') workerThreads = std::stoi(args[++i]);
+        } else if (arg == "--train-ntuple") {
+            trainNTuple = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') trainEpochs = std::stoi(args[++i]);
+            if (i + 1 < argc && args[i + 1][0] != '-') trainEpochGames = std::stoi(args[++i]);
+            if (i + 1 < argc && args[i + 1][0] != '-') workerThreads = std::stoi(args[++i]);
+        } else if (arg == "--weights" && i + 1 < argc) {
+            weightsPath = args[++i];
+        } else if (arg == "--bot") {
+            botMode = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') botSocketPath = args[++i];
+        } else if (arg == "--bot-binary") {
+            botBinary = true;
+        } else if (arg == "--no-window") {
+            noWindow = true;
+        } else if (arg == "--server") {
+            serverMode = true;
+            if (i + 1 < argc && args[i + 1][0] != '-') serverPort = std::stoi(args[++i]);
+        } else if (arg == "--load-test" && i + 1 < argc) {
+            loadTestHost = args[++i];
+            size_t colon = loadTestHost.rfind(':');
+            if (colon != std::string::npos) {
+                serverPort = std::stoi(loadTestHost.substr(colon + 1));
+                loadTestHost = loadTestHost.substr(0, colon);
+            }
+            if (i + 1 < argc && args[i + 1][0] != '-') loadTestSessions = std::stoi(args[++i]);
+            if (i + 1 < argc && args[i + 1][0] != '-') loadTestMoves = std::stoi(args[++i]);
+        } else if (arg == "--hashes" && i + 1 < argc) {
+            hashesPath = args[++i];
+        } else if (arg == "--golden" && i + 1 < argc) {
+            goldenPath = args[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = static_cast<unsigned int>(std::stoul(args[++i]));
+        }
+    }
+} catch (const std::exception&) {
+    printUsage(args[0]);
+    return 1;
+}
+// Counts of games, playouts and threads must be positive
+if (trainEpochs < 1 || trainEpochGames < 1 || monteCarloPlayouts < 1 || workerThreads < 1) {
+    printUsage(args[0]);
+    return 1;
+}
+
+if (envBenchmark) {
+    return runEnvBenchmark(envBoards, envSteps);
+}
+
+if (monteCarloBenchmark) {
+    return runMonteCarloBenchmark(monteCarloPlayouts, workerThreads);
+}
+
+if (trainNTuple) {
+    return runNTupleTraining(weightsPath.empty() ? NTUPLE_WEIGHTS_PATH : weightsPath, trainEpochs, trainEpochGames,
+                             workerThreads);
+}
+
+// The game server and its load generator need no window, audio or SDL
+if (serverMode || !loadTestHost.empty()) {
+#ifdef __linux__
+    if (serverMode) {
+        GameServer server;
+        return server.run(serverPort);
+    }
+    return runLoadTest(loadTestHost, serverPort, loadTestSessions, loadTestMoves);
+#else
+    std::cerr << "--server and --load-test use epoll and need Linux" << std::endl;
+    return 1;
+#endif
+}
+
 Game2048 game;
 
-if (!game.initialize()) {
+// On stdin/stdout the bot protocol owns stdout; everything else printed goes to stderr
+if (botMode && botSocketPath.empty()) {
+    std::cout.rdbuf(std::cerr.rdbuf());
+}
+
+// The rule check only runs the move functions and needs no SDL
+if (checkRules) {
+    return game.runRuleCheck(ruleCheckBoards, seed);
+}
+
+// A bot without a window needs no SDL: only the game rules run
+if (botMode && noWindow) {
+    return game.runBot(botSocketPath, botBinary);
+}
+
+if (!game.initialize(headlessRender || renderBenchmark, startupProfile, audioChunkSize)) {
     std::cerr << "Failed to initialize game!" << std::endl;
     return 1;
 }
+game.setSelectedPlayerCount(playerCount);
+
+if (renderBenchmark) {
+    return game.runRenderBenchmark(benchmarkMoves, seed);
+}
+
+if (headlessRender) {
+    std::string script = HEADLESS_DEFAULT_SCRIPT;
+    if (!scriptPath.empty()) {
+        std::ifstream scriptFile(scriptPath);
+        if (!scriptFile.is_open()) {
+            std::cerr << "Could not open headless script " << scriptPath << std::endl;
+            return 1;
+        }
+        std::stringstream contents;
+        contents << scriptFile.rdbuf();
+        script = contents.str();
+    }
+    return game.runHeadlessRender(script, hashesPath, goldenPath, seed);
+}
+
+// The AI and hints use the trained network when there is one, else Monte Carlo search
+if (!game.loadValueNetwork(weightsPath.empty() ? NTUPLE_WEIGHTS_PATH : weightsPath) && !weightsPath.empty()) {
+    std::cerr << "Could not load n-tuple weights from " << weightsPath << std::endl;
+    return 1;
+}
+
+if ((hostGame || !joinHost.empty()) && !game.startNetwork(hostGame, joinHost, networkPort)) {
+    return 1;
+}
+if (botMode && !game.startBot(botSocketPath, botBinary, true)) {
+    return 1;
+}
 
 game.run();
 
 return 0;
 }
-
+#endif